@@ -0,0 +1,137 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <iostream>
+#include <list>
+#include <string>
+
+using index_type = adaptive_key_index<int, std::list<int>>;
+using layout = index_type::layout;
+
+/**
+ * Checks that the index migrates between layouts without losing entries.
+ */
+void index_migrations() {
+    index_type index;
+    assert(index.current_layout() == layout::small);
+
+    for (int k = 0; k < 20; ++k) {
+        index.try_emplace(k).first->push_back(k * 10);
+    }
+    // Too many keys for the small layout
+    assert(index.current_layout() == layout::hashed);
+
+    // Frequent ordered scans make the ordered layout cheaper
+    for (std::size_t i = 0; i < index_type::reshape_period; ++i) {
+        index.record(false, 1, 20);
+    }
+    assert(index.current_layout() == layout::ordered);
+
+    for (int k = 0; k < 20; ++k) {
+        assert(index.find(k) && index.find(k)->front() == k * 10);
+    }
+
+    for (int k = 2; k < 20; ++k) {
+        index.erase(index.find(k));
+    }
+    // Only a few keys are left
+    for (std::size_t i = 0; i < index_type::reshape_period; ++i) {
+        index.record(true, 0, 2);
+    }
+    assert(index.current_layout() == layout::small);
+    assert(index.size() == 2);
+    assert(index.find(1)->front() == 10);
+    assert(!index.find(5));
+}
+
+/**
+ * The same scans pay off in the ordered layout for keys with many elements,
+ * but not for keys with one element each, whose pushes and pops create and erase keys.
+ */
+void elements_per_key() {
+    for (const std::size_t per_key : { std::size_t(1), std::size_t(100) }) {
+        index_type index;
+        for (int k = 0; k < 20; ++k) {
+            index.try_emplace(k).first->push_back(k);
+        }
+        assert(index.current_layout() == layout::hashed);
+        // 5 scans of 20 keys cost more than 64 lookups, but less than 64 key insertions and erasures
+        index.record(false, 5, 20 * per_key);
+        for (std::size_t i = 1; i < index_type::reshape_period; ++i) {
+            index.record(false, 0, 20 * per_key);
+        }
+        assert(index.statistics().fifo_ops == 0);
+        assert(index.current_layout() == (per_key == 1 ? layout::hashed : layout::ordered));
+    }
+}
+
+/**
+ * Runs the same operations on keyed_queue and simple list model.
+ */
+void queue_matches_model(int keys, int elements) {
+    keyed_queue<int, int> q;
+    std::list<std::pair<int, int>> model;
+
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % keys, i);
+        model.push_back({ i % keys, i });
+    }
+    for (int i = 0; i < elements / 3; ++i) {
+        const int k = (i * 7) % keys;
+        if (q.count(k) > 0) {
+            q.pop(k);
+            for (auto e = model.begin(); e != model.end(); ++e) {
+                if (e->first == k) {
+                    model.erase(e);
+                    break;
+                }
+            }
+        }
+        if (i % 5 == 0) {
+            q.pop();
+            model.pop_front();
+        }
+    }
+
+    assert(q.size() == model.size());
+    int previous = -1;
+    std::size_t distinct = 0;
+    for (auto it = q.k_begin(), end = q.k_end(); it != end; ++it) {
+        assert(*it > previous);
+        previous = *it;
+        ++distinct;
+    }
+    std::size_t expected_distinct = 0;
+    for (int k = 0; k < keys; ++k) {
+        if (q.count(k) > 0) ++expected_distinct;
+    }
+    assert(distinct == expected_distinct);
+
+    while (!model.empty()) {
+        assert(q.front().first == model.front().first);
+        assert(q.front().second == model.front().second);
+        q.pop();
+        model.pop_front();
+    }
+    assert(q.empty());
+}
+
+int main() {
+    index_migrations();
+    elements_per_key();
+
+    // Few keys with many elements, many keys with one element
+    queue_matches_model(3, 3000);
+    queue_matches_model(5000, 5000);
+    queue_matches_model(100, 10000);
+
+    keyed_queue<std::string, int> names;
+    for (int i = 0; i < 100; ++i) {
+        names.push("key" + std::to_string(i % 30), i);
+    }
+    names.move_to_back("key0");
+    assert(names.back().second == 90 && names.first("key0").second == 0);
+    assert(*names.k_begin() == "key0");
+
+    std::cout << "OK!\n";
+    return 0;
+}
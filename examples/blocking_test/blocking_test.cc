@@ -0,0 +1,239 @@
+#include "blocking_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::chrono_literals;
+
+/**
+ * Timeouts on full and empty queues, per-key quotas.
+ */
+void timeouts_and_quotas() {
+    blocking_keyed_queue<int, std::string> q(3, 2);
+    assert(q.capacity() == 3 && q.empty());
+
+    assert(!q.extract_for(5ms));
+    assert(q.push_for(1, "a", 5ms));
+    assert(q.push_for(1, "b", 5ms));
+    // Key 1 reached its quota, key 2 still fits
+    std::string value = "c";
+    assert(!q.push_for(1, std::move(value), 5ms));
+    assert(value == "c");
+    assert(q.push_for(2, "d", 5ms));
+    // Queue is full
+    assert(!q.push_for(3, "e", 5ms));
+    assert(q.size() == 3 && q.count(1) == 2);
+
+    assert(!q.extract_for(3, 5ms));
+    auto e = q.extract_for(2, 5ms);
+    assert(e && e->second == "d");
+    assert(q.extract().second == "a");
+    assert(q.extract(1).second == "b");
+    assert(q.empty());
+}
+
+/**
+ * Producers block on the full queue until the consumer makes room.
+ */
+void backpressure(int producers, int per_producer) {
+    blocking_keyed_queue<int, int> q(8, 3);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&q, p, per_producer] {
+            for (int i = 0; i < per_producer; ++i) {
+                q.push(p, i);
+            }
+        });
+    }
+    std::vector<int> expected(producers, 0);
+    std::size_t max_size = 0;
+    for (int i = 0; i < producers * per_producer; ++i) {
+        max_size = std::max(max_size, q.size());
+        auto e = q.extract();
+        assert(e.second == expected[e.first]++);
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(max_size <= 8);
+    assert(q.empty());
+}
+
+/**
+ * Batches are returned when full or when the linger expires.
+ */
+void linger_batches() {
+    blocking_keyed_queue<int, int> q(100);
+    for (int i = 0; i < 10; ++i) {
+        q.push(i % 2, i);
+    }
+    auto full = q.consume(4, 1s);
+    assert(full.size() == 4);
+    for (int i = 0; i < 4; ++i) {
+        assert(full[i].second == i);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    auto partial = q.consume(50, 20ms);
+    assert(std::chrono::steady_clock::now() - start >= 20ms);
+    assert(partial.size() == 6 && partial.back().second == 9);
+
+    assert(q.consume(5, 1ms).empty());
+
+    // Batch completed by a producer wakes the consumer before the linger expires
+    std::thread producer([&q] {
+        for (int i = 0; i < 5; ++i) {
+            std::this_thread::sleep_for(1ms);
+            q.push(7, i);
+        }
+    });
+    auto waited = q.consume(5, 10s);
+    producer.join();
+    assert(waited.size() == 5);
+}
+
+/**
+ * Watermark callbacks fire once per crossing.
+ */
+void watermarks() {
+    blocking_keyed_queue<int, int> q(10);
+    int highs = 0;
+    int lows = 0;
+    q.set_watermarks(5, 2, [&highs] { ++highs; }, [&lows] { ++lows; });
+    for (int round = 0; round < 3; ++round) {
+        for (int i = 0; i < 7; ++i) {
+            q.push(i, i);
+        }
+        assert(highs == round + 1 && lows == round);
+        while (!q.empty()) {
+            q.extract();
+        }
+        assert(lows == round + 1);
+    }
+    // Batch consumption crosses the low watermark too
+    for (int i = 0; i < 6; ++i) {
+        q.push(i, i);
+    }
+    q.consume(10, 1ms);
+    assert(highs == 4 && lows == 4);
+}
+
+/**
+ * Threads waiting for their own keys get exactly their elements.
+ */
+void keyed_waiters(int keys, int waiters_per_key, int per_waiter) {
+    blocking_keyed_queue<int, int> q(1000000);
+    std::atomic<int> received{ 0 };
+    std::atomic<bool> wrong_key{ false };
+    std::vector<std::thread> threads;
+    for (int k = 0; k < keys; ++k) {
+        for (int w = 0; w < waiters_per_key; ++w) {
+            threads.emplace_back([&, k, per_waiter] {
+                for (int i = 0; i < per_waiter; ++i) {
+                    if (q.extract(k).first != k) {
+                        wrong_key = true;
+                    }
+                    ++received;
+                }
+            });
+        }
+    }
+    // Give the waiters time to register before the pushes
+    std::this_thread::sleep_for(10ms);
+    for (int i = 0; i < per_waiter * waiters_per_key; ++i) {
+        for (int k = 0; k < keys; ++k) {
+            q.push(k, i);
+        }
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(!wrong_key);
+    assert(received == keys * waiters_per_key * per_waiter);
+    assert(q.empty());
+}
+
+/**
+ * Keyed waiters time out, and elements stolen by other consumers do not lose the waiter.
+ */
+void keyed_timeouts() {
+    blocking_keyed_queue<int, int> q(100);
+    q.push(1, 1);
+    assert(!q.extract_for(2, 5ms));
+    std::atomic<int> got{ 0 };
+    std::thread waiter([&q, &got] {
+        auto e = q.extract_for(2, 10s);
+        assert(e);
+        got = e->second;
+    });
+    std::this_thread::sleep_for(5ms);
+    q.push(2, 21);
+    // Try to steal the element, then the waiter gets the next one
+    const auto stolen = q.extract_for(2, 1ms);
+    q.push(2, 22);
+    waiter.join();
+    if (stolen) {
+        assert(stolen->second == 21 && got == 22);
+        assert(q.size() == 1);
+    } else {
+        assert(got == 21);
+        assert(q.size() == 2 && q.extract(2).second == 22);
+    }
+    assert(q.extract().second == 1);
+}
+
+/**
+ * A consumed batch wakes as many producers as it freed slots; every push wakes one sleeping consumer.
+ */
+void batch_wakeups() {
+    blocking_keyed_queue<int, int> q(4, 0, 0);
+    for (int i = 0; i < 4; ++i) {
+        q.push(i, i);
+    }
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; ++p) {
+        producers.emplace_back([&q, p] { q.push(10 + p, p); });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    assert(q.consume(4, std::chrono::milliseconds(0)).size() == 4);
+    for (auto& t : producers) {
+        t.join();
+    }
+    assert(q.size() == 4);
+
+    q.consume(4, std::chrono::milliseconds(0));
+    std::atomic<int> taken{ 0 };
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < 4; ++c) {
+        consumers.emplace_back([&q, &taken] {
+            q.extract();
+            taken.fetch_add(1);
+        });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (int i = 0; i < 4; ++i) {
+        q.push(i, i);
+    }
+    for (auto& t : consumers) {
+        t.join();
+    }
+    assert(taken.load() == 4 && q.empty());
+}
+
+int main() {
+    timeouts_and_quotas();
+    backpressure(1, 1000);
+    backpressure(4, 500);
+    linger_batches();
+    watermarks();
+    keyed_waiters(1, 4, 100);
+    keyed_waiters(50, 2, 20);
+    keyed_timeouts();
+    batch_wakeups();
+    std::cout << "blocking_keyed_queue: all tests passed\n";
+    return 0;
+}
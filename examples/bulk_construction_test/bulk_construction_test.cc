@@ -0,0 +1,120 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+using queue = keyed_queue<int, int>;
+
+template <class Clock>
+long long micros(typename Clock::time_point a, typename Clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+}
+
+void assert_equal(queue a, queue b, int keys) {
+    assert(a.size() == b.size());
+    for (int k = 0; k < keys; k += 3) {
+        assert(a.count(k) == b.count(k));
+        while (a.count(k) > 0) {
+            assert(a.first(k).second == b.first(k).second);
+            assert(a.last(k).second == b.last(k).second);
+            a.pop(k);
+            b.pop(k);
+        }
+    }
+    while (!a.empty()) {
+        assert(a.front().first == b.front().first);
+        assert(a.front().second == b.front().second);
+        a.pop();
+        b.pop();
+    }
+    assert(b.empty());
+}
+
+queue pushed_queue(std::vector<std::pair<int, int>> const& input) {
+    queue pushed;
+    for (auto const& e : input) {
+        pushed.push(e.first, e.second);
+    }
+    return pushed;
+}
+
+/**
+ * Best times of a few builds by pushing and by the bulk constructor (in microseconds).
+ * Runs alternate between the ways (push bulk bulk push ...), so both see the same conditions,
+ * and a single slow run does not decide.
+ */
+std::pair<long long, long long> best_build_times(std::vector<std::pair<int, int>> const& input) {
+    using clock = std::chrono::steady_clock;
+    long long best[2] = { -1, -1 };
+    for (int i = 0; i < 4; ++i) {
+        const int bulk = (i % 4 == 1 || i % 4 == 2) ? 1 : 0;
+        const auto start = clock::now();
+        {
+            queue q = bulk ? queue(input.begin(), input.end()) : pushed_queue(input);
+        }
+        const long long time = micros<clock>(start, clock::now());
+        if (best[bulk] < 0 || time < best[bulk]) {
+            best[bulk] = time;
+        }
+    }
+    return { best[0], best[1] };
+}
+
+void bulk_matches_push(int keys, int elements) {
+    std::vector<std::pair<int, int>> input;
+    input.reserve(elements);
+    for (int i = 0; i < elements; ++i) {
+        // Scatter keys so groups are not contiguous in the input
+        input.push_back({ static_cast<int>((i * 7919LL) % keys), i });
+    }
+
+    queue pushed = pushed_queue(input);
+    queue bulk(input.begin(), input.end());
+    queue parallel(input.begin(), input.end(), parallel_policy(4, 1000));
+    queue sequential(input.begin(), input.end(), parallel_policy::sequential());
+
+    // Bulk construction is not slower than pushing, and much faster for many keys
+    // (up to the timing noise; a noisy measurement is repeated)
+    const bool many_keys = keys * 4 >= elements;
+    const auto fast_enough = [many_keys](std::pair<long long, long long> const& t) {
+        return many_keys ? t.second * 4 <= t.first * 3 : t.second * 4 <= t.first * 5;
+    };
+    std::pair<long long, long long> times;
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        times = best_build_times(input);
+        if (fast_enough(times)) {
+            break;
+        }
+    }
+    std::cout << keys << " keys, " << elements << " elements: push " << times.first
+              << "us, bulk " << times.second << "us\n";
+    assert(fast_enough(times));
+
+    assert_equal(pushed, bulk, keys);
+    assert_equal(pushed, parallel, keys);
+    assert_equal(pushed, sequential, keys);
+}
+
+int main() {
+    bulk_matches_push(1, 1000);
+    bulk_matches_push(3, 300000);
+    bulk_matches_push(1000, 300000);
+    bulk_matches_push(300000, 300000);
+
+    std::vector<std::pair<int, int>> empty;
+    queue nothing(empty.begin(), empty.end(), parallel_policy(4, 1));
+    assert(nothing.empty());
+
+    // Bulk constructed queue behaves like any other one
+    std::vector<std::pair<int, int>> small = { {2, 1}, {1, 2}, {2, 3} };
+    queue q(small.begin(), small.end());
+    q.move_to_back(2);
+    q.push(1, 4);
+    assert(q.front().second == 2 && q.back().second == 4 && q.last(2).second == 3);
+    assert(*q.k_begin() == 1);
+
+    std::cout << "OK!\n";
+    return 0;
+}
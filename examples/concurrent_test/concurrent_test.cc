@@ -0,0 +1,168 @@
+#include "concurrent_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * Single threaded semantics match the keyed_queue.
+ */
+void sequential_semantics() {
+    concurrent_keyed_queue<int, int> q(3);
+    keyed_queue<int, int> reference;
+    for (int i = 0; i < 100; ++i) {
+        q.push(i % 7, i);
+        reference.push(i % 7, i);
+    }
+    q.move_to_back(3);
+    reference.move_to_back(3);
+    q.pop(5);
+    reference.pop(5);
+
+    assert(q.size() == reference.size());
+    for (int k = 0; k < 7; ++k) {
+        assert(q.count(k) == reference.count(k));
+        assert(q.first(k).second == reference.first(k).second);
+        assert(q.last(k).second == reference.last(k).second);
+    }
+    while (!reference.empty()) {
+        assert(q.front().first == reference.front().first);
+        const auto e = q.extract();
+        assert(e.first == reference.front().first);
+        assert(e.second == reference.front().second);
+        reference.pop();
+    }
+    assert(q.empty());
+    assert(!q.try_extract());
+    assert(!q.try_extract(1));
+
+    bool thrown = false;
+    try {
+        q.pop();
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    q.push(1, 1);
+    q.push(2, 2);
+    q.clear();
+    assert(q.empty() && q.count(1) == 0 && !q.try_front());
+}
+
+/**
+ * Producers push ascending values for their own keys while consumers pop concurrently.
+ * Every element must be popped exactly once and in per-key order.
+ */
+void producers_and_consumers(int producers, int consumers, int per_producer) {
+    concurrent_keyed_queue<int, std::unique_ptr<int>> q;
+    std::atomic<int> remaining{ producers * per_producer };
+    std::vector<std::map<int, int>> last_seen(consumers);
+    std::atomic<bool> order_ok{ true };
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&q, p, per_producer] {
+            for (int i = 0; i < per_producer; ++i) {
+                // Every producer owns 4 keys
+                q.push(p * 4 + i % 4, std::make_unique<int>(i));
+            }
+        });
+    }
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&, c] {
+            while (remaining.load() > 0) {
+                auto e = (c % 2 == 0) ? q.try_extract() : q.try_extract(c % (producers * 4));
+                if (!e) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                auto& last = last_seen[c];
+                // Values of a key grow, so one consumer never sees them out of order
+                if (last.count(e->first) && last[e->first] >= *e->second) {
+                    order_ok = false;
+                }
+                last[e->first] = *e->second;
+                --remaining;
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(order_ok);
+    assert(remaining.load() == 0);
+    assert(q.empty());
+    assert(!q.try_extract());
+}
+
+/**
+ * move_to_back from many threads keeps all the elements.
+ */
+void concurrent_move_to_back() {
+    concurrent_keyed_queue<int, int> q(4);
+    for (int i = 0; i < 1000; ++i) {
+        q.push(i % 10, i);
+    }
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; ++t) {
+        threads.emplace_back([&q, t] {
+            for (int i = 0; i < 200; ++i) {
+                q.move_to_back((t + i) % 10);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(q.size() == 1000);
+    std::map<int, int> last;
+    for (int i = 0; i < 1000; ++i) {
+        const auto e = q.extract();
+        if (last.count(e.first)) {
+            assert(last[e.first] < e.second);
+        }
+        last[e.first] = e.second;
+    }
+    assert(q.empty());
+}
+
+/**
+ * Keyed pops and move_to_back() behind a pinned front element leave stale head entries;
+ * they are compacted away and the global order stays right.
+ */
+void stale_head_entries(int cycles) {
+    concurrent_keyed_queue<int, int> q(4);
+    q.push(0, -1);
+    for (int i = 0; i < cycles; ++i) {
+        q.push(1, i);
+        q.push(1, i + 1);
+        q.pop(1);
+        q.pop(1);
+        q.push(2, i);
+        q.move_to_back(2);
+        q.pop(2);
+    }
+    q.push(3, 3);
+    q.push(4, 4);
+    q.move_to_back(3);
+    assert(q.size() == 3);
+    assert(q.extract() == std::make_pair(0, -1));
+    assert(q.extract() == std::make_pair(4, 4));
+    assert(q.extract() == std::make_pair(3, 3));
+    assert(!q.try_extract());
+}
+
+int main() {
+    sequential_semantics();
+    producers_and_consumers(1, 1, 10000);
+    producers_and_consumers(4, 4, 5000);
+    producers_and_consumers(8, 2, 2000);
+    concurrent_move_to_back();
+    stale_head_entries(100000);
+    std::cout << "concurrent_keyed_queue: all tests passed\n";
+    return 0;
+}
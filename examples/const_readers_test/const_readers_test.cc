@@ -0,0 +1,101 @@
+#include "keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+/**
+ * Counts copies of the values.
+ */
+struct counted {
+    static std::atomic<int> copies;
+    int value;
+    counted(int v = 0): value(v) {}
+    counted(counted const& c): value(c.value) { ++copies; }
+    counted& operator=(counted const& c) { value = c.value; ++copies; return *this; }
+};
+std::atomic<int> counted::copies{ 0 };
+
+/**
+ * Const accessors do not change the sharing state: copies made after them still share the data.
+ */
+template <class Q>
+void const_access_keeps_sharing() {
+    Q q;
+    for (int i = 0; i < 100; ++i) {
+        q.push(i % 10, counted(i));
+    }
+    Q const& view = q;
+    counted::copies = 0;
+
+    assert(view.front().second.value == 0);
+    assert(view.back().second.value == 99);
+    assert(view.first(3).second.value == 3);
+    assert(view.last(3).second.value == 93);
+
+    Q copy = q;
+    assert(counted::copies == 0);
+    // Captured const reference stays valid and unchanged while the copy is modified
+    auto const& first = view.front().second;
+    copy.front().second.value = -1;
+    assert(counted::copies == 100);
+    assert(first.value == 0);
+    assert(view.front().second.value == 0);
+    assert(copy.front().second.value == -1);
+
+    // Mutable access still makes the data private
+    q.front().second.value = 7;
+    counted::copies = 0;
+    Q other = q;
+    assert(counted::copies == 100);
+    q.front().second.value = 8;
+    assert(other.front().second.value == 7);
+}
+
+/**
+ * Many threads call the const API on the same queue without synchronisation.
+ */
+void concurrent_const_reads(int threads) {
+    keyed_queue<int, int> q;
+    for (int i = 0; i < 10000; ++i) {
+        q.push(i % 100, i);
+    }
+    keyed_queue<int, int> const& shared = q;
+    std::atomic<bool> ok{ true };
+    std::vector<std::thread> readers;
+    for (int t = 0; t < threads; ++t) {
+        readers.emplace_back([&shared, &ok, t] {
+            for (int round = 0; round < 200; ++round) {
+                const int k = (t * 31 + round) % 100;
+                if (shared.size() != 10000 || shared.empty() || shared.count(k) != 100) {
+                    ok = false;
+                }
+                if (shared.front().second != 0 || shared.back().second != 9999) {
+                    ok = false;
+                }
+                if (shared.first(k).second != k || shared.last(k).second != 9900 + k) {
+                    ok = false;
+                }
+                // Copies share the data in O(1) and can be used privately
+                keyed_queue<int, int> copy = shared;
+                copy.pop(k);
+                if (copy.first(k).second != 100 + k || shared.first(k).second != k) {
+                    ok = false;
+                }
+            }
+        });
+    }
+    for (auto& r : readers) {
+        r.join();
+    }
+    assert(ok);
+}
+
+int main() {
+    const_access_keeps_sharing<keyed_queue<int, counted>>();
+    const_access_keeps_sharing<keyed_queue<int, counted, hashed_index, contiguous_storage>>();
+    concurrent_const_reads(4);
+    std::cout << "const readers: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,142 @@
+#include "async_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Minimal fire-and-forget coroutine used by the tests.
+ */
+struct task {
+    struct promise_type {
+        task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() { std::terminate(); }
+    };
+};
+
+using queue = async_keyed_queue<int, std::string>;
+
+task consume_any(queue& q, std::vector<std::string>& out, int n) {
+    for (int i = 0; i < n; ++i) {
+        auto e = co_await q.async_pop();
+        out.push_back(e.second);
+    }
+}
+
+task consume_key(queue& q, int key, std::vector<std::string>& out, int n) {
+    for (int i = 0; i < n; ++i) {
+        auto e = co_await q.async_pop(key);
+        assert(e.first == key);
+        out.push_back(e.second);
+    }
+}
+
+task drain_all(queue& q, std::vector<std::string>& out, bool& finished) {
+    auto stream = q.drain();
+    while (auto e = co_await stream.next()) {
+        out.push_back(e->second);
+    }
+    finished = true;
+}
+
+task pop_closed(queue& q, bool& thrown) {
+    try {
+        co_await q.async_pop(5);
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+}
+
+/**
+ * Elements go to the waiting coroutines in the order of their arrival, keyed waiters get only their keys.
+ */
+void inline_resumption() {
+    queue q;
+    q.push(1, "ready");
+    std::vector<std::string> any, keyed;
+    consume_any(q, any, 3);
+    // The element available right away does not suspend
+    assert(any.size() == 1 && any[0] == "ready");
+    consume_key(q, 2, keyed, 2);
+
+    q.push(2, "k2-a");   // the any-waiter is older, it waits again behind the keyed waiter
+    q.push(2, "k2-b");   // the keyed waiter is older now
+    q.push(3, "k3");     // only the any-waiter takes key 3
+    q.push(2, "k2-c");
+    assert(any == (std::vector<std::string>{ "ready", "k2-a", "k3" }));
+    assert(keyed == (std::vector<std::string>{ "k2-b", "k2-c" }));
+    assert(q.size() == 0);
+    q.push(2, "k2-d");
+    assert(q.count(2) == 1);
+
+    bool finished = false;
+    std::vector<std::string> drained;
+    drain_all(q, drained, finished);
+    q.push(4, "x");
+    q.push(5, "y");
+    bool thrown = false;
+    pop_closed(q, thrown);
+    q.close();
+    assert(finished && thrown);
+    assert(drained == (std::vector<std::string>{ "k2-d", "x", "y" }));
+}
+
+/**
+ * Coroutines are resumed by the user executor, never on the pushing thread.
+ */
+void custom_executor() {
+    std::deque<std::coroutine_handle<>> scheduled;
+    queue q([&scheduled](std::coroutine_handle<> h) { scheduled.push_back(h); });
+    std::vector<std::string> out;
+    consume_key(q, 7, out, 2);
+    q.push(7, "a");
+    assert(out.empty() && scheduled.size() == 1);
+    q.push(7, "b");
+    assert(q.count(7) == 1);
+    while (!scheduled.empty()) {
+        auto h = scheduled.front();
+        scheduled.pop_front();
+        h.resume();
+    }
+    assert(out == (std::vector<std::string>{ "a", "b" }));
+}
+
+/**
+ * Pushes from other threads resume the coroutines waiting on the main thread.
+ */
+void cross_thread(int producers, int per_producer) {
+    queue q;
+    std::vector<std::string> out;
+    bool finished = false;
+    drain_all(q, out, finished);
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&q, p, per_producer] {
+            for (int i = 0; i < per_producer; ++i) {
+                q.push(p, std::to_string(i));
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    q.close();
+    assert(finished);
+    assert(out.size() == static_cast<std::size_t>(producers * per_producer));
+}
+
+int main() {
+    inline_resumption();
+    custom_executor();
+    cross_thread(4, 1000);
+    std::cout << "async_keyed_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,135 @@
+#include "keyed_queue.h"
+#include "eventfd_notifier.h"
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <poll.h>
+#include <sys/epoll.h>
+
+/**
+ * Checks if the descriptor is readable right now.
+ */
+bool readable(int fd) {
+    pollfd p{ fd, POLLIN, 0 };
+    return ::poll(&p, 1, 0) == 1 && (p.revents & POLLIN);
+}
+
+/**
+ * Queue readiness: bursts cost one write, the descriptor fires on the empty to non-empty transition.
+ */
+template <class Q>
+void queue_readiness() {
+    auto notifier = std::make_shared<eventfd_notifier>();
+    Q q;
+    q.set_notifier(notifier);
+    assert(!readable(notifier->fd()));
+
+    for (int i = 0; i < 100; ++i) {
+        q.push(i % 3, i);
+    }
+    assert(readable(notifier->fd()));
+    assert(notifier->reset() == 1);
+    assert(!readable(notifier->fd()));
+
+    // Non-empty queue does not notify again
+    q.push(5, 5);
+    assert(!readable(notifier->fd()));
+    q.clear();
+    q.push(5, 5);
+    assert(readable(notifier->fd()));
+    notifier->reset();
+
+    // Copies do not notify
+    Q copy = q;
+    copy.clear();
+    copy.push(1, 1);
+    assert(!readable(notifier->fd()));
+
+    q.set_notifier(nullptr);
+    q.clear();
+    q.push(1, 1);
+    assert(!readable(notifier->fd()));
+}
+
+/**
+ * Watched keys fire when they get their first element.
+ */
+void key_readiness() {
+    auto watched = std::make_shared<eventfd_notifier>();
+    keyed_queue<int, int> q;
+    q.watch(7, watched);
+    q.push(1, 1);
+    assert(!readable(watched->fd()));
+    q.push(7, 1);
+    q.push(7, 2);
+    assert(readable(watched->fd()));
+    assert(watched->reset() == 1);
+    q.push(7, 3);
+    assert(!readable(watched->fd()));
+    q.pop(7);
+    q.pop(7);
+    q.pop(7);
+    q.push(7, 4);
+    assert(readable(watched->fd()));
+    watched->reset();
+    q.watch(7, nullptr);
+    q.pop(7);
+    q.push(7, 5);
+    assert(!readable(watched->fd()));
+}
+
+/**
+ * Producer thread pushes under a mutex, the consumer waits on epoll.
+ */
+void epoll_consumer(int elements) {
+    auto notifier = std::make_shared<eventfd_notifier>();
+    keyed_queue<int, int> q;
+    q.set_notifier(notifier);
+    std::mutex lock;
+
+    const int ep = ::epoll_create1(EPOLL_CLOEXEC);
+    assert(ep >= 0);
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = notifier->fd();
+    assert(::epoll_ctl(ep, EPOLL_CTL_ADD, notifier->fd(), &ev) == 0);
+
+    std::thread producer([&] {
+        for (int i = 0; i < elements; ++i) {
+            std::lock_guard<std::mutex> guard(lock);
+            q.push(i % 4, i);
+        }
+    });
+
+    int received = 0;
+    int wakeups = 0;
+    while (received < elements) {
+        epoll_event out;
+        const int n = ::epoll_wait(ep, &out, 1, 5000);
+        assert(n == 1);
+        ++wakeups;
+        notifier->reset();
+        std::lock_guard<std::mutex> guard(lock);
+        while (!q.empty()) {
+            assert(q.front().second == received);
+            q.pop();
+            ++received;
+        }
+    }
+    producer.join();
+    ::close(ep);
+    assert(wakeups <= elements);
+    std::cout << elements << " elements, " << wakeups << " wakeups\n";
+}
+
+int main() {
+    queue_readiness<keyed_queue<int, int>>();
+    queue_readiness<keyed_queue<int, int, unique_ownership, basic_guarantee>>();
+    key_readiness();
+    epoll_consumer(10000);
+    std::cout << "eventfd notifier: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include "keyed_executor.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * Tasks of the key run one at the time in the submission order.
+ */
+void serial_per_key(unsigned threads, int keys, int per_key) {
+    keyed_executor<int> executor(threads);
+    assert(executor.thread_count() == threads);
+
+    std::vector<std::vector<int>> done(keys);
+    std::vector<std::atomic<int>> in_flight(keys);
+    std::atomic<bool> overlap{ false };
+
+    for (int i = 0; i < per_key; ++i) {
+        for (int k = 0; k < keys; ++k) {
+            executor.submit(k, [&, k, i] {
+                if (in_flight[k].fetch_add(1) != 0) {
+                    overlap = true;
+                }
+                // Not synchronised: tasks of the key must never overlap
+                done[k].push_back(i);
+                in_flight[k].fetch_sub(1);
+            });
+        }
+    }
+    executor.wait_idle();
+    assert(executor.pending() == 0);
+    assert(!overlap);
+    for (int k = 0; k < keys; ++k) {
+        assert(static_cast<int>(done[k].size()) == per_key);
+        for (int i = 0; i < per_key; ++i) {
+            assert(done[k][i] == i);
+        }
+    }
+}
+
+/**
+ * Different keys run in parallel: two tasks wait for each other.
+ */
+void parallel_keys() {
+    keyed_executor<std::string> executor(2);
+    std::atomic<int> arrived{ 0 };
+    auto meet = [&arrived] {
+        ++arrived;
+        while (arrived.load() < 2) {
+            std::this_thread::yield();
+        }
+    };
+    executor.submit("a", meet);
+    executor.submit("b", meet);
+    executor.wait_idle();
+    assert(arrived.load() == 2);
+}
+
+/**
+ * Move-only tasks, tasks submitting more tasks and exceptions.
+ */
+void move_only_and_errors() {
+    keyed_executor<int> executor(3);
+    std::atomic<int> sum{ 0 };
+    for (int i = 0; i < 100; ++i) {
+        auto value = std::make_unique<int>(i);
+        executor.submit(i % 5, [value = std::move(value), &sum] { sum += *value; });
+    }
+    executor.submit(1, [&executor, &sum] {
+        executor.submit(1, [&sum] { sum += 1000; });
+    });
+    executor.wait_idle();
+    assert(sum.load() == 4950 + 1000);
+
+    executor.submit(2, [] { throw std::runtime_error("task failed"); });
+    executor.submit(2, [&sum] { ++sum; });
+    bool thrown = false;
+    try {
+        executor.wait_idle();
+    } catch (std::runtime_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+    // Failure does not stop the key
+    assert(sum.load() == 5951);
+    executor.wait_idle();
+}
+
+/**
+ * Destructor runs the pending tasks.
+ */
+void shutdown_runs_pending() {
+    std::atomic<int> count{ 0 };
+    {
+        keyed_executor<int> executor(2);
+        for (int i = 0; i < 1000; ++i) {
+            executor.submit(i % 3, [&count] { ++count; });
+        }
+    }
+    assert(count.load() == 1000);
+}
+
+/**
+ * Tasks submitted after shutdown are rejected instead of staying in the queue forever.
+ */
+void submit_after_shutdown() {
+    std::atomic<int> count{ 0 };
+    keyed_executor<int> executor(2);
+    executor.submit(1, [&count] { ++count; });
+    executor.shutdown();
+    bool thrown = false;
+    try {
+        executor.submit(1, [&count] { ++count; });
+    } catch (std::logic_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(executor.pending() == 0);
+    executor.wait_idle();
+    assert(count.load() == 1);
+}
+
+int main() {
+    serial_per_key(1, 10, 100);
+    serial_per_key(4, 3, 2000);
+    serial_per_key(8, 64, 200);
+    parallel_keys();
+    move_only_and_errors();
+    shutdown_runs_pending();
+    submit_after_shutdown();
+    std::cout << "keyed_executor: all tests passed\n";
+    return 0;
+}
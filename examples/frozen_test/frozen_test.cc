@@ -0,0 +1,139 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using clock_type = std::chrono::steady_clock;
+
+long long micros(clock_type::time_point a, clock_type::time_point b) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+}
+
+template <class Queue>
+void matches(Queue q, frozen_keyed_queue<int, std::string> const& f, int keys) {
+    assert(q.size() == f.size());
+    if (q.empty()) {
+        assert(f.empty());
+        return;
+    }
+    assert(q.front().first == f.front().first && q.front().second == f.front().second);
+    assert(q.back().first == f.back().first && q.back().second == f.back().second);
+    for (int k = 0; k < keys + 2; ++k) {
+        assert(q.count(k) == f.count(k));
+        if (q.count(k) > 0) {
+            assert(q.first(k).second == f.first(k).second);
+            assert(q.last(k).second == f.last(k).second);
+        }
+        // Values of the key in the queue order
+        auto values = f.values(k);
+        assert(values.size() == q.count(k));
+        for (auto const& v : values) {
+            assert(q.first(k).second == v);
+            q.pop(k);
+        }
+        assert(q.count(k) == 0);
+    }
+    // Keys are iterated in the sorted order
+    int previous = -1;
+    for (auto i = f.k_begin(); i != f.k_end(); ++i) {
+        assert(*i > previous);
+        previous = *i;
+    }
+}
+
+template <class Queue>
+void freeze_and_thaw(int keys, int elements) {
+    Queue q;
+    for (int i = 0; i < elements; ++i) {
+        q.push((i * 31) % keys, std::to_string(i));
+    }
+    auto f = q.freeze();
+    matches(q, f, keys);
+
+    // Full iteration in the queue order
+    auto copy = q;
+    for (auto e : f) {
+        assert(e.first == copy.front().first);
+        assert(e.second == copy.front().second);
+        copy.pop();
+    }
+    assert(copy.empty());
+
+    // Thawed queue is equal to the original and mutable
+    auto thawed = f.thaw();
+    matches(thawed, f, keys);
+    auto parallel = f.template thaw<unique_ownership>(parallel_policy(4, 100));
+    matches(parallel, f, keys);
+    thawed.push(keys, "new");
+    assert(thawed.size() == f.size() + 1);
+}
+
+void empty_queue() {
+    keyed_queue<int, std::string> q;
+    auto f = q.freeze();
+    assert(f.empty());
+    assert(f.count(1) == 0);
+    assert(f.values(1).empty());
+    bool thrown = false;
+    try {
+        f.front();
+    } catch (lookup_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        f.first(1);
+    } catch (lookup_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(f.thaw().empty());
+}
+
+void scan_speed(int keys, int elements) {
+    keyed_queue<int, long long> q;
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % keys, i);
+    }
+    auto f = q.freeze();
+
+    const auto t0 = clock_type::now();
+    long long list_sum = 0;
+    q.for_each(parallel_policy::sequential(), [&list_sum](int const&, long long const& v) { list_sum += v; });
+    const auto t1 = clock_type::now();
+    long long frozen_sum = 0;
+    for (auto e : f) {
+        frozen_sum += e.second;
+    }
+    const auto t2 = clock_type::now();
+    long long key_sum = 0;
+    for (int k = 0; k < keys; ++k) {
+        for (auto v : f.values(k)) {
+            key_sum += v;
+        }
+    }
+    const auto t3 = clock_type::now();
+    assert(list_sum == frozen_sum);
+    assert(list_sum == key_sum);
+
+    // Every element of keyed_queue takes at least a list node with the pair and a list node with its position
+    const std::size_t node_bytes = elements * (2 * sizeof(void*) + sizeof(std::pair<int, long long>) + 3 * sizeof(void*));
+    std::cout << elements << " elements, " << keys << " keys: scan keyed_queue " << micros(t0, t1) << "us, frozen "
+              << micros(t1, t2) << "us, frozen by keys " << micros(t2, t3) << "us; memory >= " << node_bytes
+              << "B vs " << f.memory_usage() << "B\n";
+    assert(f.memory_usage() < node_bytes);
+}
+
+int main() {
+    empty_queue();
+    freeze_and_thaw<keyed_queue<int, std::string>>(5, 100);
+    freeze_and_thaw<keyed_queue<int, std::string>>(500, 5000);
+    freeze_and_thaw<keyed_queue<int, std::string, ordered_index, contiguous_storage>>(50, 1000);
+    freeze_and_thaw<unique_keyed_queue<int, std::string>>(1000, 3000);
+    scan_speed(1000, 1000000);
+    std::cout << "frozen_test passed\n";
+    return 0;
+}
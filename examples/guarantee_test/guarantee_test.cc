@@ -0,0 +1,67 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <iostream>
+#include <string>
+
+/**
+ * Runs the same sequence of operations on queue of type Q
+ * and returns its final contents.
+ */
+template <class Q>
+std::string run_scenario() {
+    Q q;
+    for (int i = 0; i < 20; ++i) {
+        q.push(i % 4, i);
+    }
+
+    Q copy = q;
+    q.pop();
+    q.pop(2);
+    q.move_to_back(1);
+    q.push(7, 100);
+    q.pop(7);
+
+    assert(copy.size() == 20);
+    assert(q.size() == 18);
+    assert(q.count(2) == 4);
+    assert(q.count(7) == 0);
+    assert(q.front().second == 3);
+    assert(q.first(1).second == 1 && q.last(1).second == 17);
+
+    std::string result = q.to_string();
+    q.clear();
+    assert(q.empty() && q.count(1) == 0);
+    assert(copy.size() == 20 && copy.front().second == 0);
+    return result;
+}
+
+struct throwing_value {
+    int value;
+    throwing_value(int v): value(v) {}
+    throwing_value(throwing_value const& o): value(o.value) {}
+};
+
+std::ostream& operator<<(std::ostream& out, throwing_value const& v) {
+    return out << v.value;
+}
+
+bool operator==(throwing_value const& a, int b) {
+    return a.value == b;
+}
+
+int main() {
+    static_assert(keyed_queue_nothrow<int, int>::value, "int keys and values never throw");
+    static_assert(!keyed_queue_nothrow<int, throwing_value>::value, "throwing_value copy may throw");
+
+    const auto strong = run_scenario<keyed_queue<int, int, strong_guarantee>>();
+    const auto basic = run_scenario<keyed_queue<int, int, basic_guarantee>>();
+    const auto automatic = run_scenario<keyed_queue<int, int>>();
+    const auto throwing = run_scenario<keyed_queue<int, throwing_value>>();
+
+    std::cout << strong << "\n";
+    assert(strong == basic);
+    assert(strong == automatic);
+    assert(strong == throwing);
+
+    return 0;
+}
@@ -0,0 +1,99 @@
+#include "ingest_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Single producer: drain keeps the order and respects the batch size.
+ */
+void single_producer() {
+    ingest_keyed_queue<int, std::string> q;
+    assert(!q.pending());
+    assert(q.drain() == 0);
+    for (int i = 0; i < 10; ++i) {
+        q.push(i % 3, std::to_string(i));
+    }
+    assert(q.pending());
+    assert(q.drain(4) == 4);
+    assert(q.queue().size() == 4);
+    assert(q.drain() == 6);
+    assert(!q.pending());
+
+    auto& target = q.queue();
+    assert(target.count(0) == 4 && target.count(1) == 3 && target.count(2) == 3);
+    for (int i = 0; i < 10; ++i) {
+        assert(target.front().second == std::to_string(i));
+        target.pop();
+    }
+}
+
+/**
+ * Many producers push while the consumer drains in batches.
+ * No element is lost and the elements of every producer keep their order.
+ */
+void many_producers(int producers, int per_producer) {
+    ingest_keyed_queue<int, std::unique_ptr<int>> q;
+    std::atomic<int> finished{ 0 };
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&q, &finished, p, per_producer] {
+            for (int i = 0; i < per_producer; ++i) {
+                q.push(p, std::make_unique<int>(i));
+            }
+            ++finished;
+        });
+    }
+
+    std::vector<int> expected(producers, 0);
+    std::size_t total = 0;
+    while (true) {
+        const bool done = (finished.load() == producers);
+        total += q.drain(256);
+        auto& target = q.queue();
+        while (!target.empty()) {
+            auto e = target.extract();
+            assert(*e.second == expected[e.first]);
+            ++expected[e.first];
+        }
+        if (done && !q.pending()) {
+            break;
+        }
+        std::this_thread::yield();
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(total == static_cast<std::size_t>(producers * per_producer));
+    for (int p = 0; p < producers; ++p) {
+        assert(expected[p] == per_producer);
+    }
+}
+
+/**
+ * Pending elements are released with the queue.
+ */
+void destroy_pending() {
+    auto counter = std::make_shared<int>(0);
+    {
+        ingest_keyed_queue<int, std::shared_ptr<int>> q;
+        for (int i = 0; i < 100; ++i) {
+            q.push(i, counter);
+        }
+        q.drain(10);
+        assert(counter.use_count() == 101);
+    }
+    assert(counter.use_count() == 1);
+}
+
+int main() {
+    single_producer();
+    many_producers(1, 100000);
+    many_producers(4, 50000);
+    destroy_pending();
+    std::cout << "ingest_keyed_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,186 @@
+#include "message_group_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Leased keys are skipped, ack and nack release them.
+ */
+void leasing() {
+    message_group_queue<int, std::string> q;
+    q.push(1, "1a");
+    q.push(2, "2a");
+    q.push(1, "1b");
+    q.push(3, "3a");
+    q.push(2, "2b");
+
+    auto a = q.pop_next_unlocked();
+    assert(a.key() == 1 && a.value() == "1a" && q.is_locked(1));
+    // Key 1 is leased: its next element is skipped
+    auto b = q.pop_next_unlocked();
+    assert(b.key() == 2 && b.value() == "2a");
+    auto c = q.pop_next_unlocked();
+    assert(c.key() == 3 && c.value() == "3a");
+    assert(!q.try_pop_next_unlocked());
+    assert(q.size() == 2 && q.in_flight() == 3 && q.count(1) == 1);
+
+    bool thrown = false;
+    try {
+        q.pop_next_unlocked();
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    // Rejected element goes back before the later elements of all keys
+    q.nack(std::move(b));
+    q.ack(a);
+    assert(!q.is_locked(1) && q.is_locked(3));
+    auto d = q.pop_next_unlocked();
+    assert(d.key() == 2 && d.value() == "2a");
+    auto e = q.pop_next_unlocked();
+    assert(e.key() == 1 && e.value() == "1b");
+    assert(!q.try_pop_next_unlocked());
+
+    thrown = false;
+    try {
+        q.ack(a);
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    q.ack(c);
+    q.ack(d);
+    q.ack(e);
+    auto f = q.pop_next_unlocked();
+    assert(f.key() == 2 && f.value() == "2b");
+    q.ack(f);
+    assert(q.size() == 0 && q.in_flight() == 0 && !q.is_locked(2));
+}
+
+/**
+ * Move-only values are moved in and out of the leases.
+ */
+void move_only_values() {
+    message_group_queue<int, std::unique_ptr<int>> q;
+    q.push(1, std::make_unique<int>(1));
+    auto l = q.pop_next_unlocked();
+    assert(*l.value() == 1);
+    q.nack(std::move(l));
+    auto again = q.pop_next_unlocked();
+    assert(*again.value() == 1);
+    q.ack(again);
+}
+
+/**
+ * Value whose move constructor throws on demand, before taking anything from the source.
+ */
+struct fragile {
+    std::string text;
+    /** Number of moves left before the throwing one (negative: never throw) */
+    static int moves_left;
+
+    explicit fragile(std::string t): text(std::move(t)) {}
+    fragile(fragile const&) = default;
+    fragile(fragile&& o): text() {
+        if (moves_left >= 0 && moves_left-- == 0) {
+            throw std::runtime_error("move failed");
+        }
+        text = std::move(o.text);
+    }
+    fragile& operator=(fragile const&) = default;
+    fragile& operator=(fragile&&) = default;
+};
+
+int fragile::moves_left = -1;
+
+/**
+ * Rejected value is moved back exactly once; when that move throws the lease keeps the value.
+ */
+void nack_keeps_value() {
+    message_group_queue<int, fragile> q;
+    q.push(1, fragile("a"));
+    auto l = q.pop_next_unlocked();
+
+    fragile::moves_left = 0;
+    bool thrown = false;
+    try {
+        q.nack(std::move(l));
+    } catch (std::runtime_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(l.value().text == "a" && q.is_locked(1) && q.in_flight() == 1 && q.size() == 0);
+
+    // A second move would throw
+    fragile::moves_left = 1;
+    q.nack(std::move(l));
+    fragile::moves_left = -1;
+    assert(!q.is_locked(1) && q.size() == 1);
+    auto again = q.pop_next_unlocked();
+    assert(again.value().text == "a");
+    q.ack(again);
+}
+
+/**
+ * Consumers process keys concurrently, rejecting some elements: a key is never held by two
+ * consumers at once and its elements are processed in order, every element exactly once.
+ */
+void exclusive_consumers(int consumers, int keys, int per_key) {
+    message_group_queue<int, int> q;
+    for (int i = 0; i < per_key; ++i) {
+        for (int k = 0; k < keys; ++k) {
+            q.push(k, i);
+        }
+    }
+    std::vector<std::atomic<bool>> held(keys);
+    std::vector<int> processed(keys, 0);
+    std::atomic<int> done{ 0 };
+    std::vector<std::thread> threads;
+    for (int c = 0; c < consumers; ++c) {
+        threads.emplace_back([&, c] {
+            int attempts = 0;
+            while (done.load() < keys * per_key) {
+                auto l = q.try_pop_next_unlocked();
+                if (!l) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                const int k = l->key();
+                assert(!held[k].exchange(true));
+                assert(l->value() == processed[k]);
+                if (++attempts % 7 == c) {
+                    held[k].store(false);
+                    q.nack(std::move(*l));
+                    continue;
+                }
+                ++processed[k];
+                held[k].store(false);
+                q.ack(*l);
+                done.fetch_add(1);
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (int k = 0; k < keys; ++k) {
+        assert(processed[k] == per_key);
+    }
+    assert(q.size() == 0 && q.in_flight() == 0);
+}
+
+int main() {
+    leasing();
+    move_only_values();
+    nack_keeps_value();
+    exclusive_consumers(4, 16, 2000);
+    std::cout << "message_group_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,110 @@
+#include "monitored_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Value spanning several words; a torn copy would have different fields.
+ */
+struct sample {
+    long a;
+    long b;
+    long c;
+};
+
+/**
+ * Mirror follows every mutation of the owner.
+ */
+void mirror_follows_owner() {
+    monitored_keyed_queue<int, sample> q({ 1, 2 });
+    assert(q.size() == 0 && !q.front());
+    q.push(1, { 1, 1, 1 });
+    q.push(2, { 2, 2, 2 });
+    q.push(1, { 3, 3, 3 });
+    q.push(3, { 4, 4, 4 });
+    assert(q.size() == 4 && q.count(1) == 2 && q.count(2) == 1);
+    assert(q.front()->first == 1 && q.front()->second.a == 1);
+
+    q.move_to_back(1);
+    assert(q.front()->first == 2);
+    assert(q.extract().second.a == 2);
+    assert(q.count(2) == 0);
+    q.pop(1);
+    assert(q.count(1) == 1 && q.observe().size == 2);
+    assert(q.observe().front->first == 3);
+    q.clear();
+    assert(q.size() == 0 && q.count(1) == 0 && !q.observe().front);
+    assert(q.local().empty());
+
+    bool thrown = false;
+    try {
+        q.count(3);
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+/**
+ * Non trivially copyable values: counters are mirrored, the front element is not.
+ */
+void counters_only() {
+    monitored_keyed_queue<int, std::string> q({ 7 });
+    static_assert(!decltype(q)::mirrors_front, "strings are not trivially copyable");
+    q.push(7, "a");
+    q.push(8, "b");
+    assert(q.size() == 2 && q.count(7) == 1);
+    assert(q.extract(7).second == "a");
+    assert(q.count(7) == 0 && q.size() == 1);
+}
+
+/**
+ * Monitors poll while the owner mutates: copies are never torn and the size matches the front.
+ */
+void monitors_while_owner_mutates(int monitors, int operations) {
+    monitored_keyed_queue<int, sample> q({ 0, 1, 2 });
+    std::atomic<bool> done{ false };
+    std::vector<std::thread> threads;
+    std::atomic<long> observations{ 0 };
+    for (int m = 0; m < monitors; ++m) {
+        threads.emplace_back([&] {
+            long seen = 0;
+            while (!done.load()) {
+                const auto o = q.observe();
+                if (o.front) {
+                    assert(o.size > 0);
+                    assert(o.front->second.a == o.front->second.b && o.front->second.b == o.front->second.c);
+                    assert(o.front->second.a % 3 == o.front->first);
+                } else {
+                    assert(o.size == 0);
+                }
+                assert(q.count(1) <= 64);
+                ++seen;
+            }
+            observations.fetch_add(seen);
+        });
+    }
+    for (long i = 0; i < operations; ++i) {
+        q.push(static_cast<int>(i % 3), { i, i, i });
+        if (q.local().size() > 32) {
+            q.pop();
+        }
+    }
+    done.store(true);
+    for (auto& t : threads) {
+        t.join();
+    }
+    std::cout << observations.load() << " observations\n";
+}
+
+int main() {
+    mirror_follows_owner();
+    counters_only();
+    monitors_while_owner_mutates(3, 200000);
+    std::cout << "monitored_keyed_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,198 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Move-only owner of a resource, like a file descriptor
+class handle {
+    int fd;
+
+public:
+    static int open_handles;
+
+    explicit handle(int f): fd(f) { ++open_handles; }
+    handle(handle const&) = delete;
+    handle& operator=(handle const&) = delete;
+    handle(handle&& h) noexcept: fd(h.fd) { h.fd = -1; }
+    handle& operator=(handle&& h) noexcept {
+        std::swap(fd, h.fd);
+        return *this;
+    }
+    ~handle() {
+        if (fd >= 0) {
+            --open_handles;
+        }
+    }
+    int get() const { return fd; }
+};
+
+int handle::open_handles = 0;
+
+using message = std::unique_ptr<std::string>;
+
+static_assert(!std::is_copy_constructible<keyed_queue<int, message>>::value, "move-only queue must not be copyable");
+static_assert(!std::is_copy_assignable<keyed_queue<int, message>>::value, "move-only queue must not be copyable");
+static_assert(std::is_move_constructible<keyed_queue<int, message>>::value, "move-only queue must be movable");
+static_assert(std::is_copy_constructible<keyed_queue<int, int>>::value, "queue of copyable values stays copyable");
+
+template <class Queue>
+void messages() {
+    Queue q;
+    for (int i = 0; i < 10; ++i) {
+        q.push(i % 3, std::make_unique<std::string>("m" + std::to_string(i)));
+    }
+    assert(q.size() == 10);
+    assert(*q.front().second == "m0");
+    assert(*q.last(2).second == "m8");
+
+    auto first = q.extract();
+    assert(first.first == 0);
+    assert(*first.second == "m0");
+    assert(q.count(0) == 3);
+
+    auto keyed = q.extract(2);
+    assert(keyed.first == 2);
+    assert(*keyed.second == "m2");
+    assert(q.count(2) == 2);
+
+    q.move_to_back(1);
+    assert(*q.back().second == "m7");
+    q.pop(1);
+    assert(q.count(1) == 2);
+
+    // Values can be modified in place
+    *q.front().second += "!";
+    assert(*q.front().second == "m3!");
+
+    Queue moved(std::move(q));
+    assert(moved.size() == 7);
+    assert(q.empty());
+    q = std::move(moved);
+    assert(q.size() == 7);
+
+    bool thrown = false;
+    try {
+        q.extract(7);
+    } catch (lookup_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+
+    while (!q.empty()) {
+        q.extract();
+    }
+    thrown = false;
+    try {
+        q.extract();
+    } catch (lookup_error&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+void handles() {
+    {
+        keyed_queue<std::string, handle> q;
+        q.push("a", handle(3));
+        q.push("b", handle(4));
+        q.push("a", handle(5));
+        assert(handle::open_handles == 3);
+
+        handle h = q.extract("a").second;
+        assert(h.get() == 3);
+        q.pop("a");
+        assert(handle::open_handles == 2);
+        assert(q.front().second.get() == 4);
+    }
+    assert(handle::open_handles == 0);
+}
+
+void bulk_move() {
+    std::vector<std::pair<int, message>> input;
+    for (int i = 0; i < 100; ++i) {
+        input.emplace_back(i % 7, std::make_unique<std::string>(std::to_string(i)));
+    }
+    keyed_queue<int, message> q(std::make_move_iterator(input.begin()), std::make_move_iterator(input.end()));
+    assert(q.size() == 100);
+    assert(q.count(3) == 14);
+    assert(*q.first(3).second == "3");
+    assert(*q.last(6).second == "97");
+}
+
+void copyable_extract() {
+    keyed_queue<int, std::string> q;
+    std::string value = "value";
+    q.push(1, value);
+    q.push(1, std::move(value));
+    keyed_queue<int, std::string> copy = q;
+    assert(q.extract(1).second == "value");
+    assert(q.size() == 1);
+    assert(copy.size() == 2);
+}
+
+// Key whose copy and move may throw
+struct fragile_key {
+    static bool fail;
+    int id;
+
+    fragile_key(int i): id(i) {}
+    fragile_key(fragile_key const& k): id(k.id) {
+        if (fail) {
+            throw std::runtime_error("fragile_key copy");
+        }
+    }
+    fragile_key(fragile_key&& k): fragile_key(static_cast<fragile_key const&>(k)) {}
+    fragile_key& operator=(fragile_key const&) = default;
+
+    bool operator<(fragile_key const& k) const { return id < k.id; }
+    bool operator==(fragile_key const& k) const { return id == k.id; }
+};
+
+bool fragile_key::fail = false;
+
+/**
+ * Extraction failing on the key copy leaves the element (and its moved-only value) in the queue.
+ */
+void failed_extract_keeps_element() {
+    keyed_queue<fragile_key, std::unique_ptr<int>> q;
+    q.push(fragile_key(1), std::make_unique<int>(1));
+    q.push(fragile_key(2), std::make_unique<int>(2));
+    fragile_key::fail = true;
+    for (int attempt = 0; attempt < 2; ++attempt) {
+        bool thrown = false;
+        try {
+            if (attempt == 0) {
+                q.extract();
+            } else {
+                q.extract(fragile_key(2));
+            }
+        } catch (std::runtime_error const&) {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+    fragile_key::fail = false;
+    assert(q.size() == 2);
+    auto first = q.extract();
+    assert(first.first.id == 1 && first.second && *first.second == 1);
+    auto second = q.extract(fragile_key(2));
+    assert(second.second && *second.second == 2);
+}
+
+int main() {
+    messages<keyed_queue<int, message>>();
+    messages<keyed_queue<int, message, strong_guarantee>>();
+    messages<keyed_queue<int, message, basic_guarantee>>();
+    handles();
+    bulk_move();
+    copyable_extract();
+    failed_extract_keeps_element();
+    std::cout << "move_only_test passed\n";
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <utility>
+
+/**
+ * Checks that both queues hold the same elements in the same order
+ * and that the per-key order matches too.
+ */
+template <class Q>
+void assert_equal(Q a, Q b, int keys) {
+    assert(a.size() == b.size());
+    for (int k = 0; k < keys; ++k) {
+        assert(a.count(k) == b.count(k));
+        if (a.count(k) > 0) {
+            assert(a.first(k).second == b.first(k).second);
+            assert(a.last(k).second == b.last(k).second);
+        }
+    }
+    // Popping by key walks the per-key chains
+    for (int k = 0; k < keys; k += 7) {
+        while (a.count(k) > 0) {
+            assert(a.first(k).second == b.first(k).second);
+            a.pop(k);
+            b.pop(k);
+        }
+    }
+    while (!a.empty()) {
+        assert(a.front().first == b.front().first);
+        assert(a.front().second == b.front().second);
+        a.pop();
+        b.pop();
+    }
+    assert(b.empty());
+}
+
+/**
+ * Best times of a few clones with both policies (in microseconds).
+ * Runs alternate between the policies (a b b a ...), so both see the same conditions,
+ * and a single slow run does not decide.
+ */
+template <class Q>
+std::pair<long long, long long> best_clone_times(Q const& q, parallel_policy const& a, parallel_policy const& b) {
+    long long best[2] = { -1, -1 };
+    // Warm up the allocator
+    q.clone(a);
+    for (int i = 0; i < 4; ++i) {
+        const int which = (i % 4 == 1 || i % 4 == 2) ? 1 : 0;
+        const auto start = std::chrono::steady_clock::now();
+        Q copy = q.clone(which ? b : a);
+        const auto end = std::chrono::steady_clock::now();
+        const long long time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+        if (best[which] < 0 || time < best[which]) {
+            best[which] = time;
+        }
+    }
+    return { best[0], best[1] };
+}
+
+template <class Q>
+void clone_matches_copy(int keys, int elements) {
+    Q q;
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % keys, i);
+    }
+    q.move_to_back(0);
+
+    Q parallel = q.clone(parallel_policy(4, 1000));
+    Q sequential = q.clone(parallel_policy::sequential());
+
+    // With as many threads as the hardware runs the parallel clone is not slower than the sequential one
+    // (up to the timing noise; a noisy measurement is repeated)
+    std::pair<long long, long long> times;
+    for (int attempt = 0; attempt < 3; ++attempt) {
+        times = best_clone_times(q, parallel_policy(), parallel_policy::sequential());
+        if (times.first * 4 <= times.second * 5) {
+            break;
+        }
+    }
+    std::cout << keys << " keys, " << elements << " elements: parallel " << times.first
+              << "us, sequential " << times.second << "us\n";
+    assert(times.first * 4 <= times.second * 5);
+
+    // Clone must not share data with the source
+    parallel.front().second = -1;
+    assert(q.front().second != -1);
+    parallel.front().second = q.front().second;
+
+    assert_equal(q, parallel, keys);
+    assert_equal(q, sequential, keys);
+}
+
+int main() {
+    clone_matches_copy<keyed_queue<int, int>>(3, 200000);
+    clone_matches_copy<keyed_queue<int, int>>(200000, 200000);
+    clone_matches_copy<keyed_queue<int, int, strong_guarantee>>(1000, 100000);
+
+    // Detaching shared queue copies it once, afterwards writes do not copy
+    keyed_queue<int, int> source;
+    for (int i = 0; i < 50000; ++i) {
+        source.push(i % 100, i);
+    }
+    keyed_queue<int, int> shared = source;
+    shared.detach(parallel_policy(4, 1000));
+    shared.pop();
+    assert(source.size() == 50000 && shared.size() == 49999);
+    assert(source.front().second == 0 && shared.front().second == 1);
+
+    std::cout << "OK!\n";
+    return 0;
+}
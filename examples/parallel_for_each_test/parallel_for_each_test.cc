@@ -0,0 +1,76 @@
+#include "keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <vector>
+
+int main() {
+    const int keys = 50;
+    const int elements = 100000;
+    const parallel_policy policy(4, 1000);
+
+    keyed_queue<int, long> q;
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % keys, i);
+    }
+
+    // Read-only pass on a snapshot while the original keeps changing
+    const keyed_queue<int, long> snapshot = q;
+    q.pop();
+    q.push(keys, -1);
+
+    std::atomic<long> sum(0);
+    std::atomic<int> visited(0);
+    snapshot.for_each(policy, [&](int const& k, long const& v) {
+        assert(v % keys == k);
+        sum += v;
+        ++visited;
+    });
+    assert(visited == elements);
+    assert(sum == static_cast<long>(elements) * (elements - 1) / 2);
+
+    // Key groups get their values in queue order
+    std::vector<int> group_sizes(keys + 1, 0);
+    std::atomic<int> groups(0);
+    snapshot.for_each_key_group(policy, [&](int const& k, keyed_queue<int, long>::const_key_values values) {
+        long previous = -1;
+        int count = 0;
+        for (long v : values) {
+            assert(v % keys == k && v > previous);
+            previous = v;
+            ++count;
+        }
+        assert(static_cast<std::size_t>(count) == values.size());
+        group_sizes[k] = count;
+        ++groups;
+    });
+    assert(groups == keys);
+    for (int k = 0; k < keys; ++k) {
+        assert(group_sizes[k] == elements / keys);
+    }
+
+    // Modifying pass does not touch the snapshot
+    q.for_each(policy, [](int const&, long& v) {
+        v *= 2;
+    });
+    assert(q.front().second == 2 && q.back().second == -2);
+    assert(snapshot.front().second == 0);
+
+    q.for_each_key_group(policy, [](int const&, keyed_queue<int, long>::key_values values) {
+        for (long& v : values) {
+            v += 1;
+        }
+    });
+    assert(q.first(1).second == 3 && q.last(keys).second == -1);
+    assert(snapshot.first(1).second == 1);
+
+    // Mutable access through front() must not leak into shared copies
+    keyed_queue<int, long> a;
+    a.push(1, 1);
+    keyed_queue<int, long> b = a;
+    a.front().second = 5;
+    assert(b.front().second == 1);
+
+    std::cout << "OK!\n";
+    return 0;
+}
@@ -0,0 +1,116 @@
+#include "partitioned_keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Elements reach the partitions of their keys, local pushes skip the mailboxes.
+ */
+void routing() {
+    partitioned_keyed_queue<int, int, 3> q(4);
+    static_assert(std::is_same<decltype(q)::partition_queue, keyed_queue<int, int, unique_ownership>>::value,
+                  "partitions are not shared by default");
+    assert(q.partition_count() == 3);
+    for (int k = 0; k < 9; ++k) {
+        q.push(0, k, k * 10);
+    }
+    // Keys of partition 0 are already there, the others wait in the mailboxes
+    for (int k = 0; k < 9; ++k) {
+        assert(q.local(0).count(k) == (q.partition_of(k) == 0 ? 1u : 0u));
+    }
+    assert(q.local(0).size() == 3 && q.local(1).empty());
+    assert(q.poll(1, 2) == 2);
+    assert(q.poll(1) == 1);
+    assert(q.local(1).size() == 3);
+
+    auto e = q.try_extract(2);
+    assert(e && q.partition_of(e->first) == 2);
+    assert(q.try_extract(1) && q.local(1).size() == 2);
+
+    bool thrown = false;
+    try {
+        q.poll(3);
+    } catch (std::out_of_range const&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+/**
+ * A full mailbox makes the sender wait; elements of a key keep the order of the pushes.
+ */
+void full_mailbox() {
+    partitioned_keyed_queue<int, int, 2> q(2);
+    int remote = 0;
+    while (q.partition_of(remote) != 1) {
+        ++remote;
+    }
+    std::thread consumer([&q, remote] {
+        int expected = 0;
+        while (expected < 1000) {
+            if (auto e = q.try_extract(1)) {
+                assert(e->first == remote && e->second == expected);
+                ++expected;
+            }
+        }
+    });
+    for (int i = 0; i < 1000; ++i) {
+        q.push(0, remote, i);
+    }
+    consumer.join();
+}
+
+/**
+ * Every core pushes elements of keys shared with the other cores and consumes its own partition.
+ * Every element is taken once, by the owner of its key, and the elements of every (key, producer)
+ * pair come in the order of the pushes.
+ */
+void thread_per_core(int per_core) {
+    constexpr std::size_t cores = 4;
+    partitioned_keyed_queue<int, std::pair<int, int>, cores, unique_ownership> q(64);
+    std::atomic<int> taken{ 0 };
+    const int total = static_cast<int>(cores) * per_core;
+    std::vector<std::thread> threads;
+    for (std::size_t core = 0; core < cores; ++core) {
+        threads.emplace_back([&, core] {
+            std::map<std::pair<int, int>, int> last;
+            auto consume = [&] {
+                while (auto e = q.try_extract(core)) {
+                    assert(q.partition_of(e->first) == core);
+                    const auto id = std::make_pair(e->first, e->second.first);
+                    const auto it = last.find(id);
+                    assert(it == last.end() || it->second < e->second.second);
+                    last[id] = e->second.second;
+                    taken.fetch_add(1);
+                }
+            };
+            for (int i = 0; i < per_core; ++i) {
+                q.push(core, i % 13, std::make_pair(static_cast<int>(core), i));
+                if (i % 32 == 0) {
+                    consume();
+                }
+            }
+            while (taken.load() < total) {
+                consume();
+                std::this_thread::yield();
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(taken.load() == total);
+}
+
+int main() {
+    routing();
+    full_mailbox();
+    thread_per_core(20000);
+    std::cout << "partitioned_keyed_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,177 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+static_assert(std::is_same<keyed_queue_config<>::index, adaptive_index>::value, "default index");
+static_assert(std::is_same<keyed_queue_config<>::ownership, shared_ownership>::value, "default ownership");
+static_assert(std::is_same<keyed_queue_config<ordered_index, strong_guarantee, hashed_index>::index, hashed_index>::value,
+              "last policy of the category wins");
+static_assert(std::is_same<keyed_queue_config<ordered_index, strong_guarantee, hashed_index>::guarantee, strong_guarantee>::value,
+              "policies of other categories are kept");
+static_assert(!keyed_queue_is_policy<int>::value, "int is not a policy");
+
+using reference = keyed_queue<int, int>;
+
+// Runs the same mix of operations on the tested queue and the default one
+template <class Queue>
+void same_as_default(char const* name) {
+    using clock = std::chrono::steady_clock;
+    const auto start = clock::now();
+
+    Queue q;
+    reference r;
+    unsigned seed = 12345;
+    auto next = [&seed]() {
+        seed = seed * 1103515245u + 12345u;
+        return (seed >> 8) & 0xffff;
+    };
+    for (int i = 0; i < 20000; ++i) {
+        const int k = static_cast<int>(next() % 50);
+        switch (next() % 8) {
+            case 0:
+            case 1:
+            case 2:
+                q.push(k, i);
+                r.push(k, i);
+                break;
+            case 3:
+                if (!r.empty()) {
+                    assert(q.front().second == r.front().second);
+                    q.pop();
+                    r.pop();
+                }
+                break;
+            case 4:
+                assert(q.count(k) == r.count(k));
+                if (r.count(k) > 0) {
+                    assert(q.first(k).second == r.first(k).second);
+                    assert(q.last(k).second == r.last(k).second);
+                    q.pop(k);
+                    r.pop(k);
+                }
+                break;
+            case 5:
+                if (r.count(k) > 0) {
+                    q.move_to_back(k);
+                    r.move_to_back(k);
+                    assert(q.back().second == r.back().second);
+                }
+                break;
+            case 6: {
+                // Copies are independent regardless of the ownership policy
+                Queue copy = q;
+                copy.push(k, -1);
+                assert(copy.size() == q.size() + 1);
+                break;
+            }
+            default:
+                assert(q.size() == r.size());
+                break;
+        }
+    }
+
+    // Keys are iterated in the same (sorted) order
+    auto ri = r.k_begin();
+    for (auto qi = q.k_begin(); qi != q.k_end(); ++qi, ++ri) {
+        assert(*qi == *ri);
+    }
+    assert(ri == r.k_end());
+
+    while (!r.empty()) {
+        assert(q.front().first == r.front().first);
+        assert(q.front().second == r.front().second);
+        q.pop();
+        r.pop();
+    }
+    assert(q.empty());
+
+    q.push(1, 1);
+    q.clear();
+    assert(q.empty());
+
+    const auto us = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start).count();
+    std::cout << name << ": " << us << "us\n";
+}
+
+void unique_ownership_moves() {
+    keyed_queue<int, std::unique_ptr<int>, unique_ownership, contiguous_storage> q;
+    q.push(1, std::make_unique<int>(1));
+    q.push(2, std::make_unique<int>(2));
+    q.push(1, std::make_unique<int>(3));
+    auto e = q.extract(1);
+    assert(*e.second == 1);
+    auto moved = std::move(q);
+    assert(moved.size() == 2);
+    assert(*moved.first(1).second == 3);
+}
+
+void unique_ownership_reclaimer() {
+    auto reclaimer = std::make_shared<background_reclaimer>();
+    {
+        keyed_queue<int, std::string, unique_ownership> q;
+        q.set_reclaimer(reclaimer);
+        for (int i = 0; i < 1000; ++i) {
+            q.push(i % 10, std::to_string(i));
+        }
+        q.clear();
+        assert(q.empty());
+        q.push(1, "a");
+    }
+    reclaimer->drain();
+    assert(reclaimer->released_count() == 2);
+}
+
+void local_refcount_sharing() {
+    keyed_queue<int, int, local_refcount> q;
+    q.push(1, 1);
+    auto copy = q;
+    q.push(2, 2);
+    assert(copy.size() == 1);
+    assert(q.size() == 2);
+    auto& v = copy.front().second;
+    auto second = copy;
+    v = 5;
+    // Data with captured references is not shared
+    assert(second.front().second == 1);
+    assert(copy.front().second == 5);
+}
+
+void contiguous_positions_reuse_space() {
+    position_vector<int> p;
+    for (int round = 0; round < 1000; ++round) {
+        p.push_back(round);
+        p.push_back(round);
+        p.pop_front();
+    }
+    assert(p.size() == 1000);
+    assert(p.front() == 500);
+    assert(p.back() == 999);
+    position_vector<int> other;
+    other.push_back(7);
+    p.append(other);
+    assert(other.empty());
+    assert(p.back() == 7);
+}
+
+int main() {
+    same_as_default<keyed_queue<int, int>>("default");
+    same_as_default<keyed_queue<int, int, ordered_index>>("ordered_index");
+    same_as_default<keyed_queue<int, int, hashed_index>>("hashed_index");
+    same_as_default<keyed_queue<int, int, contiguous_storage>>("contiguous_storage");
+    same_as_default<keyed_queue<int, int, strong_guarantee, contiguous_storage>>("strong_guarantee, contiguous_storage");
+    same_as_default<keyed_queue<int, int, unique_ownership>>("unique_ownership");
+    same_as_default<keyed_queue<int, int, unique_ownership, hashed_index, contiguous_storage>>(
+        "unique_ownership, hashed_index, contiguous_storage");
+    same_as_default<keyed_queue<int, int, local_refcount, ordered_index>>("local_refcount, ordered_index");
+    unique_ownership_moves();
+    unique_ownership_reclaimer();
+    local_refcount_sharing();
+    contiguous_positions_reuse_space();
+    std::cout << "policies_test passed\n";
+    return 0;
+}
@@ -0,0 +1,140 @@
+#include "keyed_queue_pool.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**
+ * Stealing moves the whole group of the last key of the largest shard.
+ */
+void stealing_groups() {
+    keyed_queue_pool<int, int> pool(2);
+    assert(pool.workers() == 2 && pool.size() == 0);
+    // All keys home in shard 0 or 1 by the hash; find keys of shard 0
+    std::vector<int> keys;
+    for (int k = 0; keys.size() < 3; ++k) {
+        if (std::hash<int>()(k) % 2 == 0) {
+            keys.push_back(k);
+        }
+    }
+    const int a = keys[0], b = keys[1], c = keys[2];
+    pool.push(a, 1);
+    pool.push(b, 2);
+    pool.push(a, 3);
+    pool.push(c, 4);
+    pool.push(b, 5);
+    assert(pool.depth(0) == 5 && pool.depth(1) == 0);
+
+    // Last element has key b: both elements of b move
+    assert(pool.steal(1) == 2);
+    assert(pool.depth(0) == 3 && pool.depth(1) == 2);
+    // New elements of b follow the group to its owner
+    pool.push(b, 6);
+    assert(pool.depth(1) == 3);
+    assert(pool.extract(1) == std::make_pair(b, 2));
+    assert(pool.extract(1) == std::make_pair(b, 5));
+    assert(pool.extract(1) == std::make_pair(b, 6));
+
+    // Worker 1 is empty: it steals the group of c, then of a
+    assert(pool.extract(1) == std::make_pair(c, 4));
+    assert(pool.extract(1) == std::make_pair(a, 1));
+    assert(pool.extract(1) == std::make_pair(a, 3));
+    assert(pool.size() == 0);
+    assert(!pool.try_extract(0) && !pool.try_extract(1));
+
+    // Keys return home once their owner is empty
+    pool.push(b, 7);
+    assert(pool.depth(0) == 1);
+    assert(pool.extract(0) == std::make_pair(b, 7));
+
+    bool thrown = false;
+    try {
+        pool.extract(0);
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+    thrown = false;
+    try {
+        pool.depth(2);
+    } catch (std::out_of_range const&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+/**
+ * Move-only values are moved between the shards.
+ */
+void move_only_values() {
+    keyed_queue_pool<int, std::unique_ptr<int>, unique_ownership> pool(3);
+    for (int i = 0; i < 30; ++i) {
+        pool.push(i % 4, std::make_unique<int>(i));
+    }
+    int total = 0;
+    while (auto e = pool.try_extract(2)) {
+        assert(*e->second % 4 == e->first);
+        ++total;
+    }
+    assert(total == 30);
+}
+
+/**
+ * Producers push ascending values of their keys, unevenly spread over the shards, while workers consume.
+ * Every element is taken exactly once and every worker sees the elements of a key in order.
+ */
+void workers_balance(int workers, int producers, int per_producer) {
+    keyed_queue_pool<int, int> pool(workers);
+    std::atomic<int> producing{ producers };
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&pool, &producing, p, per_producer] {
+            for (int i = 0; i < per_producer; ++i) {
+                // Keys of a producer: p, p + 100, ...
+                pool.push(p + 100 * (i % 5), i);
+            }
+            producing.fetch_sub(1);
+        });
+    }
+    std::vector<std::map<int, int>> last(workers);
+    std::vector<int> taken(workers, 0);
+    for (int w = 0; w < workers; ++w) {
+        threads.emplace_back([&, w] {
+            while (true) {
+                const bool done = producing.load() == 0;
+                auto e = pool.try_extract(w);
+                if (!e) {
+                    if (done) {
+                        break;
+                    }
+                    std::this_thread::yield();
+                    continue;
+                }
+                auto it = last[w].find(e->first);
+                assert(it == last[w].end() || it->second < e->second);
+                last[w][e->first] = e->second;
+                ++taken[w];
+            }
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
+    }
+    int total = 0;
+    for (int w = 0; w < workers; ++w) {
+        total += taken[w];
+    }
+    assert(total == producers * per_producer);
+    assert(pool.size() == 0);
+}
+
+int main() {
+    stealing_groups();
+    move_only_values();
+    workers_balance(4, 3, 20000);
+    std::cout << "keyed_queue_pool: all tests passed\n";
+    return 0;
+}
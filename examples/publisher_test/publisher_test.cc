@@ -0,0 +1,124 @@
+#include "keyed_queue.h"
+#include "snapshot_publisher.h"
+#include <atomic>
+#include <cassert>
+#include <iostream>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**
+ * Counts live instances to check reclamation.
+ */
+struct tracked {
+    static std::atomic<int> alive;
+    int value;
+    tracked(int v = 0): value(v) { ++alive; }
+    tracked(tracked const& t): value(t.value) { ++alive; }
+    tracked(tracked&& t): value(t.value) { ++alive; }
+    ~tracked() { --alive; }
+};
+std::atomic<int> tracked::alive{ 0 };
+
+/**
+ * Versions held by readers are kept, the others are reclaimed.
+ */
+void reclamation() {
+    {
+        snapshot_publisher<tracked> publisher(tracked(0), 2);
+        auto a = publisher.register_reader();
+        auto b = publisher.register_reader();
+        bool thrown = false;
+        try {
+            publisher.register_reader();
+        } catch (std::length_error const&) {
+            thrown = true;
+        }
+        assert(thrown);
+
+        publisher.publish(tracked(1));
+        assert(publisher.pending_versions() == 0);
+        assert(tracked::alive == 1);
+        {
+            auto held = a.acquire();
+            assert(held->value == 1);
+            publisher.publish(tracked(2));
+            publisher.publish(tracked(3));
+            // Version 1 is held, version 2 was published after the reader announced its epoch
+            assert(publisher.pending_versions() == 2);
+            assert(held->value == 1);
+            auto fresh = b.acquire();
+            assert(fresh->value == 3);
+        }
+        assert(publisher.reclaim() == 0);
+        assert(tracked::alive == 1);
+        assert(publisher.latest().value == 3);
+    }
+    assert(tracked::alive == 0);
+}
+
+/**
+ * Readers see consistent keyed_queue versions while the writer keeps publishing.
+ */
+void concurrent_readers(int readers, int versions) {
+    using queue = keyed_queue<int, int>;
+    snapshot_publisher<queue> publisher;
+    std::atomic<bool> done{ false };
+    std::atomic<bool> consistent{ true };
+    std::atomic<long> reads{ 0 };
+
+    std::vector<std::thread> threads;
+    for (int r = 0; r < readers; ++r) {
+        threads.emplace_back([&] {
+            auto reader = publisher.register_reader();
+            int last_version = 0;
+            while (!done.load()) {
+                queue copy;
+                {
+                    auto version = reader.acquire();
+                    // Version v holds v elements: 0..v-1 under keys i % 2
+                    const int size = static_cast<int>(version->size());
+                    if (size < last_version || version->count(0) + version->count(1) != version->size()) {
+                        consistent = false;
+                    }
+                    last_version = size;
+                    copy = *version;
+                }
+                // The copy shares the data and stays valid after the guard is released
+                int expected = 0;
+                while (!copy.empty()) {
+                    if (copy.front().second != expected++) {
+                        consistent = false;
+                    }
+                    copy.pop();
+                }
+                if (expected != last_version) {
+                    consistent = false;
+                }
+                ++reads;
+            }
+        });
+    }
+
+    queue latest;
+    for (int v = 0; v < versions; ++v) {
+        latest.push(v % 2, v);
+        publisher.publish(latest);
+    }
+    done = true;
+    for (auto& t : threads) {
+        t.join();
+    }
+    assert(consistent);
+    assert(publisher.reclaim() == 0);
+    assert(publisher.latest().size() == static_cast<std::size_t>(versions));
+    std::cout << readers << " readers, " << versions << " versions: " << reads.load() << " reads\n";
+}
+
+int main() {
+    reclamation();
+    concurrent_readers(1, 2000);
+    concurrent_readers(4, 2000);
+    std::cout << "snapshot_publisher: all tests passed\n";
+    return 0;
+}
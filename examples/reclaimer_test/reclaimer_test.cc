@@ -0,0 +1,159 @@
+#include "keyed_queue.h"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <thread>
+
+std::atomic<long> destroyed_here{ 0 };
+std::atomic<long> destroyed_elsewhere{ 0 };
+std::thread::id main_thread;
+
+struct Tracked {
+    int value;
+    Tracked(int v = 0): value(v) {}
+    Tracked(Tracked const&) = default;
+    ~Tracked() {
+        if (std::this_thread::get_id() == main_thread) {
+            ++destroyed_here;
+        } else {
+            ++destroyed_elsewhere;
+        }
+    }
+};
+
+using queue = keyed_queue<int, Tracked>;
+
+template <class Clock>
+long long micros(typename Clock::time_point a, typename Clock::time_point b) {
+    return std::chrono::duration_cast<std::chrono::microseconds>(b - a).count();
+}
+
+void fill(queue& q, int elements) {
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % 1000, Tracked(i));
+    }
+}
+
+void reset_counters() {
+    destroyed_here = 0;
+    destroyed_elsewhere = 0;
+}
+
+void clear_is_deferred() {
+    using clock = std::chrono::steady_clock;
+    auto reclaimer = std::make_shared<background_reclaimer>();
+    const int elements = 200000;
+
+    queue q;
+    q.set_reclaimer(reclaimer);
+    fill(q, elements);
+    reset_counters();
+
+    const auto t0 = clock::now();
+    q.clear();
+    const auto t1 = clock::now();
+    assert(q.empty());
+    assert(q.count(3) == 0);
+    reclaimer->drain();
+    std::cout << "clear of " << elements << " elements took " << micros<clock>(t0, t1) << "us\n";
+    assert(destroyed_here == 0);
+    assert(destroyed_elsewhere == elements);
+
+    // The queue is usable after clear
+    q.push(1, Tracked(5));
+    assert(q.first(1).second.value == 5);
+}
+
+void last_release_is_deferred() {
+    auto reclaimer = std::make_shared<background_reclaimer>();
+    const int elements = 50000;
+    {
+        queue q;
+        q.set_reclaimer(reclaimer);
+        fill(q, elements);
+        queue copy = q;
+        reset_counters();
+        {
+            queue dropped = std::move(q);
+        }
+        // The copy still holds the data
+        reclaimer->drain();
+        assert(destroyed_elsewhere == 0);
+        assert(copy.size() == static_cast<size_t>(elements));
+        reset_counters();
+    }
+    reclaimer->drain();
+    assert(destroyed_here == 0);
+    assert(destroyed_elsewhere == elements);
+    assert(reclaimer->released_count() == 1);
+}
+
+void shared_clear_does_not_copy() {
+    queue q;
+    fill(q, 1000);
+    queue copy = q;
+    reset_counters();
+    q.clear();
+    assert(q.empty());
+    assert(copy.size() == 1000);
+    // Nothing was copied or destroyed, the copy keeps the data
+    assert(destroyed_here == 0);
+}
+
+void without_reclaimer() {
+    {
+        queue q;
+        fill(q, 1000);
+        reset_counters();
+        q.clear();
+        assert(destroyed_here == 1000);
+        fill(q, 10);
+        reset_counters();
+    }
+    assert(destroyed_here == 10);
+    assert(destroyed_elsewhere == 0);
+}
+
+/**
+ * Holds the last reference to the reclaimer it was retired to.
+ */
+struct last_owner {
+    std::shared_ptr<background_reclaimer> reclaimer;
+    std::promise<void>* done;
+    last_owner(std::shared_ptr<background_reclaimer> r, std::promise<void>* d): reclaimer(std::move(r)), done(d) {}
+    last_owner(last_owner const&) = delete;
+    ~last_owner() {
+        assert(std::this_thread::get_id() != main_thread);
+        reclaimer.reset();
+        done->set_value();
+    }
+};
+
+void reclaimer_released_by_its_worker() {
+    std::promise<void> open_gate;
+    std::shared_future<void> gate = open_gate.get_future().share();
+    std::promise<void> done;
+    auto reclaimer = std::make_shared<background_reclaimer>();
+    // Keep the worker busy until the main thread drops its reference
+    reclaimer->retire(std::shared_ptr<void>(nullptr, [gate](void*) { gate.wait(); }));
+    reclaimer->retire(std::make_shared<last_owner>(reclaimer, &done));
+    reclaimer.reset();
+    open_gate.set_value();
+    done.get_future().wait();
+    // The worker finishes its batch after the reclaimer is gone
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+}
+
+int main() {
+    main_thread = std::this_thread::get_id();
+    clear_is_deferred();
+    last_release_is_deferred();
+    shared_clear_does_not_copy();
+    without_reclaimer();
+    reclaimer_released_by_its_worker();
+    std::cout << "reclaimer_test passed\n";
+    return 0;
+}
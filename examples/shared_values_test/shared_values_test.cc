@@ -0,0 +1,174 @@
+#include "keyed_queue.h"
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+
+// Large value counting its copies
+struct payload {
+    static long copies;
+    std::array<char, 4096> bytes{};
+    int id = 0;
+
+    payload(int i = 0): id(i) {}
+    payload(payload const& p): bytes(p.bytes), id(p.id) { ++copies; }
+    payload(payload&&) = default;
+    payload& operator=(payload const& p) {
+        bytes = p.bytes;
+        id = p.id;
+        ++copies;
+        return *this;
+    }
+    payload& operator=(payload&&) = default;
+};
+
+long payload::copies = 0;
+
+using boxed = keyed_queue<int, payload, shared_values>;
+
+void detach_shares_values() {
+    boxed q;
+    for (int i = 0; i < 100; ++i) {
+        q.push(i % 10, payload(i));
+    }
+    payload::copies = 0;
+
+    // Detaching copies only the structure
+    boxed copy = q;
+    copy.push(1, payload(100));
+    copy.pop(2);
+    assert(payload::copies == 0);
+    assert(copy.size() == 100);
+
+    // Writing clones only the written value
+    copy.front().second.id = -1;
+    assert(payload::copies == 1);
+    assert(q.front().second.id == 0);
+    copy.last(5).second.id = -5;
+    assert(payload::copies == 2);
+    assert(q.last(5).second.id == 95);
+
+    // Reading does not clone
+    long sum = 0;
+    const boxed& view = copy;
+    view.for_each(parallel_policy::sequential(), [&sum](int const&, payload const& p) { sum += p.id; });
+    for (int k = 0; k < 10; ++k) {
+        sum += view.first(k).second.id;
+    }
+    assert(payload::copies == 2);
+
+    // Writing all values clones the shared ones (97 values are still shared with q)
+    copy.for_each(parallel_policy::sequential(), [](int const&, payload& p) { ++p.id; });
+    assert(payload::copies == 2 + 97);
+    assert(q.front().second.id == 0);
+}
+
+void captured_references_stay_private() {
+    boxed q;
+    q.push(1, payload(1));
+    q.push(2, payload(2));
+
+    // Reference handed out by front() must not be shared with later copies
+    payload& front = q.front().second;
+    boxed copy = q;
+    front.id = 10;
+    assert(copy.front().second.id == 1);
+    assert(q.front().second.id == 10);
+
+    // Same for uniquely owned queues
+    keyed_queue<int, payload, shared_values, unique_ownership> u;
+    u.push(1, payload(1));
+    payload& u_front = u.front().second;
+    auto u_copy = u;
+    u_front.id = 5;
+    assert(u_copy.front().second.id == 1);
+}
+
+void clones_and_snapshots_are_deep() {
+    boxed q;
+    q.push(1, payload(1));
+    q.push(2, payload(2));
+    payload& front = q.front().second;
+    auto clone = q.clone(parallel_policy::sequential());
+    auto parallel = q.clone(parallel_policy(2, 1));
+    front.id = 10;
+    assert(clone.front().second.id == 1);
+    assert(parallel.front().second.id == 1);
+
+    keyed_queue<int, payload, shared_values, unique_ownership> u;
+    u.push(1, payload(1));
+    payload& u_front = u.front().second;
+    auto snapshot = u.snapshot();
+    u_front.id = 5;
+    assert(snapshot.front().second.id == 1);
+}
+
+void extract_moves_unshared_values() {
+    boxed q;
+    q.push(1, payload(1));
+    q.push(1, payload(2));
+    boxed copy = q;
+    payload::copies = 0;
+
+    // Shared with the copy - copied
+    auto first = q.extract();
+    assert(first.second.id == 1);
+    assert(payload::copies == 1);
+    assert(copy.front().second.id == 1);
+
+    copy.clear();
+    // Not shared anymore - moved
+    auto second = q.extract(1);
+    assert(second.second.id == 2);
+    assert(payload::copies == 1);
+}
+
+void freeze_and_views() {
+    keyed_queue<int, std::string, shared_values> q;
+    q.push(1, "a");
+    q.push(2, "b");
+    q.push(1, "c");
+    auto f = q.freeze();
+    assert(f.first(1).second == "a");
+    assert(f.last(1).second == "c");
+    std::string joined;
+    q.for_each_key_group(parallel_policy::sequential(), [&joined](int const&, auto values) {
+        for (auto& v : values) {
+            joined += v;
+        }
+    });
+    assert(joined == "acb");
+    assert(q.to_string() == "{ 1 => a, 2 => b, 1 => c }");
+}
+
+void detach_speed() {
+    using clock = std::chrono::steady_clock;
+    keyed_queue<int, payload> inline_q;
+    boxed boxed_q;
+    for (int i = 0; i < 5000; ++i) {
+        inline_q.push(i % 100, payload(i));
+        boxed_q.push(i % 100, payload(i));
+    }
+    const auto t0 = clock::now();
+    auto inline_copy = inline_q;
+    inline_copy.pop();
+    const auto t1 = clock::now();
+    auto boxed_copy = boxed_q;
+    boxed_copy.pop();
+    const auto t2 = clock::now();
+    std::cout << "detach of 5000 4KB values: inline "
+              << std::chrono::duration_cast<std::chrono::microseconds>(t1 - t0).count() << "us, shared_values "
+              << std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count() << "us\n";
+}
+
+int main() {
+    detach_shares_values();
+    captured_references_stay_private();
+    clones_and_snapshots_are_deep();
+    extract_moves_unshared_values();
+    freeze_and_views();
+    detach_speed();
+    std::cout << "shared_values_test passed\n";
+    return 0;
+}
@@ -0,0 +1,152 @@
+#include "shm_keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct message {
+    int producer;
+    int seq;
+    char text[16];
+};
+
+/**
+ * Keyed operations, capacity limits and reuse of the slots and buckets.
+ */
+void single_process() {
+    auto q = shm_keyed_queue<int, int>::create_anonymous(8, 3);
+    assert(q.empty() && q.capacity() == 8);
+    q.push(1, 10);
+    q.push(2, 20);
+    q.push(1, 11);
+    q.push(3, 30);
+    assert(q.size() == 4 && q.count(1) == 2);
+    assert(q.front() == std::make_pair(1, 10));
+    assert(q.first(1).second == 10 && q.last(1).second == 11);
+
+    q.move_to_back(1);
+    assert(q.extract() == std::make_pair(2, 20));
+    assert(q.extract(1) == std::make_pair(1, 10));
+    assert(q.extract() == std::make_pair(3, 30));
+    q.pop(1);
+    assert(q.empty() && q.count(1) == 0);
+
+    bool thrown = false;
+    try {
+        q.pop();
+    } catch (lookup_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(!q.try_extract(7));
+
+    // Keys come and go many times, the slots and buckets are reused
+    for (int round = 0; round < 1000; ++round) {
+        for (int i = 0; i < 8; ++i) {
+            assert(q.try_push(round + i % 3, i));
+        }
+        assert(!q.try_push(0, 0));
+        int seen = 0;
+        while (q.try_consume([&seen](int const&, int const& v) { assert(v == seen); })) {
+            ++seen;
+            if (seen == 8) {
+                break;
+            }
+        }
+        assert(seen == 8 && q.empty());
+    }
+
+    // Too many distinct keys
+    auto small = shm_keyed_queue<int, int>::create_anonymous(16, 1);
+    assert(small.try_push(1, 1));
+    assert(!small.try_push(2, 2));
+    assert(small.try_push(1, 2));
+
+    // The key capacity is exact, not the size of the index
+    auto keys = shm_keyed_queue<int, int>::create_anonymous(1000, 3);
+    for (int k = 0; k < 3; ++k) {
+        assert(keys.try_push(k, k));
+    }
+    assert(!keys.try_push(3, 3));
+    assert(keys.try_push(0, 10));
+    keys.pop(1);
+    assert(keys.try_push(3, 3));
+    assert(!keys.try_push(4, 4));
+}
+
+/**
+ * The same named object mapped twice, at different addresses.
+ */
+void named_object() {
+    const std::string name = "/shm_keyed_queue_test_" + std::to_string(::getpid());
+    auto writer = shm_keyed_queue<int, message>::create(name, 64, 16);
+    auto reader = shm_keyed_queue<int, message>::open(name);
+    shm_keyed_queue<int, message>::unlink(name);
+    message m{ 1, 1, "hello" };
+    writer.push(5, m);
+    assert(reader.size() == 1);
+    auto e = reader.extract(5);
+    assert(e.second.seq == 1 && std::string(e.second.text) == "hello");
+    assert(writer.empty());
+
+    bool thrown = false;
+    try {
+        shm_keyed_queue<int, message>::open(name);
+    } catch (std::system_error const&) {
+        thrown = true;
+    }
+    assert(thrown);
+}
+
+/**
+ * Producer processes push keyed messages, the parent consumes them waiting on the futex.
+ * Messages of every producer come in order.
+ */
+void across_processes(int producers, int per_producer) {
+    auto q = shm_keyed_queue<int, message>::create_anonymous(128, 16);
+    std::vector<pid_t> children;
+    for (int p = 0; p < producers; ++p) {
+        const pid_t pid = ::fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            for (int i = 0; i < per_producer; ++i) {
+                message m{ p, i, "msg" };
+                while (!q.try_push(p, m)) {
+                    ::usleep(100);
+                }
+            }
+            ::_exit(0);
+        }
+        children.push_back(pid);
+    }
+
+    std::vector<int> next(producers, 0);
+    int received = 0;
+    while (received < producers * per_producer) {
+        auto e = q.wait_extract(std::chrono::seconds(10));
+        assert(e);
+        assert(e->first == e->second.producer);
+        assert(e->second.seq == next[e->first]++);
+        ++received;
+    }
+    for (pid_t pid : children) {
+        int status = 0;
+        ::waitpid(pid, &status, 0);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+    assert(q.empty());
+    assert(!q.wait_extract(std::chrono::milliseconds(10)));
+    std::cout << received << " messages from " << producers << " processes\n";
+}
+
+int main() {
+    single_process();
+    named_object();
+    across_processes(4, 20000);
+    std::cout << "shm_keyed_queue: all tests passed\n";
+    return 0;
+}
@@ -0,0 +1,119 @@
+#include "keyed_queue.h"
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+static_assert(std::is_same<unique_keyed_queue<int, int>, keyed_queue<int, int, unique_ownership>>::value,
+              "unique_keyed_queue is keyed_queue with unique_ownership");
+static_assert(std::is_same<unique_keyed_queue<int, int>::shared_queue, keyed_queue<int, int>>::value,
+              "sharing drops the ownership policy");
+static_assert(std::is_same<unique_keyed_queue<int, int, strong_guarantee>::shared_queue, keyed_queue<int, int, strong_guarantee>>::value,
+              "sharing keeps other policies");
+static_assert(std::is_same<keyed_queue<int, int>::unique_queue, unique_keyed_queue<int, int>>::value,
+              "unsharing gives unique_keyed_queue");
+
+template <class Queue>
+long long push_pop_micros(int elements) {
+    using clock = std::chrono::steady_clock;
+    Queue q;
+    const auto start = clock::now();
+    for (int i = 0; i < elements; ++i) {
+        q.push(i % 64, i);
+    }
+    long long sum = 0;
+    while (!q.empty()) {
+        sum += q.front().second;
+        q.pop();
+    }
+    const auto end = clock::now();
+    assert(sum == static_cast<long long>(elements) * (elements - 1) / 2);
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+void same_api() {
+    unique_keyed_queue<int, std::string> q;
+    q.push(1, "a");
+    q.push(2, "b");
+    q.push(1, "c");
+    assert(q.size() == 3);
+    assert(q.count(1) == 2);
+    assert(q.first(1).second == "a");
+    assert(q.last(1).second == "c");
+    q.move_to_back(2);
+    assert(q.back().second == "b");
+    q.front().second = "x";
+    assert(q.front().second == "x");
+    q.pop(1);
+    assert(q.front().second == "c");
+
+    // Copies are deep
+    auto copy = q;
+    copy.pop();
+    assert(q.size() == 2);
+    assert(copy.size() == 1);
+}
+
+void share_and_snapshot() {
+    unique_keyed_queue<int, std::string> q;
+    for (int i = 0; i < 100; ++i) {
+        q.push(i % 10, std::to_string(i));
+    }
+
+    // Snapshot copies the data, the unique queue stays usable
+    keyed_queue<int, std::string> snap = q.snapshot();
+    q.pop();
+    assert(snap.size() == 100);
+    assert(q.size() == 99);
+    assert(snap.front().second == "0");
+
+    // Sharing moves the data
+    keyed_queue<int, std::string> shared = std::move(q).share();
+    assert(q.empty());
+    assert(shared.size() == 99);
+    auto copy = shared;
+    copy.pop();
+    assert(shared.size() == 99);
+    assert(shared.front().second == "1");
+
+    // Shared data is copied when unsharing, the other owner keeps it
+    unique_keyed_queue<int, std::string> back = std::move(shared).unshare();
+    assert(shared.empty());
+    assert(back.size() == 99);
+    assert(copy.size() == 98);
+    assert(back.count(3) == 10);
+    assert(back.last(9).second == "99");
+
+    // Queue is usable after sharing its data
+    q.push(5, "five");
+    assert(q.first(5).second == "five");
+
+    // Snapshot of copy-on-write queue shares the data
+    auto cow_snap = copy.snapshot();
+    assert(cow_snap.size() == copy.size());
+}
+
+void move_only_share() {
+    unique_keyed_queue<int, std::unique_ptr<int>> q;
+    q.push(1, std::make_unique<int>(1));
+    q.push(2, std::make_unique<int>(2));
+    auto shared = std::move(q).share();
+    assert(*shared.front().second == 1);
+    auto unique = std::move(shared).unshare();
+    assert(*unique.extract(2).second == 2);
+}
+
+int main() {
+    same_api();
+    share_and_snapshot();
+    move_only_share();
+
+    const int elements = 1000000;
+    std::cout << "push/pop of " << elements << " elements: keyed_queue " << push_pop_micros<keyed_queue<int, int>>(elements)
+              << "us, unique_keyed_queue " << push_pop_micros<unique_keyed_queue<int, int>>(elements) << "us\n";
+    std::cout << "unique_queue_test passed\n";
+    return 0;
+}
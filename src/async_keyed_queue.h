@@ -0,0 +1,327 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _ASYNC_KEYED_QUEUE_
+#define _ASYNC_KEYED_QUEUE_
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "async_keyed_queue.h requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include "keyed_queue.h"
+
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/**
+ * Keyed queue with coroutine consumers.
+ *
+ * co_await q.async_pop() and co_await q.async_pop(k) take the first element (with the given key)
+ * or suspend the coroutine until push() provides one. The pushed element is handed directly to the
+ * longest waiting matching coroutine, which is resumed through the executor (by default inline,
+ * on the pushing thread, after the lock is released). No thread is blocked.
+ *
+ * Waiters are linked into intrusive lists stored in the awaiters, which live in the coroutine frames,
+ * so waiting does not allocate. Lists of the keys are kept after their waiters leave, so waiting
+ * on a key allocates only the first time the key is awaited.
+ *
+ * close() resumes all the waiters; async_pop() then throws lookup_error, drain().next() gives nothing.
+ * A suspended coroutine must not be destroyed before it's resumed.
+ *
+ * @tparam K        : Key type
+ * @tparam V        : Value type
+ * @tparam Policies : Policies of the underlying keyed_queue
+ */
+template <class K, class V, class... Policies>
+class async_keyed_queue {
+public:
+
+    /** Executor resuming the coroutines */
+    using executor_type = std::function<void(std::coroutine_handle<>)>;
+
+private:
+
+    /**
+     * Suspended coroutine waiting for an element.
+     */
+    struct waiter {
+        waiter* prev = nullptr;
+        waiter* next = nullptr;
+        /** Order of arrival (older waiters get the elements first) */
+        std::uint64_t seq = 0;
+        std::coroutine_handle<> handle;
+        /** Element handed over by push() (nothing when the queue was closed) */
+        std::optional<std::pair<K, V>> result;
+    };
+
+    /**
+     * Waiters in the order of arrival.
+     */
+    struct waiter_list {
+        waiter* head = nullptr;
+        waiter* tail = nullptr;
+
+        void push_back(waiter& w) noexcept {
+            w.prev = tail;
+            w.next = nullptr;
+            (tail ? tail->next : head) = &w;
+            tail = &w;
+        }
+
+        waiter* pop_front() noexcept {
+            waiter* w = head;
+            head = w->next;
+            (head ? head->prev : tail) = nullptr;
+            w->next = nullptr;
+            return w;
+        }
+    };
+
+    /** Protects all the members below */
+    std::mutex lock;
+    /** Elements nobody waits for */
+    keyed_queue<K, V, Policies...> queue;
+    /** Coroutines waiting for any element */
+    waiter_list any_waiters;
+    /** Coroutines waiting for the given keys */
+    std::map<K, waiter_list> key_waiters;
+    /** Sequence number of the next waiter */
+    std::uint64_t next_seq = 0;
+    /** Was the queue closed? */
+    bool closed = false;
+    /** Resumes the coroutines */
+    executor_type executor;
+
+    /**
+     * Resume the coroutine through the executor. Called without the lock.
+     */
+    void resume(waiter* w) {
+        if(executor) {
+            executor(w->handle);
+        } else {
+            w->handle.resume();
+        }
+    }
+
+    /**
+     * Take the element available right away or register the waiter.
+     * Called from await_suspend(); must not touch the awaiter after the lock is released.
+     *
+     * @returns true when the coroutine should stay suspended
+     */
+    bool suspend(waiter& w, K const* key, std::coroutine_handle<> h) {
+        std::lock_guard<std::mutex> guard(lock);
+        if(key ? queue.count(*key) > 0 : !queue.empty()) {
+            w.result.emplace(key ? queue.extract(*key) : queue.extract());
+            return false;
+        }
+        if(closed) {
+            return false;
+        }
+        w.handle = h;
+        w.seq = next_seq++;
+        if(key) {
+            key_waiters[*key].push_back(w);
+        } else {
+            any_waiters.push_back(w);
+        }
+        return true;
+    }
+
+    /**
+     * Awaitable returned by async_pop().
+     */
+    class pop_awaiter {
+    private:
+        async_keyed_queue& q;
+        K const* key;
+        waiter w;
+
+    public:
+
+        pop_awaiter(async_keyed_queue& queue, K const* k) noexcept: q(queue), key(k) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            return q.suspend(w, key, h);
+        }
+
+        std::optional<std::pair<K, V>> take() noexcept {
+            return std::move(w.result);
+        }
+
+        std::pair<K, V> await_resume() {
+            if(!w.result) {
+                throw lookup_error("async_pop(): Queue is closed.");
+            }
+            return std::move(*w.result);
+        }
+    };
+
+    /**
+     * Awaitable returned by async_drain::next().
+     */
+    class next_awaiter {
+    private:
+        pop_awaiter awaiter;
+
+    public:
+
+        explicit next_awaiter(async_keyed_queue& queue) noexcept: awaiter(queue, nullptr) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        bool await_suspend(std::coroutine_handle<> h) {
+            return awaiter.await_suspend(h);
+        }
+
+        std::optional<std::pair<K, V>> await_resume() noexcept {
+            return awaiter.take();
+        }
+    };
+
+public:
+
+    /**
+     * Asynchronous stream of the elements of the queue (see drain()).
+     */
+    class async_drain {
+    private:
+        async_keyed_queue& q;
+
+    public:
+
+        explicit async_drain(async_keyed_queue& queue) noexcept: q(queue) {}
+
+        /**
+         * Wait for the next element.
+         *
+         * @returns awaitable giving the element or nothing when the queue is closed and empty
+         */
+        next_awaiter next() noexcept {
+            return next_awaiter(q);
+        }
+    };
+
+    /**
+     * Create the queue.
+     *
+     * @param[in] exec : executor resuming the coroutines (empty means resuming them inline)
+     */
+    explicit async_keyed_queue(executor_type exec = executor_type()): executor(std::move(exec)) {
+
+    }
+
+    async_keyed_queue(async_keyed_queue const&) = delete;
+    async_keyed_queue& operator=(async_keyed_queue const&) = delete;
+
+    /**
+     * Push new key, value pair. If a coroutine waits for it, the element is handed to
+     * the longest waiting one (waiting for any element or for the key) and it's resumed.
+     *
+     * @param[in] k : key
+     * @param[in] v : value (copied or moved)
+     */
+    template <class Value>
+    void push(K const& k, Value&& v) {
+        waiter* w = nullptr;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            waiter_list* list = any_waiters.head ? &any_waiters : nullptr;
+            const auto i = key_waiters.find(k);
+            if(i != key_waiters.end() && i->second.head && (!list || i->second.head->seq < list->head->seq)) {
+                list = &i->second;
+            }
+            if(!list) {
+                queue.push(k, std::forward<Value>(v));
+                return;
+            }
+            list->head->result.emplace(k, std::forward<Value>(v));
+            w = list->pop_front();
+        }
+        resume(w);
+    }
+
+    /**
+     * Take the first element of the queue, suspending the coroutine until there's one.
+     *
+     * @returns awaitable giving the element (throws lookup_error when the queue is closed)
+     */
+    pop_awaiter async_pop() noexcept {
+        return pop_awaiter(*this, nullptr);
+    }
+
+    /**
+     * Take the first element with matching key, suspending the coroutine until there's one.
+     *
+     * @param[in] k : key (must live until the coroutine is resumed)
+     * @returns awaitable giving the element (throws lookup_error when the queue is closed)
+     */
+    pop_awaiter async_pop(K const& k) noexcept {
+        return pop_awaiter(*this, &k);
+    }
+
+    /**
+     * Get the asynchronous stream of the elements: co_await drain().next() until it gives nothing.
+     */
+    async_drain drain() noexcept {
+        return async_drain(*this);
+    }
+
+    /**
+     * Close the queue and resume all the waiting coroutines (they get no element).
+     * Elements already in the queue can still be taken.
+     */
+    void close() {
+        waiter_list woken;
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            closed = true;
+            while(any_waiters.head) {
+                woken.push_back(*any_waiters.pop_front());
+            }
+            for(auto& entry : key_waiters) {
+                while(entry.second.head) {
+                    woken.push_back(*entry.second.pop_front());
+                }
+            }
+        }
+        while(woken.head) {
+            resume(woken.pop_front());
+        }
+    }
+
+    /**
+     * Gets the number of elements nobody waits for.
+     */
+    std::size_t size() {
+        std::lock_guard<std::mutex> guard(lock);
+        return queue.size();
+    }
+
+    /**
+     * Gets the number of elements with the given key.
+     *
+     * @param[in] k : key
+     */
+    std::size_t count(K const& k) {
+        std::lock_guard<std::mutex> guard(lock);
+        return queue.count(k);
+    }
+};
+
+#endif // _ASYNC_KEYED_QUEUE_
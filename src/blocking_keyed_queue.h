@@ -0,0 +1,553 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _BLOCKING_KEYED_QUEUE_
+#define _BLOCKING_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <thread>
+#include <utility>
+#include <vector>
+
+/**
+ * Bounded, blocking keyed queue for producer-consumer hand-off.
+ *
+ * push() waits while the queue holds capacity elements or the key holds key_quota elements.
+ * extract() and extract(K) wait until there's an element to take. Every blocking operation
+ * has a *_for(timeout) version returning false or nothing when the timeout expires.
+ * consume(max_items, max_linger) takes a batch as soon as max_items elements are ready
+ * or when the linger time expires.
+ *
+ * High/low watermark callbacks drive the flow control of the producers: on_high is called
+ * when the size reaches the high watermark, on_low when it drops back to the low watermark.
+ * Callbacks are called after the lock is released, by the thread whose operation crossed the mark.
+ *
+ * Waiting threads spin for a while (checking an atomic copy of the size without the lock)
+ * before they sleep on a condition variable; the condition variables are signalled only
+ * when some thread sleeps on them. A push wakes one thread sleeping in extract(), threads in consume()
+ * sleep on their own condition variable woken when the smallest awaited batch is ready,
+ * and every removed element wakes one producer.
+ *
+ * Threads waiting for a given key (extract(K), extract_for(K, timeout)) are registered in the
+ * waiters list of that key, each with its own condition variable. push(k, v) wakes only the first
+ * waiter of k, so the cost of the wakeup does not depend on the number of waiting threads.
+ * Keys without waiters have no entry.
+ *
+ * @tparam K        : Key type
+ * @tparam V        : Value type
+ * @tparam Policies : Policies of the underlying keyed_queue
+ */
+template <class K, class V, class... Policies>
+class blocking_keyed_queue {
+public:
+
+    /** Clock used for the timeouts */
+    using clock = std::chrono::steady_clock;
+
+private:
+
+    /** Protects the queue and the members below */
+    mutable std::mutex lock;
+    /** Signalled when elements are pushed (one waiter per element) */
+    std::condition_variable not_empty;
+    /** Signalled when the size reaches the smallest batch size awaited in consume() */
+    std::condition_variable batch_ready;
+    /** Signalled when elements are removed */
+    std::condition_variable not_full;
+    /** Elements */
+    keyed_queue<K, V, Policies...> queue;
+    /** Number of elements (read without the lock while spinning) */
+    std::atomic<std::size_t> elements{ 0 };
+    /**
+     * Thread waiting for an element with the given key.
+     * Lives on the stack of the waiting thread.
+     */
+    struct key_waiter {
+        std::condition_variable cv;
+        /** Set (and the waiter unlinked) by push() */
+        bool signalled = false;
+        key_waiter* prev = nullptr;
+        key_waiter* next = nullptr;
+    };
+
+    /**
+     * Waiters of one key in the order of arrival.
+     */
+    struct key_waiters {
+        key_waiter* head = nullptr;
+        key_waiter* tail = nullptr;
+    };
+
+    /** Waiters of the keys (only keys with waiters have entries) */
+    std::map<K, key_waiters> waiting_keys;
+    /** Number of threads sleeping on not_empty */
+    std::size_t sleeping_consumers = 0;
+    /** Number of threads sleeping on batch_ready */
+    std::size_t sleeping_batchers = 0;
+    /** Batch sizes awaited by the threads in consume() */
+    std::multiset<std::size_t> batch_sizes;
+    /** Number of threads sleeping on not_full */
+    std::size_t sleeping_producers = 0;
+
+    /** Maximal number of elements */
+    const std::size_t capacity_limit;
+    /** Maximal number of elements with the same key (0 means no limit) */
+    const std::size_t key_quota;
+    /** Number of the spins before the thread sleeps */
+    const unsigned spin_limit;
+
+    /** Watermarks */
+    std::size_t high_mark;
+    std::size_t low_mark;
+    std::function<void()> on_high;
+    std::function<void()> on_low;
+    /** Was the high watermark reached (and the low one not yet)? */
+    bool above_high = false;
+
+    /**
+     * Wait until pred() holds or the deadline passes.
+     * Spins checking ready() (without the lock) first, then sleeps on cv.
+     *
+     * @param[in] guard    : held lock
+     * @param[in] cv       : condition variable to sleep on
+     * @param[in] sleeping : counter of the threads sleeping on cv
+     * @param[in] deadline : deadline (nothing means no deadline)
+     * @param[in] ready    : cheap check done without the lock
+     * @param[in] pred     : condition checked under the lock
+     * @returns false when the deadline passed and pred() does not hold
+     */
+    template <class Ready, class Pred>
+    bool wait(std::unique_lock<std::mutex>& guard, std::condition_variable& cv, std::size_t& sleeping,
+              std::optional<clock::time_point> deadline, Ready ready, Pred pred) {
+        if(pred()) {
+            return true;
+        }
+        guard.unlock();
+        for(unsigned i = 0; i < spin_limit && !ready(); ++i) {
+            if(deadline && clock::now() >= *deadline) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+        guard.lock();
+
+        ++sleeping;
+        bool result;
+        if(deadline) {
+            result = cv.wait_until(guard, *deadline, pred);
+        } else {
+            cv.wait(guard, pred);
+            result = true;
+        }
+        --sleeping;
+        return result;
+    }
+
+    /**
+     * Add the waiter to the list of the key.
+     *
+     * @param[in] list  : waiters of the key
+     * @param[in] w     : waiter
+     * @param[in] front : add before the other waiters (waiter that lost its element)
+     */
+    static void link(key_waiters& list, key_waiter& w, bool front) noexcept {
+        w.signalled = false;
+        if(list.head == nullptr) {
+            w.prev = w.next = nullptr;
+            list.head = list.tail = &w;
+        } else if(front) {
+            w.prev = nullptr;
+            w.next = list.head;
+            list.head->prev = &w;
+            list.head = &w;
+        } else {
+            w.prev = list.tail;
+            w.next = nullptr;
+            list.tail->next = &w;
+            list.tail = &w;
+        }
+    }
+
+    /**
+     * Remove the waiter from the list of the key.
+     *
+     * @param[in] list : waiters of the key
+     * @param[in] w    : waiter
+     */
+    static void unlink(key_waiters& list, key_waiter& w) noexcept {
+        (w.prev ? w.prev->next : list.head) = w.next;
+        (w.next ? w.next->prev : list.tail) = w.prev;
+        w.prev = w.next = nullptr;
+    }
+
+    /**
+     * Wake the first thread waiting for the key. O(1) apart from the lookup of the key.
+     * Called with the lock held.
+     *
+     * @param[in] k : key of the pushed element
+     */
+    void wake_key(K const& k) noexcept {
+        if(waiting_keys.empty()) {
+            return;
+        }
+        const auto i = waiting_keys.find(k);
+        if(i == waiting_keys.end()) {
+            return;
+        }
+        key_waiter& w = *i->second.head;
+        unlink(i->second, w);
+        w.signalled = true;
+        if(i->second.head == nullptr) {
+            waiting_keys.erase(i);
+        }
+        w.cv.notify_one();
+    }
+
+    /**
+     * Wait until there's an element with the given key or the deadline passes.
+     * The thread sleeps on its own condition variable registered for the key.
+     *
+     * @param[in] guard    : held lock
+     * @param[in] k        : key
+     * @param[in] deadline : deadline (nothing means no deadline)
+     * @returns false when the deadline passed and there's no element with the key
+     */
+    bool wait_key(std::unique_lock<std::mutex>& guard, K const& k, std::optional<clock::time_point> deadline) {
+        if(queue.count(k) > 0) {
+            return true;
+        }
+        key_waiter w;
+        bool front = false;
+        while(true) {
+            auto& list = waiting_keys[k];
+            link(list, w, front);
+            const auto signalled = [&w] { return w.signalled; };
+            if(deadline) {
+                w.cv.wait_until(guard, *deadline, signalled);
+            } else {
+                w.cv.wait(guard, signalled);
+            }
+            if(!w.signalled) {
+                // Timed out while still registered
+                const auto i = waiting_keys.find(k);
+                unlink(i->second, w);
+                if(i->second.head == nullptr) {
+                    waiting_keys.erase(i);
+                }
+                return queue.count(k) > 0;
+            }
+            if(queue.count(k) > 0) {
+                return true;
+            }
+            // Element was taken by another consumer, wait for the next one before the later waiters
+            if(deadline && clock::now() >= *deadline) {
+                return false;
+            }
+            front = true;
+        }
+    }
+
+    /**
+     * Can the element with the given key be pushed now?
+     */
+    bool has_room(K const& k) const {
+        return queue.size() < capacity_limit && (key_quota == 0 || queue.count(k) < key_quota);
+    }
+
+    /**
+     * Wake the threads after the change of the size and check the watermarks.
+     * Called with the lock held.
+     *
+     * @param[in] pushed  : were the elements pushed (or removed)?
+     * @param[in] changed : number of the pushed (removed) elements
+     * @returns watermark callback to call after the lock is released (may be empty)
+     */
+    std::function<void()> after_change(bool pushed, std::size_t changed = 1) {
+        elements.store(queue.size(), std::memory_order_release);
+        if(pushed) {
+            if(sleeping_consumers > 0) {
+                not_empty.notify_one();
+            }
+            if(sleeping_batchers > 0 && !batch_sizes.empty() && queue.size() >= *batch_sizes.begin()) {
+                batch_ready.notify_all();
+            }
+            if(!above_high && on_high && queue.size() >= high_mark) {
+                above_high = true;
+                return on_high;
+            }
+        } else {
+            if(sleeping_producers > 0) {
+                if(key_quota == 0) {
+                    // Every removed element makes room for one producer
+                    for(std::size_t i = 0; i < changed && i < sleeping_producers; ++i) {
+                        not_full.notify_one();
+                    }
+                } else {
+                    not_full.notify_all();
+                }
+            }
+            if(above_high && queue.size() <= low_mark) {
+                above_high = false;
+                return on_low;
+            }
+        }
+        return {};
+    }
+
+    /**
+     * Push the element waiting until there's room for it.
+     *
+     * @returns false when the deadline passed (the value is not used then)
+     */
+    template <class Value>
+    bool push_until(K const& k, Value&& v, std::optional<clock::time_point> deadline) {
+        std::function<void()> callback;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            const bool ok = wait(guard, not_full, sleeping_producers, deadline,
+                [this] { return elements.load(std::memory_order_acquire) < capacity_limit; },
+                [this, &k] { return has_room(k); });
+            if(!ok) {
+                return false;
+            }
+            queue.push(k, std::forward<Value>(v));
+            wake_key(k);
+            callback = after_change(true);
+        }
+        if(callback) {
+            callback();
+        }
+        return true;
+    }
+
+    /**
+     * Take the first element (with the given key if there's one) waiting until there's such element.
+     *
+     * @returns nothing when the deadline passed
+     */
+    std::optional<std::pair<K, V>> extract_until(K const* k, std::optional<clock::time_point> deadline) {
+        std::optional<std::pair<K, V>> result;
+        std::function<void()> callback;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            const bool ok = k ? wait_key(guard, *k, deadline) : wait(guard, not_empty, sleeping_consumers, deadline,
+                [this] { return elements.load(std::memory_order_acquire) > 0; },
+                [this] { return !queue.empty(); });
+            if(!ok) {
+                return std::nullopt;
+            }
+            result.emplace(k ? queue.extract(*k) : queue.extract());
+            callback = after_change(false);
+        }
+        if(callback) {
+            callback();
+        }
+        return result;
+    }
+
+public:
+
+    /**
+     * Create the queue.
+     *
+     * @param[in] capacity   : maximal number of elements
+     * @param[in] quota      : maximal number of elements with the same key (0 means no limit)
+     * @param[in] spin_count : number of spins before the waiting thread sleeps
+     */
+    explicit blocking_keyed_queue(std::size_t capacity, std::size_t quota = 0, unsigned spin_count = 64):
+        capacity_limit(capacity), key_quota(quota), spin_limit(spin_count), high_mark(capacity), low_mark(0) {
+
+    }
+
+    blocking_keyed_queue(blocking_keyed_queue const&) = delete;
+    blocking_keyed_queue& operator=(blocking_keyed_queue const&) = delete;
+
+    /**
+     * Set the watermark callbacks.
+     * on_high is called when the size reaches high, on_low when it drops to low afterwards.
+     *
+     * @param[in] high      : high watermark
+     * @param[in] low       : low watermark (lower than high)
+     * @param[in] high_fn   : callback for the high watermark
+     * @param[in] low_fn    : callback for the low watermark
+     */
+    void set_watermarks(std::size_t high, std::size_t low, std::function<void()> high_fn, std::function<void()> low_fn) {
+        std::lock_guard<std::mutex> guard(lock);
+        high_mark = high;
+        low_mark = low;
+        on_high = std::move(high_fn);
+        on_low = std::move(low_fn);
+        above_high = false;
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     * Waits while the queue or the key is full.
+     *
+     * @param[in] k : key
+     * @param[in] v : value (copied or moved)
+     */
+    template <class Value>
+    void push(K const& k, Value&& v) {
+        push_until(k, std::forward<Value>(v), std::nullopt);
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     * Waits at most timeout while the queue or the key is full.
+     *
+     * @param[in] k       : key
+     * @param[in] v       : value (copied or moved; left untouched on timeout)
+     * @param[in] timeout : maximal waiting time
+     * @returns false when the timeout expired
+     */
+    template <class Value, class Rep, class Period>
+    bool push_for(K const& k, Value&& v, std::chrono::duration<Rep, Period> const& timeout) {
+        return push_until(k, std::forward<Value>(v), clock::now() + timeout);
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     * Waits until the queue is not empty.
+     *
+     * @returns the first element
+     */
+    std::pair<K, V> extract() {
+        return std::move(*extract_until(nullptr, std::nullopt));
+    }
+
+    /**
+     * Remove the first element of the queue with matching key and return it.
+     * Waits until there's an element with given key.
+     *
+     * @param[in] k : key
+     * @returns the first element with matching key
+     */
+    std::pair<K, V> extract(K const& k) {
+        return std::move(*extract_until(&k, std::nullopt));
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     * Waits at most timeout until the queue is not empty.
+     *
+     * @param[in] timeout : maximal waiting time
+     * @returns the first element or nothing when the timeout expired
+     */
+    template <class Rep, class Period>
+    std::optional<std::pair<K, V>> extract_for(std::chrono::duration<Rep, Period> const& timeout) {
+        return extract_until(nullptr, clock::now() + timeout);
+    }
+
+    /**
+     * Remove the first element of the queue with matching key and return it.
+     * Waits at most timeout until there's an element with given key.
+     *
+     * @param[in] k       : key
+     * @param[in] timeout : maximal waiting time
+     * @returns the first element with matching key or nothing when the timeout expired
+     */
+    template <class Rep, class Period>
+    std::optional<std::pair<K, V>> extract_for(K const& k, std::chrono::duration<Rep, Period> const& timeout) {
+        return extract_until(&k, clock::now() + timeout);
+    }
+
+    /**
+     * Take a batch of the first elements of the queue.
+     * Returns as soon as max_items elements are ready or when max_linger expires
+     * (then the batch holds the elements ready at that time, possibly none).
+     *
+     * @param[in] max_items  : maximal size of the batch
+     * @param[in] max_linger : maximal waiting time for the full batch
+     * @returns the elements in the queue order
+     */
+    template <class Rep, class Period>
+    std::vector<std::pair<K, V>> consume(std::size_t max_items, std::chrono::duration<Rep, Period> const& max_linger) {
+        std::vector<std::pair<K, V>> batch;
+        std::function<void()> callback;
+        {
+            std::unique_lock<std::mutex> guard(lock);
+            const auto awaited = batch_sizes.insert(max_items);
+            try {
+                wait(guard, batch_ready, sleeping_batchers, clock::now() + max_linger,
+                    [this, max_items] { return elements.load(std::memory_order_acquire) >= max_items; },
+                    [this, max_items] { return queue.size() >= max_items; });
+            } catch(...) {
+                batch_sizes.erase(awaited);
+                throw;
+            }
+            batch_sizes.erase(awaited);
+            batch.reserve(std::min(max_items, queue.size()));
+            try {
+                while(batch.size() < max_items && !queue.empty()) {
+                    batch.push_back(queue.extract());
+                }
+            } catch(...) {
+                // Elements taken so far are dropped with the batch, the counters must follow the queue
+                after_change(false, batch.size());
+                throw;
+            }
+            if(!batch.empty()) {
+                callback = after_change(false, batch.size());
+            }
+        }
+        if(callback) {
+            callback();
+        }
+        return batch;
+    }
+
+    /**
+     * Gets the number of elements.
+     *
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        return elements.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Checks if the queue is empty.
+     *
+     * @throws never
+     */
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    /**
+     * Gets the number of elements with the given key.
+     *
+     * @param[in] k : key
+     */
+    std::size_t count(K const& k) const {
+        std::lock_guard<std::mutex> guard(lock);
+        return queue.count(k);
+    }
+
+    /**
+     * Gets the maximal number of elements.
+     *
+     * @throws never
+     */
+    std::size_t capacity() const noexcept {
+        return capacity_limit;
+    }
+};
+
+#endif // _BLOCKING_KEYED_QUEUE_
@@ -0,0 +1,566 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _CONCURRENT_KEYED_QUEUE_
+#define _CONCURRENT_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Thread-safe keyed queue with lock striping.
+ *
+ * Keys are split between stripes by their hash. Every stripe has its own lock
+ * and holds the elements of its keys, so keyed operations on keys from
+ * different stripes run in parallel.
+ *
+ * Global FIFO order comes from a sequence counter: every element gets the next
+ * number when it's pushed. The head structure (a heap of the first elements of the keys,
+ * with its own lock) finds the oldest element for pop(). Entries of the heap are
+ * checked against the stripe and dropped lazily when the key changed in the meantime,
+ * so keyed operations never lock the head for removals. The head also remembers the sequence number
+ * of the current first element of every key; when stale entries make up more than half of the heap,
+ * they're removed all at once, so keyed pops and move_to_back() cannot grow the heap without bound.
+ *
+ * Lock order: a stripe lock may be held while locking the head, never the other way around.
+ *
+ * Elements are returned by value, references to the stored values would not be safe
+ * to use concurrently with other threads.
+ *
+ * @tparam K : Key type (requires std::hash<K> and equality comparison)
+ * @tparam V : Value type
+ */
+template <class K, class V>
+class concurrent_keyed_queue {
+private:
+
+    /** Sequence number of the element */
+    using sequence = std::uint64_t;
+
+    /**
+     * Stored element.
+     */
+    struct node {
+        sequence seq;
+        V value;
+    };
+
+    /**
+     * Part of the keys with its lock.
+     */
+    struct alignas(64) stripe {
+        mutable std::mutex lock;
+        std::unordered_map<K, std::deque<node>> keys;
+    };
+
+    /**
+     * Entry of the head structure: first element of the key at the time of the insertion.
+     */
+    struct head_entry {
+        sequence seq;
+        K key;
+    };
+
+    /**
+     * Orders the head entries so the oldest one is on the top of the heap.
+     */
+    struct later {
+        bool operator()(head_entry const& a, head_entry const& b) const noexcept {
+            return a.seq > b.seq;
+        }
+    };
+
+    /** Stripes (the number of stripes is a power of two) */
+    std::vector<stripe> stripes;
+    /** Mask selecting the stripe from the key hash */
+    std::size_t stripe_mask;
+    /** Next sequence number */
+    std::atomic<sequence> next_seq{ 0 };
+    /** Number of elements */
+    std::atomic<std::size_t> elements{ 0 };
+
+    /** Lock of the head structure */
+    alignas(64) std::mutex head_lock;
+    /** First elements of the keys (heap ordered by later, may contain stale entries) */
+    std::vector<head_entry> head;
+    /** Sequence numbers of the current first elements of the keys (their entries in the head are valid) */
+    std::unordered_map<K, sequence> published;
+
+    /**
+     * Get the stripe of the key.
+     */
+    stripe& stripe_of(K const& k) {
+        return stripes[std::hash<K>()(k) & stripe_mask];
+    }
+
+    /**
+     * Get the stripe of the key.
+     */
+    stripe const& stripe_of(K const& k) const {
+        return stripes[std::hash<K>()(k) & stripe_mask];
+    }
+
+    /**
+     * Publish the first element of the key in the head structure.
+     * Called with the stripe of the key locked.
+     *
+     * @param[in] k     : key
+     * @param[in] first : first element of the key
+     */
+    void publish(K const& k, node const& first) {
+        std::lock_guard<std::mutex> guard(head_lock);
+        const auto l = published.try_emplace(k, first.seq);
+        const sequence previous = l.first->second;
+        l.first->second = first.seq;
+        try {
+            head.push_back({ first.seq, k });
+        } catch(...) {
+            if(l.second) {
+                published.erase(l.first);
+            } else {
+                l.first->second = previous;
+            }
+            throw;
+        }
+        std::push_heap(head.begin(), head.end(), later());
+        if(head.size() > 2 * published.size() + 16) {
+            compact_head();
+        }
+    }
+
+    /**
+     * Forget the first element of the key which became empty.
+     * Called with the stripe of the key locked.
+     *
+     * @param[in] k : key
+     */
+    void unpublish(K const& k) {
+        std::lock_guard<std::mutex> guard(head_lock);
+        published.erase(k);
+    }
+
+    /**
+     * Remove the stale entries from the head. Called with the head locked.
+     */
+    void compact_head() noexcept {
+        const auto stale = [this](head_entry const& e) {
+            const auto i = published.find(e.key);
+            return i == published.end() || i->second != e.seq;
+        };
+        head.erase(std::remove_if(head.begin(), head.end(), stale), head.end());
+        std::make_heap(head.begin(), head.end(), later());
+    }
+
+    /**
+     * Take the top entry of the head. Called with the head locked.
+     */
+    head_entry pop_head() {
+        std::pop_heap(head.begin(), head.end(), later());
+        head_entry top = std::move(head.back());
+        head.pop_back();
+        return top;
+    }
+
+    /**
+     * Push new element.
+     *
+     * @param[in] k : key
+     * @param[in] v : value (copied or moved)
+     */
+    template <class Value>
+    void push_value(K const& k, Value&& v) {
+        stripe& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        auto& list = s.keys[k];
+        try {
+            // Sequence is taken under the stripe lock, so the elements of every key are ordered
+            list.push_back({ next_seq.fetch_add(1, std::memory_order_relaxed), std::forward<Value>(v) });
+        } catch(...) {
+            if(list.empty()) {
+                s.keys.erase(k);
+            }
+            throw;
+        }
+        // Counted before it's published, so consumers never see more elements than the counter
+        elements.fetch_add(1, std::memory_order_release);
+        if(list.size() == 1) {
+            try {
+                publish(k, list.front());
+            } catch(...) {
+                s.keys.erase(k);
+                elements.fetch_sub(1, std::memory_order_release);
+                throw;
+            }
+        }
+    }
+
+    /**
+     * Remove the first element of the key.
+     * Called with the stripe of the key locked.
+     *
+     * @param[in] s : stripe of the key
+     * @param[in] i : position of the key in the stripe
+     * @returns removed element
+     */
+    std::pair<K, V> take_first(stripe& s, typename std::unordered_map<K, std::deque<node>>::iterator i) {
+        auto& list = i->second;
+        const sequence seq = list.front().seq;
+        std::pair<K, V> result(i->first, std::move(list.front().value));
+        list.pop_front();
+        if(list.empty()) {
+            s.keys.erase(i);
+            unpublish(result.first);
+        } else {
+            try {
+                publish(result.first, list.front());
+            } catch(...) {
+                // Put the element back, try_extract() restores its head entry (keyed extraction did not remove it)
+                list.push_front({ seq, std::move(result.second) });
+                throw;
+            }
+        }
+        elements.fetch_sub(1, std::memory_order_release);
+        return result;
+    }
+
+    /**
+     * Wait until the element in transit between the stripe and the head structure is published.
+     * @returns false when the queue is empty
+     */
+    bool wait_for_head() const {
+        if(elements.load(std::memory_order_acquire) == 0) {
+            return false;
+        }
+        std::this_thread::yield();
+        return true;
+    }
+
+public:
+
+    /**
+     * Creates empty queue.
+     *
+     * @param[in] stripe_count : number of stripes (rounded up to the power of two)
+     */
+    explicit concurrent_keyed_queue(std::size_t stripe_count = 64) {
+        std::size_t count = 1;
+        while(count < stripe_count) {
+            count *= 2;
+        }
+        stripes = std::vector<stripe>(count);
+        stripe_mask = count - 1;
+    }
+
+    concurrent_keyed_queue(concurrent_keyed_queue const&) = delete;
+    concurrent_keyed_queue& operator=(concurrent_keyed_queue const&) = delete;
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V const& v) {
+        push_value(k, v);
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue moving the value into it.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V&& v) {
+        push_value(k, std::move(v));
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     *
+     * @returns the first element or nothing if the queue is empty
+     */
+    std::optional<std::pair<K, V>> try_extract() {
+        while(true) {
+            std::optional<head_entry> entry;
+            {
+                std::lock_guard<std::mutex> guard(head_lock);
+                if(!head.empty()) {
+                    entry.emplace(pop_head());
+                }
+            }
+            if(!entry) {
+                if(!wait_for_head()) {
+                    return std::nullopt;
+                }
+                continue;
+            }
+            stripe& s = stripe_of(entry->key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            const auto i = s.keys.find(entry->key);
+            if(i == s.keys.end() || i->second.front().seq != entry->seq) {
+                // The key changed after the entry was published
+                continue;
+            }
+            try {
+                return take_first(s, i);
+            } catch(...) {
+                // The heap keeps its capacity and the key stays published, so pushing the entry back does not allocate
+                publish(entry->key, i->second.front());
+                throw;
+            }
+        }
+    }
+
+    /**
+     * Remove the first element of the queue with matching key and return it.
+     *
+     * @param[in] k : key
+     * @returns the first element with matching key or nothing if there's no such element
+     */
+    std::optional<std::pair<K, V>> try_extract(K const& k) {
+        stripe& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto i = s.keys.find(k);
+        if(i == s.keys.end()) {
+            return std::nullopt;
+        }
+        return take_first(s, i);
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     *
+     * @returns the first element
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> extract() {
+        auto e = try_extract();
+        if(!e) {
+            throw lookup_error("extract(): Queue is empty.");
+        }
+        return std::move(*e);
+    }
+
+    /**
+     * Remove the first element of the queue with matching key and return it.
+     *
+     * @param[in] k : key
+     * @returns the first element with matching key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> extract(K const& k) {
+        auto e = try_extract(k);
+        if(!e) {
+            throw lookup_error("extract(K): Key not present in the queue.");
+        }
+        return std::move(*e);
+    }
+
+    /**
+     * Pop the first element from the queue.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    void pop() {
+        if(!try_extract()) {
+            throw lookup_error("pop(): Queue is empty.");
+        }
+    }
+
+    /**
+     * Pop the first element from the queue with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void pop(K const& k) {
+        if(!try_extract(k)) {
+            throw lookup_error("pop(K): Key not present in the queue.");
+        }
+    }
+
+    /**
+     * Move all elements with matching key to the end of the queue.
+     * Operation preserves order of the elements of the key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void move_to_back(K const& k) {
+        stripe& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto i = s.keys.find(k);
+        if(i == s.keys.end()) {
+            throw lookup_error("move_to_back(K): There's no such key in the queue.");
+        }
+        auto& list = i->second;
+        const sequence first = next_seq.fetch_add(list.size(), std::memory_order_relaxed);
+        const sequence old_first = list.front().seq;
+        std::size_t offset = 0;
+        for(auto& e : list) {
+            e.seq = first + offset++;
+        }
+        try {
+            publish(k, list.front());
+        } catch(...) {
+            // Keep the old order, its head entry is still valid
+            offset = 0;
+            for(auto& e : list) {
+                e.seq = old_first + offset++;
+            }
+            throw;
+        }
+    }
+
+    /**
+     * Get the copy of the first element of the queue.
+     *
+     * @returns the first element or nothing if the queue is empty
+     */
+    std::optional<std::pair<K, V>> try_front() {
+        while(true) {
+            std::optional<head_entry> entry;
+            {
+                std::lock_guard<std::mutex> guard(head_lock);
+                if(!head.empty()) {
+                    entry.emplace(head.front());
+                }
+            }
+            if(!entry) {
+                if(!wait_for_head()) {
+                    return std::nullopt;
+                }
+                continue;
+            }
+            stripe& s = stripe_of(entry->key);
+            std::lock_guard<std::mutex> guard(s.lock);
+            const auto i = s.keys.find(entry->key);
+            if(i != s.keys.end() && i->second.front().seq == entry->seq) {
+                return std::pair<K, V>(i->first, i->second.front().value);
+            }
+            // Drop the stale entry if nobody did it yet
+            std::lock_guard<std::mutex> head_guard(head_lock);
+            if(!head.empty() && head.front().seq == entry->seq) {
+                pop_head();
+            }
+        }
+    }
+
+    /**
+     * Get the copy of the first element of the queue.
+     *
+     * @returns the first element
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> front() {
+        auto e = try_front();
+        if(!e) {
+            throw lookup_error("front(): Queue is empty.");
+        }
+        return std::move(*e);
+    }
+
+    /**
+     * Get the copy of the first element with matching key.
+     *
+     * @param[in] k : key
+     * @returns the first element with matching key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> first(K const& k) const {
+        stripe const& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto i = s.keys.find(k);
+        if(i == s.keys.end()) {
+            throw lookup_error("first(K): Key not present in the queue.");
+        }
+        return { i->first, i->second.front().value };
+    }
+
+    /**
+     * Get the copy of the last element with matching key.
+     *
+     * @param[in] k : key
+     * @returns the last element with matching key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> last(K const& k) const {
+        stripe const& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto i = s.keys.find(k);
+        if(i == s.keys.end()) {
+            throw lookup_error("last(K): Key not present in the queue.");
+        }
+        return { i->first, i->second.back().value };
+    }
+
+    /**
+     * Gets the number of elements with the given key.
+     *
+     * @param[in] k : key
+     * @returns number of elements with matching key
+     */
+    std::size_t count(K const& k) const {
+        stripe const& s = stripe_of(k);
+        std::lock_guard<std::mutex> guard(s.lock);
+        const auto i = s.keys.find(k);
+        return (i == s.keys.end()) ? 0 : i->second.size();
+    }
+
+    /**
+     * Gets the number of elements.
+     * The value may be outdated when other threads modify the queue.
+     *
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        return elements.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Checks if the queue is empty.
+     * The value may be outdated when other threads modify the queue.
+     *
+     * @throws never
+     */
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    /**
+     * Removes all the elements.
+     * Locks all the stripes, so it's not concurrent with any other keyed operation.
+     */
+    void clear() {
+        std::vector<std::unique_lock<std::mutex>> guards;
+        guards.reserve(stripes.size());
+        for(auto& s : stripes) {
+            guards.emplace_back(s.lock);
+        }
+        std::lock_guard<std::mutex> head_guard(head_lock);
+        for(auto& s : stripes) {
+            s.keys.clear();
+        }
+        head.clear();
+        published.clear();
+        elements.store(0, std::memory_order_release);
+    }
+
+};
+
+#endif // _CONCURRENT_KEYED_QUEUE_
@@ -0,0 +1,101 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _EVENTFD_NOTIFIER_
+#define _EVENTFD_NOTIFIER_
+
+#include "keyed_queue.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <system_error>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/**
+ * Readiness notifier on a Linux eventfd (non-blocking, close-on-exec).
+ * The descriptor can be added to an epoll (poll, select) set; it's readable
+ * after notify() until reset().
+ *
+ * Notifications are coalesced: only the first notify() after reset() writes to the descriptor,
+ * the next ones just see that it's already signalled.
+ *
+ * Consumer loop: wait until fd() is readable, call reset(), then take the elements from the queue.
+ */
+class eventfd_notifier: public readiness_notifier {
+private:
+    /** The eventfd */
+    int descriptor;
+    /** Was the descriptor written since the last reset()? */
+    std::atomic<bool> signalled{ false };
+
+public:
+
+    /**
+     * Creates the eventfd.
+     *
+     * @throws std::system_error when the eventfd cannot be created
+     */
+    eventfd_notifier(): descriptor(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+        if(descriptor < 0) {
+            throw std::system_error(errno, std::generic_category(), "eventfd_notifier(): Cannot create eventfd.");
+        }
+    }
+
+    eventfd_notifier(eventfd_notifier const&) = delete;
+    eventfd_notifier& operator=(eventfd_notifier const&) = delete;
+
+    /**
+     * Closes the eventfd.
+     */
+    ~eventfd_notifier() {
+        ::close(descriptor);
+    }
+
+    /**
+     * Get the descriptor to wait on.
+     *
+     * @throws never
+     */
+    int fd() const noexcept {
+        return descriptor;
+    }
+
+    /**
+     * Make the descriptor readable (unless it already is).
+     *
+     * @throws never
+     */
+    void notify() noexcept override {
+        if(!signalled.exchange(true, std::memory_order_acq_rel)) {
+            const std::uint64_t one = 1;
+            // Cannot fail: the counter never gets anywhere near the overflow
+            [[maybe_unused]] const auto written = ::write(descriptor, &one, sizeof(one));
+        }
+    }
+
+    /**
+     * Make the descriptor not readable.
+     * The descriptor is read before the flag is cleared, so a notify() racing with reset()
+     * either gets read here or writes again afterwards.
+     *
+     * @returns number of writes since the last reset
+     * @throws never
+     */
+    std::uint64_t reset() noexcept {
+        std::uint64_t count = 0;
+        if(::read(descriptor, &count, sizeof(count)) != static_cast<ssize_t>(sizeof(count))) {
+            count = 0;
+        }
+        signalled.store(false, std::memory_order_release);
+        return count;
+    }
+};
+
+#endif // _EVENTFD_NOTIFIER_
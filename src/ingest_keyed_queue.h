@@ -0,0 +1,168 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _INGEST_KEYED_QUEUE_
+#define _INGEST_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <optional>
+#include <utility>
+
+/**
+ * Keyed queue with lock-free multi-producer ingestion.
+ *
+ * Producers call push() from any thread. Pushed elements go to a linked
+ * multi-producer single-consumer list (Vyukov's queue): push() allocates the node,
+ * swaps it into the tail with a single atomic exchange and links the previous node,
+ * so it never waits for other threads.
+ *
+ * The consumer thread moves the elements in batches into the keyed_queue with drain()
+ * and then uses the queue directly (queue()), so keyed operations stay single-threaded.
+ * Elements of every producer keep their order; elements of different producers
+ * are ordered by the exchange on the tail.
+ *
+ * Only one thread at the time may call drain(), pending() or use queue().
+ *
+ * @tparam K        : Key type
+ * @tparam V        : Value type
+ * @tparam Policies : Policies of the keyed_queue
+ */
+template <class K, class V, class... Policies>
+class ingest_keyed_queue {
+public:
+
+    /** Type of the queue filled by the consumer */
+    using queue_type = keyed_queue<K, V, Policies...>;
+
+private:
+
+    /**
+     * Node of the ingest list.
+     * The first node (head) is always a stub with already consumed (or no) element.
+     */
+    struct node {
+        std::atomic<node*> next{ nullptr };
+        std::optional<std::pair<K, V>> element;
+    };
+
+    /** Last pushed node (shared by producers) */
+    alignas(64) std::atomic<node*> tail;
+    /** Stub node before the first pending element (consumer only) */
+    alignas(64) node* head;
+    /** Elements moved from the ingest list */
+    queue_type target;
+
+public:
+
+    /**
+     * Creates empty queue.
+     */
+    ingest_keyed_queue(): head(new node()) {
+        tail.store(head, std::memory_order_relaxed);
+    }
+
+    ingest_keyed_queue(ingest_keyed_queue const&) = delete;
+    ingest_keyed_queue& operator=(ingest_keyed_queue const&) = delete;
+
+    /**
+     * Destroys the queue with all pending elements.
+     * Producers must not push anymore.
+     */
+    ~ingest_keyed_queue() {
+        while(head != nullptr) {
+            node* next = head->next.load(std::memory_order_acquire);
+            delete head;
+            head = next;
+        }
+    }
+
+    /**
+     * Push new key, value pair. Safe to call from any number of threads at once.
+     * Apart from the allocation of the node it's wait-free.
+     *
+     * @param[in] k : key
+     * @param[in] v : value (copied or moved)
+     * @throws when the node can't be allocated or the element can't be copied (nothing is pushed then)
+     */
+    template <class Value>
+    void push(K const& k, Value&& v) {
+        node* n = new node();
+        try {
+            n->element.emplace(k, std::forward<Value>(v));
+        } catch(...) {
+            delete n;
+            throw;
+        }
+        node* prev = tail.exchange(n, std::memory_order_acq_rel);
+        // Until this store the consumer sees the list ending at prev
+        prev->next.store(n, std::memory_order_release);
+    }
+
+    /**
+     * Checks if there're elements ready to be drained.
+     * Elements pushed by producers that did not link their nodes yet are not counted.
+     * Consumer thread only.
+     *
+     * @throws never
+     */
+    bool pending() const noexcept {
+        return head->next.load(std::memory_order_acquire) != nullptr;
+    }
+
+    /**
+     * Move at most max_items pushed elements into the keyed queue.
+     * Consumer thread only.
+     *
+     * If pushing into the queue throws, the element stays first in the ingest list
+     * and the exception is propagated. The value is moved, so it's left untouched
+     * only when push() fails before constructing the element (see keyed_queue::push).
+     *
+     * @param[in] max_items : maximum number of the elements to move
+     * @returns number of the moved elements
+     */
+    std::size_t drain(std::size_t max_items = std::numeric_limits<std::size_t>::max()) {
+        std::size_t moved = 0;
+        while(moved < max_items) {
+            node* next = head->next.load(std::memory_order_acquire);
+            if(next == nullptr) {
+                break;
+            }
+            target.push(next->element->first, std::move(next->element->second));
+            next->element.reset();
+            delete head;
+            head = next;
+            ++moved;
+        }
+        return moved;
+    }
+
+    /**
+     * Get the keyed queue with the drained elements.
+     * Consumer thread only.
+     *
+     * @throws never
+     */
+    queue_type& queue() noexcept {
+        return target;
+    }
+
+    /**
+     * Get the keyed queue with the drained elements.
+     * Consumer thread only.
+     *
+     * @throws never
+     */
+    queue_type const& queue() const noexcept {
+        return target;
+    }
+};
+
+#endif // _INGEST_KEYED_QUEUE_
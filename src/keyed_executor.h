@@ -0,0 +1,289 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _KEYED_EXECUTOR_
+#define _KEYED_EXECUTOR_
+
+#include "keyed_queue.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Move-only type erased task taking no arguments.
+ * Unlike std::function it accepts callables that can't be copied.
+ */
+class keyed_task {
+private:
+
+    /**
+     * Interface of the stored callable.
+     */
+    struct callable {
+        virtual ~callable() = default;
+        virtual void run() = 0;
+    };
+
+    /**
+     * Stored callable of the given type.
+     */
+    template <class F>
+    struct callable_of: callable {
+        F fn;
+        explicit callable_of(F&& f): fn(std::move(f)) {}
+        explicit callable_of(F const& f): fn(f) {}
+        void run() override {
+            fn();
+        }
+    };
+
+    /** Stored callable (empty for moved-from tasks) */
+    std::unique_ptr<callable> fn;
+
+public:
+
+    /**
+     * Create the task calling f().
+     *
+     * @param[in] f : callable
+     */
+    template <class F, class = std::enable_if_t<!std::is_same<std::decay_t<F>, keyed_task>::value>>
+    keyed_task(F&& f): fn(std::make_unique<callable_of<std::decay_t<F>>>(std::forward<F>(f))) {}
+
+    keyed_task(keyed_task&&) noexcept = default;
+    keyed_task& operator=(keyed_task&&) noexcept = default;
+
+    /**
+     * Run the task.
+     */
+    void operator()() {
+        fn->run();
+    }
+};
+
+/**
+ * Executor running tasks on a pool of threads so that tasks with the same key
+ * run one at the time in the submission order and tasks with different keys run in parallel.
+ *
+ * Pending tasks are stored in a keyed_queue. Keys that have pending tasks and no running task
+ * are kept in the ready list, the workers take keys from it in a round robin fashion.
+ * A key with a running task gets back to the ready list only when the task finishes,
+ * idle keys (without pending tasks) are never visited.
+ *
+ * The lock is held only to pick the next task and to finish it, never while the task runs.
+ * Exceptions thrown by the tasks are caught, the first one is rethrown by wait_idle().
+ * A key moves between the ready and running lists by splicing its node, so the workers never
+ * allocate and an extracted task is never lost.
+ *
+ * @tparam K : Key type
+ */
+template <class K>
+class keyed_executor {
+private:
+
+    /** Protects all the members below */
+    std::mutex lock;
+    /** Wakes the workers */
+    std::condition_variable work_available;
+    /** Wakes the threads waiting in wait_idle() */
+    std::condition_variable idle;
+    /** Pending tasks */
+    unique_keyed_queue<K, keyed_task> tasks;
+    /** Keys with pending tasks and no running task */
+    std::list<K> ready;
+    /** Keys with running task (at most one per worker) */
+    std::list<K> running;
+    /** First exception thrown by a task */
+    std::exception_ptr failure;
+    /** Set when workers should finish */
+    bool stopping = false;
+    /** Worker threads */
+    std::vector<std::thread> workers;
+
+    /**
+     * Main loop of the worker thread.
+     */
+    void work() {
+        std::unique_lock<std::mutex> guard(lock);
+        while(true) {
+            work_available.wait(guard, [this] { return stopping || !ready.empty(); });
+            if(ready.empty()) {
+                return;
+            }
+            const auto node = ready.begin();
+            std::optional<keyed_task> task;
+            try {
+                task.emplace(tasks.extract(*node).second);
+            } catch(...) {
+                // The task stays in the queue, other keys go first
+                if(!failure) {
+                    failure = std::current_exception();
+                }
+                ready.splice(ready.end(), ready, node);
+                guard.unlock();
+                std::this_thread::yield();
+                guard.lock();
+                continue;
+            }
+            running.splice(running.end(), ready, node);
+
+            guard.unlock();
+            std::exception_ptr error;
+            try {
+                (*task)();
+            } catch(...) {
+                error = std::current_exception();
+            }
+            guard.lock();
+
+            if(error && !failure) {
+                failure = error;
+            }
+            if(tasks.count(*node) > 0) {
+                ready.splice(ready.end(), running, node);
+                work_available.notify_one();
+            } else {
+                running.erase(node);
+                if(running.empty() && tasks.empty()) {
+                    idle.notify_all();
+                }
+            }
+        }
+    }
+
+    /**
+     * Check if a task of the key is running.
+     * Scans the running keys, there are at most as many as the workers.
+     */
+    bool is_running(K const& k) const {
+        return std::any_of(running.begin(), running.end(), [&k](K const& r) {
+            return !(r < k) && !(k < r);
+        });
+    }
+
+public:
+
+    /**
+     * Create the executor with the given number of worker threads.
+     *
+     * @param[in] threads : number of worker threads (0 means std::thread::hardware_concurrency())
+     */
+    explicit keyed_executor(unsigned threads = 0) {
+        const unsigned count = threads ? threads : std::max(1u, std::thread::hardware_concurrency());
+        workers.reserve(count);
+        try {
+            for(unsigned i = 0; i < count; ++i) {
+                workers.emplace_back([this] { work(); });
+            }
+        } catch(...) {
+            shutdown();
+            throw;
+        }
+    }
+
+    keyed_executor(keyed_executor const&) = delete;
+    keyed_executor& operator=(keyed_executor const&) = delete;
+
+    /**
+     * Runs all the submitted tasks and stops the workers.
+     */
+    ~keyed_executor() {
+        shutdown();
+    }
+
+    /**
+     * Submit the task for the given key.
+     * It runs after all the tasks submitted for the key before.
+     *
+     * @param[in] k : key
+     * @param[in] f : callable taking no arguments (may be move-only)
+     * @throws std::logic_error when the executor was shut down
+     */
+    template <class F>
+    void submit(K const& k, F&& f) {
+        keyed_task task(std::forward<F>(f));
+        std::lock_guard<std::mutex> guard(lock);
+        if(stopping) {
+            throw std::logic_error("keyed_executor: Tasks cannot be submitted after shutdown.");
+        }
+        tasks.push(k, std::move(task));
+        // Key with pending tasks is already in the ready list, running key is added when it finishes
+        if(tasks.count(k) == 1 && !is_running(k)) {
+            try {
+                ready.push_back(k);
+            } catch(...) {
+                tasks.pop(k);
+                throw;
+            }
+            work_available.notify_one();
+        }
+    }
+
+    /**
+     * Wait until all the submitted tasks finish.
+     *
+     * @throws the first exception thrown by a task since the last call
+     */
+    void wait_idle() {
+        std::unique_lock<std::mutex> guard(lock);
+        idle.wait(guard, [this] { return running.empty() && tasks.empty(); });
+        if(failure) {
+            std::exception_ptr error = std::move(failure);
+            failure = nullptr;
+            std::rethrow_exception(error);
+        }
+    }
+
+    /**
+     * Run all the submitted tasks and stop the workers.
+     * Exceptions thrown by the tasks are dropped. No tasks can be submitted afterwards
+     * (also by the tasks still running).
+     */
+    void shutdown() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        work_available.notify_all();
+        for(auto& w : workers) {
+            if(w.joinable()) {
+                w.join();
+            }
+        }
+        workers.clear();
+    }
+
+    /**
+     * Get the number of tasks waiting to run.
+     */
+    std::size_t pending() {
+        std::lock_guard<std::mutex> guard(lock);
+        return tasks.size();
+    }
+
+    /**
+     * Get the number of worker threads.
+     *
+     * @throws never
+     */
+    std::size_t thread_count() const noexcept {
+        return workers.size();
+    }
+};
+
+#endif // _KEYED_EXECUTOR_
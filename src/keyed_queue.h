@@ -8,12 +8,27 @@
 #ifndef _KEYED_QUEUE_
 #define _KEYED_QUEUE_
 
+#include <tuple>
 #include <utility>
 #include <exception>
+#include <stdexcept>
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <list>
+#include <algorithm>
+#include <functional>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
 #include <memory>
 #include <sstream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <type_traits>
+#include <iterator>
 #include <assert.h>
 
 /**
@@ -44,20 +59,403 @@ public:
 };
 
 
+/**
+ * Background reclaimer.
+ * Destroys retired objects on its own thread, so releasing large data structures
+ * does not stall the thread that dropped them.
+ *
+ * Objects are retired as std::shared_ptr<void> - the reclaimer thread drops the reference,
+ * so the object is destroyed there if nobody else holds it.
+ */
+class background_reclaimer {
+private:
+    /**
+     * State shared by the reclaimer and its worker thread.
+     * The worker holds its own reference, so the state outlives the reclaimer
+     * when the reclaimer itself is destroyed by an object released on the worker.
+     */
+    struct control {
+        /** Guards all the fields below */
+        std::mutex lock;
+        /** Signalled when there's new work or the reclaimer stops */
+        std::condition_variable wake;
+        /** Signalled when the reclaimer becomes idle */
+        std::condition_variable idle;
+        /** Objects waiting for destruction */
+        std::vector<std::shared_ptr<void>> pending;
+        /** Number of objects currently destroyed by the worker */
+        std::size_t in_progress = 0;
+        /** Number of objects released so far */
+        std::size_t released = 0;
+        /** Should the worker stop? */
+        bool stopping = false;
+    };
+    
+    std::shared_ptr<control> state;
+    /** Worker thread */
+    std::thread worker;
+    
+    /**
+     * Worker loop: takes all the pending objects at once and releases them.
+     * Uses only the control block, never the reclaimer object.
+     */
+    static void run(std::shared_ptr<control> const& c) {
+        std::vector<std::shared_ptr<void>> batch;
+        std::unique_lock<std::mutex> guard(c->lock);
+        while(true) {
+            c->wake.wait(guard, [&c] { return c->stopping || !c->pending.empty(); });
+            if(c->pending.empty()) {
+                return;
+            }
+            batch.swap(c->pending);
+            c->in_progress = batch.size();
+            guard.unlock();
+            batch.clear();
+            guard.lock();
+            c->released += c->in_progress;
+            c->in_progress = 0;
+            if(c->pending.empty()) {
+                c->idle.notify_all();
+            }
+        }
+    }
+    
+public:
+
+    /**
+     * Creates the reclaimer and starts its thread.
+     */
+    background_reclaimer(): state(std::make_shared<control>()) {
+        worker = std::thread([c = state] { run(c); });
+    }
+    
+    background_reclaimer(background_reclaimer const&) = delete;
+    background_reclaimer& operator=(background_reclaimer const&) = delete;
+    
+    /**
+     * Releases all the pending objects and stops the thread.
+     * May run on the worker itself (when a released object held the last reference
+     * to the reclaimer): the worker is detached then and stops on its own.
+     */
+    ~background_reclaimer() {
+        {
+            std::lock_guard<std::mutex> guard(state->lock);
+            state->stopping = true;
+        }
+        state->wake.notify_one();
+        if(worker.get_id() == std::this_thread::get_id()) {
+            worker.detach();
+        } else {
+            worker.join();
+        }
+    }
+    
+    /**
+     * Hand the object to the reclaimer thread.
+     * If the object cannot be queued it's released on the calling thread.
+     *
+     * @param[in] object : object to release
+     * @throws never
+     */
+    void retire(std::shared_ptr<void> object) noexcept {
+        try {
+            std::lock_guard<std::mutex> guard(state->lock);
+            state->pending.push_back(std::move(object));
+        } catch(...) {
+            return;
+        }
+        state->wake.notify_one();
+    }
+    
+    /**
+     * Wait until all the objects retired so far are released.
+     */
+    void drain() {
+        control& c = *state;
+        std::unique_lock<std::mutex> guard(c.lock);
+        c.idle.wait(guard, [&c] { return c.pending.empty() && c.in_progress == 0; });
+    }
+    
+    /**
+     * Get the number of objects released by the reclaimer so far.
+     *
+     * @returns number of released objects
+     */
+    std::size_t released_count() {
+        std::lock_guard<std::mutex> guard(state->lock);
+        return state->released;
+    }
+};
+
+
+/**
+ * Readiness notifier.
+ * Signalled by keyed_queue when it goes from empty to non-empty
+ * or when a watched key gets its first element (see keyed_queue::set_notifier and keyed_queue::watch).
+ * eventfd_notifier (eventfd_notifier.h) makes it readable on a Linux eventfd.
+ */
+class readiness_notifier {
+public:
+    virtual ~readiness_notifier() = default;
+    
+    /**
+     * Signal the readiness.
+     * @throws never
+     */
+    virtual void notify() noexcept = 0;
+};
+
+
+/**
+ * Argument type of the overloads disabled for given template parameters.
+ * It cannot be constructed, so such overloads never match any call.
+ */
+class disabled_argument {
+private:
+    disabled_argument() {}
+};
+
+
+/**
+ * Tag of the constructors making copies that share nothing with the source.
+ * cow_data uses them (when available) to copy data whose references were handed out.
+ */
+struct deep_copy_t {};
+
+
+/**
+ * Policy categories of keyed_queue.
+ * Every policy type names its category as the nested `category` type.
+ */
+struct guarantee_policy {};
+struct index_policy {};
+struct storage_policy {};
+struct ownership_policy {};
+struct refcount_policy {};
+struct value_policy {};
+
+/**
+ * Picks the policy of the given category from the list of policies.
+ * When the category appears more than once the last policy wins,
+ * when it does not appear the default is used.
+ *
+ * @tparam Category : Policy category
+ * @tparam Default  : Policy used when the list has no policy of the category
+ * @tparam Policies : List of policies
+ */
+template <class Category, class Default, class... Policies>
+struct select_policy {
+    using type = Default;
+};
+
+template <class Category, class Default, class P, class... Policies>
+struct select_policy<Category, Default, P, Policies...> :
+    select_policy<Category, typename std::conditional<std::is_same<typename P::category, Category>::value, P, Default>::type, Policies...> {};
+
+
+/**
+ * Shared pointer with a non-atomic reference counter.
+ * Cheaper to copy and release than std::shared_ptr, but its copies
+ * must not be used concurrently by different threads.
+ *
+ * @tparam T : Type of the held object
+ */
+template <typename T>
+class local_shared_ptr {
+private:
+    /** Object together with its reference counter */
+    struct block {
+        long count;
+        T value;
+        
+        template <class... Args>
+        explicit block(Args&&... args): count(1), value(std::forward<Args>(args)...) {
+        
+        }
+    };
+    
+    /** Held block (null if empty) */
+    block* held = nullptr;
+    
+public:
+
+    /**
+     * Create the object in a new block.
+     *
+     * @param[in] args : constructor arguments of T
+     * @returns pointer to the created object
+     */
+    template <class... Args>
+    static local_shared_ptr make(Args&&... args) {
+        local_shared_ptr p;
+        p.held = new block(std::forward<Args>(args)...);
+        return p;
+    }
+    
+    local_shared_ptr() noexcept = default;
+    
+    local_shared_ptr(local_shared_ptr const& p) noexcept: held(p.held) {
+        if(held) {
+            ++held->count;
+        }
+    }
+    
+    local_shared_ptr(local_shared_ptr&& p) noexcept: held(p.held) {
+        p.held = nullptr;
+    }
+    
+    local_shared_ptr& operator=(local_shared_ptr p) noexcept {
+        std::swap(held, p.held);
+        return *this;
+    }
+    
+    ~local_shared_ptr() {
+        reset();
+    }
+    
+    /**
+     * Drop the reference (destroys the object if it was the last one).
+     * @throws never
+     */
+    void reset() noexcept {
+        if(held && --held->count == 0) {
+            delete held;
+        }
+        held = nullptr;
+    }
+    
+    /**
+     * Get the number of pointers sharing the object.
+     * @throws never
+     */
+    long use_count() const noexcept {
+        return held ? held->count : 0;
+    }
+    
+    T& operator*() const noexcept {
+        return held->value;
+    }
+    
+    T* operator->() const noexcept {
+        return &held->value;
+    }
+};
+
+/**
+ * Reference counting policy: shared data is counted with atomic counters (std::shared_ptr).
+ * Copies of the queue sharing data can be used by different threads.
+ */
+struct atomic_refcount {
+    using category = refcount_policy;
+    
+    template <class T>
+    using pointer = std::shared_ptr<T>;
+    
+    template <class T, class... Args>
+    static std::shared_ptr<T> make(Args&&... args) {
+        return std::make_shared<T>(std::forward<Args>(args)...);
+    }
+};
+
+/**
+ * Reference counting policy: shared data is counted with plain counters (local_shared_ptr).
+ * Copies of the queue sharing data must stay on one thread.
+ */
+struct local_refcount {
+    using category = refcount_policy;
+    
+    template <class T>
+    using pointer = local_shared_ptr<T>;
+    
+    template <class T, class... Args>
+    static local_shared_ptr<T> make(Args&&... args) {
+        return local_shared_ptr<T>::make(std::forward<Args>(args)...);
+    }
+};
+
+
 /**
  * Copy-on-write data container
  *
  * @tparam Type of value that is held by container
+ * @tparam RefCount : Reference counting policy of the shared data (atomic_refcount or local_refcount)
  */
-template <typename T>
+template <typename T, class RefCount = atomic_refcount>
 class cow_data {
 private:
     
     /** Is the underlying data sharable? */
     std::shared_ptr<bool> shareableState;
     
+    /** Pointer to the shared data */
+    using pointer = typename RefCount::template pointer<T>;
+    
     /** The underlying data */
-    std::shared_ptr<T> shared_data;
+    pointer shared_data;
+    
+    /** Reclaimer releasing the data dropped by this container (optional) */
+    std::shared_ptr<background_reclaimer> reclaimer;
+    
+    /**
+     * Can the data be copied?
+     * Containers of move-only data cannot be copied, so their data is never shared.
+     */
+    static constexpr bool copyable = std::is_copy_constructible<T>::value;
+    
+    /**
+     * Make a copy of the data with captured references.
+     * Such data must not share anything with the copy, because it can still be modified
+     * through the references.
+     *
+     * @param[in] data : data to copy
+     * @returns pointer to the copy
+     */
+    static pointer referenced_copy_of(T const& data) {
+        if constexpr (std::is_constructible<T, T const&, deep_copy_t>::value) {
+            return RefCount::template make<T>(data, deep_copy_t());
+        } else {
+            return RefCount::template make<T>(data);
+        }
+    }
+    
+    /**
+     * Make a copy of the shared data.
+     *
+     * @param[in] data : data to copy
+     * @returns pointer to the copy
+     */
+    static pointer copy_of(T const& data) {
+        if constexpr (copyable) {
+            return RefCount::template make<T>(data);
+        } else {
+            // Move-only data is never shared, so it's never detached
+            assert(false);
+            throw std::logic_error("cow_data: Move-only data cannot be detached.");
+        }
+    }
+    
+    /**
+     * Drop the reference to the data.
+     * If this is the last reference and there's a reclaimer
+     * the data is released on the reclaimer thread.
+     *
+     * @param[in] data : reference to drop
+     * @throws never
+     */
+    void release(pointer&& data) noexcept {
+        if(reclaimer && data.use_count() == 1) {
+            if constexpr (std::is_same<pointer, std::shared_ptr<T>>::value) {
+                reclaimer->retire(std::move(data));
+            } else {
+                try {
+                    reclaimer->retire(std::make_shared<pointer>(std::move(data)));
+                } catch(...) {
+                    // Destroy the data on the calling thread
+                }
+            }
+        }
+        data.reset();
+    }
     
 public:
 
@@ -75,15 +473,30 @@ public:
      */
     class cow_writer {
     private:
-        cow_data<T>& ref;
-        std::shared_ptr<T> buffer;
+        cow_data& ref;
+        pointer buffer;
     public:
         
-        cow_writer(cow_data<T>& data): ref(data) {
+        cow_writer(cow_data& data): ref(data) {
+            if(!is_shared()) {
+                buffer = ref.shared_data;
+            } else {
+                buffer = copy_of(*ref.shared_data);
+            }
+        }
+        
+        /**
+         * Create writer that detaches shared data using custom copy function.
+         *
+         * @param[in] data : source container
+         * @param[in] copy : function returning copy of T for given const T&
+         */
+        template <typename Copier>
+        cow_writer(cow_data& data, Copier&& copy): ref(data) {
             if(!is_shared()) {
                 buffer = ref.shared_data;
             } else {
-                buffer = std::make_shared<T>(T(*ref.shared_data));
+                buffer = RefCount::template make<T>(copy(static_cast<const T&>(*ref.shared_data)));
             }
         }
         
@@ -121,7 +534,7 @@ public:
          * @returns reference to self
          */
         cow_writer& detach() {
-            buffer = std::make_shared<T>(T(*buffer));
+            buffer = copy_of(*buffer);
             return *this;
         }
         
@@ -140,18 +553,21 @@ public:
     
     /**
      * Reader view.
-     * Reader cannot modify any data.
+     * Reader cannot modify any data, including the sharing state,
+     * so any number of threads may read the same container at once.
+     *
+     * References captured by reader do not have to make the data unshareable:
+     * they cannot modify it, and the copies that share it detach before they mutate it.
      * NOTE:
      *   References and pointers captured by reader are valid only
-     *   to the moment of the next mutation (usage of writer)
-     *   or object sharing (assignment).
+     *   to the moment of the next mutation (usage of writer).
      */
     class cow_reader {
     private:
-        const cow_data<T>& ref;
+        const cow_data& ref;
     public:
         
-        cow_reader(const cow_data<T>& data): ref(data) {
+        cow_reader(const cow_data& data): ref(data) {
             
         }
         
@@ -183,60 +599,12 @@ public:
         }
     };
     
-    /**
-     * Persistent reader view.
-     * Reader cannot modify any data.
-     *
-     * This version of reader provides 'unsharing' functionality.
-     * After contructing such a reader the source object is marked
-     * as unshareable to the moment of next mutation (usage of writer).
-     * Thanks to that you can capture the internal references and pointers
-     * and use them freely even when the data will be shared.
-     *
-     * NOTE:
-     *   References and pointers captured by reader are valid only
-     *   to the moment of the next mutation (usage of writer).
-     */
-    class cow_persistent_reader {
-    private:
-        const cow_data<T>& ref;
-    public:
-    
-        cow_persistent_reader(const cow_data<T>& data): ref(data) {
-            *ref.shareableState = false;
-        }
-        /**
-         * Checks if any COW container is currently sharing the local data.
-         *
-         * @returns Is the held data shared by any other container?
-         */
-        bool is_shared() const noexcept {
-            return ref.shared_data.use_count() > 1;
-        }
-        
-        /**
-         * Get the read-only reference to the internal data.
-         *
-         * @returns Reference to the captured object (copy or original version)
-         */
-        const T& operator*() const {
-            return *ref.shared_data;
-        }
-        
-        /**
-         * Get the read-only pointer to the internal data.
-         *
-         * @returns Pointer to the captured object (copy or original version)
-         */
-        const T * operator->() const {
-            return &(*ref.shared_data);
-        }
-    };
-    
     /**
      * Persistent writer view.
      *
-     * This version of writer always works on the original version of the object.
+     * This version of writer works on the original version of the object
+     * unless it is shared - then the data is detached first, so the other containers
+     * do not see the changes.
      *
      * This version of writer provides 'unsharing' functionality.
      * After contructing such a writer the source object is marked
@@ -250,10 +618,13 @@ public:
      */
     class cow_persistent_writer {
     private:
-        cow_data<T>& ref;
+        cow_data& ref;
     public:
     
-        cow_persistent_writer(cow_data<T>& data): ref(data) {
+        cow_persistent_writer(cow_data& data): ref(data) {
+            if(is_shared()) {
+                ref.shared_data = copy_of(*ref.shared_data);
+            }
             *ref.shareableState = false;
         }
         
@@ -291,43 +662,53 @@ public:
      *
      * @param[in] value : initial value of the stored data
      */
-    cow_data(T value): shareableState(std::make_shared<bool>(true)), shared_data(std::make_shared<T>(T())) {
-        shared_data = std::make_shared<T>(value);
+    cow_data(T value): shareableState(std::make_shared<bool>(true)), shared_data(RefCount::template make<T>(std::move(value))) {
+        
     }
     
     /**
      * Creates empty container using default empty constructor of type T.
      * By default container is standalone and sharable.
      */
-    cow_data(): shareableState(std::make_shared<bool>(true)), shared_data(std::make_shared<T>(T())) {
+    cow_data(): shareableState(std::make_shared<bool>(true)), shared_data(RefCount::template make<T>(T())) {
     
     }
     
     /**
      * Creates container using another COW container contents.
      * Contents will be shared and sharable.
+     * Deleted when T is not copy constructible.
      *
      * @param[in] d : source to be copied
      */
-    cow_data(cow_data<T> const& d): shareableState(std::make_shared<bool>(true)) {
+    cow_data(std::conditional_t<copyable, cow_data, disabled_argument> const& d): shareableState(std::make_shared<bool>(true)), reclaimer(d.reclaimer) {
         if(*d.shareableState) {
             shared_data = d.shared_data;
         } else {
-            shared_data = std::make_shared<T>(*d.shared_data);
+            shared_data = referenced_copy_of(*d.shared_data);
         }
     }
     
+    cow_data(std::conditional_t<copyable, disabled_argument, cow_data> const&) = delete;
+    
     /**
      * Creates container using another COW container contents.
      * Contents will be shared and sharable.
+     * Move-only contents are moved out of the source, which is left empty.
      *
      * * @param[in] d : source to be copied
      */
-    cow_data(cow_data<T>&& d): shareableState(std::make_shared<bool>(true)) {
-        if(*d.shareableState) {
-            shared_data = d.shared_data;
+    cow_data(cow_data&& d): shareableState(std::make_shared<bool>(true)), reclaimer(d.reclaimer) {
+        if constexpr (copyable) {
+            if(*d.shareableState) {
+                shared_data = d.shared_data;
+            } else {
+                shared_data = referenced_copy_of(*d.shared_data);
+            }
         } else {
-            shared_data = std::make_shared<T>(*d.shared_data);
+            auto empty = RefCount::template make<T>();
+            shared_data = std::move(d.shared_data);
+            d.shared_data = std::move(empty);
         }
     }
     
@@ -338,15 +719,61 @@ public:
      * @param[in] d : another COW data container
      * @returns reference to self
      */
-    cow_data& operator= (cow_data<T> d) {
-        if(*d.shareableState) {
-            shared_data = d.shared_data;
+    cow_data& operator= (cow_data d) {
+        auto old = std::move(shared_data);
+        if constexpr (copyable) {
+            if(*d.shareableState) {
+                shared_data = d.shared_data;
+            } else {
+                shared_data = referenced_copy_of(*d.shared_data);
+            }
         } else {
-            shared_data = std::make_shared<T>(*d.shared_data);
+            shared_data = std::move(d.shared_data);
         }
+        release(std::move(old));
         return *this;
     }
     
+    /**
+     * Releases the data.
+     * If this was the last reference and there's a reclaimer
+     * the data is destroyed on the reclaimer thread.
+     */
+    ~cow_data() {
+        release(std::move(shared_data));
+    }
+    
+    /**
+     * Set the reclaimer used to destroy the data dropped by this container.
+     * Copies of the container use the same reclaimer.
+     *
+     * @param[in] r : reclaimer (null to destroy the data on the calling thread)
+     * @throws never
+     */
+    void set_reclaimer(std::shared_ptr<background_reclaimer> r) noexcept {
+        reclaimer = std::move(r);
+    }
+    
+    /**
+     * Check if the dropped data is destroyed by a reclaimer.
+     * @throws never
+     */
+    bool has_reclaimer() const noexcept {
+        return static_cast<bool>(reclaimer);
+    }
+    
+    /**
+     * Replace the data with default constructed T in O(1).
+     * Old data is released (on the reclaimer thread if there's one).
+     * Provides strong exception guarantee.
+     */
+    void reset() {
+        auto fresh = RefCount::template make<T>();
+        std::swap(shared_data, fresh);
+        *shareableState = true;
+        release(std::move(fresh));
+    }
+    
     /**
      * Create the reader object.
      *
@@ -366,21 +793,23 @@ public:
     }
     
     /**
-     * Create the persistent reader object.
+     * Create the writer object.
      *
-     * @returns persistent reader of the data
+     * @returns writer of the data
      */
-    cow_persistent_reader readPersistent() const {
-        return cow_persistent_reader(*this);
+    cow_writer write() {
+        return cow_writer(*this);
     }
     
     /**
-     * Create the writer object.
+     * Create the writer object that detaches shared data using custom copy function.
      *
+     * @param[in] copy : function returning copy of T for given const T&
      * @returns writer of the data
      */
-    cow_writer write() {
-        return cow_writer(*this);
+    template <typename Copier>
+    cow_writer write(Copier&& copy) {
+        return cow_writer(*this, std::forward<Copier>(copy));
     }
     
     //TODO: Remove
@@ -394,6 +823,1357 @@ public:
 };
 
 
+/**
+ * Uniquely owned data container with the interface of cow_data.
+ * The data is held directly and never shared: readers and writers
+ * access it in place, commit() does nothing and copies are deep.
+ *
+ * @tparam T : Type of value that is held by container
+ */
+template <typename T>
+class unique_data {
+private:
+    
+    /** The underlying data */
+    T data;
+    
+    /** Reclaimer releasing the data dropped by this container (optional) */
+    std::shared_ptr<background_reclaimer> reclaimer;
+    
+    /** Can the data be copied? */
+    static constexpr bool copyable = std::is_copy_constructible<T>::value;
+    
+    /**
+     * Make a copy of the data.
+     * References to the data can be held at any time, so the copy shares nothing with it.
+     *
+     * @param[in] d : data to copy
+     * @returns copy of the data
+     */
+    static T copy_of(T const& d) {
+        if constexpr (std::is_constructible<T, T const&, deep_copy_t>::value) {
+            return T(d, deep_copy_t());
+        } else {
+            return T(d);
+        }
+    }
+    
+    /**
+     * Release the data.
+     * If there's a reclaimer the data is moved out and destroyed on the reclaimer thread.
+     *
+     * @param[in] dropped : data to release
+     * @throws never
+     */
+    void release(T& dropped) noexcept {
+        if(!reclaimer) {
+            return;
+        }
+        try {
+            reclaimer->retire(std::make_shared<T>(std::move(dropped)));
+        } catch(...) {
+            // Destroy the data on the calling thread
+        }
+    }
+    
+public:
+
+    /**
+     * View of the data.
+     * Same for readers and writers: there is nothing to detach or commit.
+     */
+    template <bool Const>
+    class view {
+    private:
+        using data_type = typename std::conditional<Const, T const, T>::type;
+        data_type& ref;
+    public:
+    
+        explicit view(data_type& d) noexcept: ref(d) {
+        
+        }
+        
+        /**
+         * Uniquely owned data is never shared.
+         * @throws never
+         */
+        constexpr bool is_shared() const noexcept {
+            return false;
+        }
+        
+        data_type& operator*() const noexcept {
+            return ref;
+        }
+        
+        data_type* operator->() const noexcept {
+            return &ref;
+        }
+        
+        /**
+         * Changes are done in place so there's nothing to commit.
+         * @throws never
+         */
+        void commit() noexcept {
+        
+        }
+    };
+    
+    /**
+     * Creates container holding the given value.
+     *
+     * @param[in] value : initial value of the stored data
+     */
+    unique_data(T value): data(std::move(value)) {
+    
+    }
+    
+    /**
+     * Creates container holding default constructed T.
+     */
+    unique_data(): data() {
+    
+    }
+    
+    /**
+     * Creates container holding the copy of another container contents.
+     * Deleted when T is not copy constructible.
+     *
+     * @param[in] d : source to be copied
+     */
+    unique_data(typename std::conditional<copyable, unique_data, disabled_argument>::type const& d): data(copy_of(d.data)), reclaimer(d.reclaimer) {
+    
+    }
+    
+    unique_data(typename std::conditional<copyable, disabled_argument, unique_data>::type const&) = delete;
+    
+    /**
+     * Creates container taking over another container contents.
+     *
+     * @param[in] d : source to be moved
+     */
+    unique_data(unique_data&& d): data(std::move(d.data)), reclaimer(d.reclaimer) {
+    
+    }
+    
+    /**
+     * Replaces the contents with the copy or contents of another container.
+     *
+     * @param[in] d : another container
+     * @returns reference to self
+     */
+    unique_data& operator= (unique_data d) {
+        std::swap(data, d.data);
+        release(d.data);
+        return *this;
+    }
+    
+    /**
+     * Releases the data (on the reclaimer thread if there's one).
+     */
+    ~unique_data() {
+        release(data);
+    }
+    
+    /**
+     * Set the reclaimer used to destroy the data dropped by this container.
+     *
+     * @param[in] r : reclaimer (null to destroy the data on the calling thread)
+     * @throws never
+     */
+    void set_reclaimer(std::shared_ptr<background_reclaimer> r) noexcept {
+        reclaimer = std::move(r);
+    }
+    
+    /**
+     * Check if the dropped data is destroyed by a reclaimer.
+     * @throws never
+     */
+    bool has_reclaimer() const noexcept {
+        return static_cast<bool>(reclaimer);
+    }
+    
+    /**
+     * Replace the data with default constructed T.
+     * Old data is released (on the reclaimer thread if there's one).
+     */
+    void reset() {
+        T fresh;
+        std::swap(data, fresh);
+        release(fresh);
+    }
+    
+    view<true> read() const noexcept {
+        return view<true>(data);
+    }
+    
+    view<false> writePersistent() noexcept {
+        return view<false>(data);
+    }
+    
+    view<false> write() noexcept {
+        return view<false>(data);
+    }
+    
+    /**
+     * Create the writer object.
+     * The copy function is never used, because the data is never shared.
+     *
+     * @returns writer of the data
+     */
+    template <typename Copier>
+    view<false> write(Copier&&) noexcept {
+        return view<false>(data);
+    }
+};
+
+
+/**
+ * Exception guarantee policy: every mutation either succeeds
+ * or leaves the queue untouched.
+ * Mutations are prepared on temporary buffers that are spliced into the queue at the end.
+ */
+struct strong_guarantee {
+    using category = guarantee_policy;
+};
+
+/**
+ * Exception guarantee policy: mutations work directly on the queue.
+ * When an operation fails the queue stays consistent, but it does not have to be
+ * in the state from before the call.
+ */
+struct basic_guarantee {
+    using category = guarantee_policy;
+};
+
+/**
+ * Exception guarantee policy: picks basic_guarantee when copying, moving
+ * and comparing keys and values cannot throw, strong_guarantee otherwise
+ * (values that cannot be copied only have to be nothrow movable).
+ * In the former case both policies behave the same (allocation failures are rolled back),
+ * so the buffered strong path would be pure overhead.
+ */
+struct auto_guarantee {
+    using category = guarantee_policy;
+};
+
+/**
+ * Checks if all the key, value operations used by keyed_queue are declared noexcept.
+ *
+ * @tparam K : Key type
+ * @tparam V : Value type
+ */
+template <class K, class V>
+struct keyed_queue_nothrow {
+    static constexpr bool value =
+        std::is_nothrow_copy_constructible<K>::value &&
+        std::is_nothrow_move_constructible<K>::value &&
+        (std::is_nothrow_copy_constructible<V>::value || !std::is_copy_constructible<V>::value) &&
+        std::is_nothrow_move_constructible<V>::value &&
+        noexcept(std::declval<K const&>() < std::declval<K const&>());
+};
+
+/**
+ * Resolves exception guarantee policy into the flag telling
+ * if keyed_queue may mutate its data in-place.
+ *
+ * @tparam G : Exception guarantee policy
+ * @tparam K : Key type
+ * @tparam V : Value type
+ */
+template <class G, class K, class V>
+struct keyed_queue_in_place;
+
+template <class K, class V>
+struct keyed_queue_in_place<strong_guarantee, K, V> : std::false_type {};
+
+template <class K, class V>
+struct keyed_queue_in_place<basic_guarantee, K, V> : std::true_type {};
+
+template <class K, class V>
+struct keyed_queue_in_place<auto_guarantee, K, V> : std::integral_constant<bool, keyed_queue_nothrow<K, V>::value> {};
+
+
+/**
+ * Ownership policy: queues share their data copy-on-write.
+ * Copying a queue takes O(1) time, the first mutation of shared data copies it.
+ */
+struct shared_ownership {
+    using category = ownership_policy;
+    
+    template <class T, class RefCount>
+    using holder = cow_data<T, RefCount>;
+};
+
+/**
+ * Ownership policy: every queue owns its data.
+ * Mutations skip all the copy-on-write bookkeeping, copying a queue copies all the elements.
+ */
+struct unique_ownership {
+    using category = ownership_policy;
+    
+    template <class T, class RefCount>
+    using holder = unique_data<T>;
+};
+
+
+/**
+ * Execution policy of keyed_queue bulk operations.
+ * Work is split into contiguous ranges handled by separate threads.
+ * Calling thread always handles one of the ranges.
+ */
+class parallel_policy {
+private:
+    /** Maximal number of threads (0 means hardware concurrency) */
+    unsigned max_threads;
+    /** Minimal number of elements handled by one thread */
+    std::size_t min_chunk;
+public:
+
+    /**
+     * Create the policy.
+     *
+     * @param[in] threads : maximal number of threads (0 means std::thread::hardware_concurrency())
+     * @param[in] chunk   : minimal number of elements worth a separate thread
+     */
+    explicit parallel_policy(unsigned threads = 0, std::size_t chunk = 16384): max_threads(threads), min_chunk(chunk) {
+    
+    }
+    
+    /**
+     * Create the policy that does all the work on the calling thread.
+     *
+     * @returns sequential policy
+     */
+    static parallel_policy sequential() {
+        return parallel_policy(1);
+    }
+    
+    /**
+     * Get the number of workers that should handle the given number of elements.
+     *
+     * @param[in] items : number of elements
+     * @returns number of workers (at least 1)
+     * @throws never
+     */
+    unsigned workers(std::size_t items) const noexcept {
+        const unsigned threads = max_threads ? max_threads : std::max(1u, std::thread::hardware_concurrency());
+        const std::size_t by_size = std::max<std::size_t>(1, items / std::max<std::size_t>(1, min_chunk));
+        return static_cast<unsigned>(std::min<std::size_t>(threads, by_size));
+    }
+    
+    /**
+     * Run f(0), ..., f(workers - 1) in parallel.
+     * f(0) runs on the calling thread. If a thread cannot be started its work runs on the calling thread.
+     * Waits for all the workers and rethrows the first exception thrown by any of them.
+     *
+     * @param[in] workers : number of workers
+     * @param[in] f       : function taking worker number
+     */
+    template <class F>
+    static void run(unsigned workers, F const& f) {
+        std::vector<std::exception_ptr> errors(workers);
+        std::vector<std::thread> threads;
+        const auto guarded = [&](unsigned i) {
+            try {
+                f(i);
+            } catch(...) {
+                errors[i] = std::current_exception();
+            }
+        };
+        try {
+            threads.reserve(workers);
+        } catch(...) {
+            // Run everything on the calling thread
+        }
+        for(unsigned i = 1; i < workers; ++i) {
+            try {
+                threads.emplace_back(guarded, i);
+            } catch(...) {
+                guarded(i);
+            }
+        }
+        guarded(0);
+        for(auto& t : threads) {
+            t.join();
+        }
+        for(auto& e : errors) {
+            if(e) std::rethrow_exception(e);
+        }
+    }
+    
+    /**
+     * Split [begin, end) into contiguous ranges of (almost) equal size
+     * and run f(worker, range_begin, range_end) for each of them in parallel.
+     * The range is walked once: every worker starts as soon as the walk reaches the end
+     * of its range and the calling thread handles the last range.
+     * Waits for all the workers and rethrows the first exception thrown by any of them.
+     *
+     * @param[in] workers : number of ranges
+     * @param[in] begin   : first element
+     * @param[in] end     : past-the-end element
+     * @param[in] size    : number of elements between begin and end
+     * @param[in] f       : function handling one range
+     */
+    template <class Iter, class F>
+    static void split(unsigned workers, Iter begin, Iter end, std::size_t size, F const& f) {
+        std::vector<std::exception_ptr> errors(workers);
+        std::vector<std::thread> threads;
+        const auto guarded = [&](unsigned w, Iter part_begin, Iter part_end) {
+            try {
+                f(w, part_begin, part_end);
+            } catch(...) {
+                errors[w] = std::current_exception();
+            }
+        };
+        try {
+            threads.reserve(workers);
+        } catch(...) {
+            // Run everything on the calling thread
+        }
+        const std::size_t step = size / workers;
+        try {
+            for(unsigned w = 0; w + 1 < workers; ++w) {
+                Iter part_end = begin;
+                std::advance(part_end, step);
+                try {
+                    threads.emplace_back(guarded, w, begin, part_end);
+                } catch(...) {
+                    guarded(w, begin, part_end);
+                }
+                begin = part_end;
+            }
+        } catch(...) {
+            // Walking the range failed, the started workers must finish first
+            for(auto& t : threads) {
+                t.join();
+            }
+            throw;
+        }
+        guarded(workers - 1, begin, end);
+        for(auto& t : threads) {
+            t.join();
+        }
+        for(auto& e : errors) {
+            if(e) std::rethrow_exception(e);
+        }
+    }
+};
+
+
+/**
+ * Checks if keys of type K can be used in hashed containers.
+ * Requires std::hash<K> that cannot throw and equality comparison.
+ *
+ * @tparam K : Key type
+ */
+template <class K, class = void>
+struct keyed_queue_hashable : std::false_type {};
+
+template <class K>
+struct keyed_queue_hashable<K, std::void_t<
+    decltype(std::hash<K>{}(std::declval<K const&>())),
+    decltype(std::declval<K const&>() == std::declval<K const&>())
+>> : std::integral_constant<bool, noexcept(std::hash<K>{}(std::declval<K const&>()))> {};
+
+
+/**
+ * Index policy: keys mapping reshapes itself from the observed workload (see adaptive_key_index).
+ */
+struct adaptive_index {
+    using category = index_policy;
+};
+
+/**
+ * Index policy: keys mapping always uses std::map.
+ */
+struct ordered_index {
+    using category = index_policy;
+};
+
+/**
+ * Index policy: keys mapping always uses std::unordered_map
+ * (std::map when there's no noexcept std::hash<K> or equality comparison of keys).
+ */
+struct hashed_index {
+    using category = index_policy;
+};
+
+
+/**
+ * Key index that reshapes itself from the observed workload.
+ * It maps every key onto entry of type E.
+ *
+ * Available layouts:
+ *   small   - sorted inline vector, used while there are only a few distinct keys
+ *   hashed  - std::unordered_map, used for many keys
+ *             (requires noexcept std::hash<K> and equality comparison)
+ *   ordered - std::map, used when ordered key scans dominate lookups or K cannot be hashed
+ *
+ * Layout is re-evaluated after every reshape period (at least as many recorded operations
+ * as there are keys), so the cost of migrations is amortised over the recorded operations.
+ * Migration first allocates the whole new layout and then moves the entries,
+ * so on failure the index stays in its old layout.
+ *
+ * Keys that cannot be moved without throwing always use the ordered layout.
+ * With ordered_index or hashed_index policy the index never leaves the chosen layout.
+ *
+ * @tparam K : Key type
+ * @tparam E : Entry type held for each key (must be nothrow movable)
+ * @tparam Index : Index policy (adaptive_index, ordered_index or hashed_index)
+ */
+template <class K, class E, class Index = adaptive_index>
+class adaptive_key_index {
+public:
+
+    /** Internal layouts of the index */
+    enum class layout { small, hashed, ordered };
+
+    /** Maximal number of keys held in the small layout */
+    static constexpr std::size_t small_limit = 8;
+    /** Minimal number of operations between two layout evaluations */
+    static constexpr std::size_t reshape_period = 64;
+
+    /** Can the entries be migrated between layouts? */
+    static constexpr bool migratable =
+        std::is_nothrow_move_constructible<K>::value &&
+        std::is_nothrow_move_assignable<K>::value &&
+        std::is_nothrow_move_constructible<E>::value &&
+        std::is_nothrow_move_assignable<E>::value;
+    /** Does the index reshape itself? */
+    static constexpr bool adaptive = migratable && std::is_same<Index, adaptive_index>::value;
+    /** Can the index use the hashed layout? */
+    static constexpr bool hash_supported = keyed_queue_hashable<K>::value &&
+        (adaptive || std::is_same<Index, hashed_index>::value);
+
+    /** Small layout storage */
+    using small_map = std::vector<std::pair<K, E>>;
+    /** Ordered layout storage */
+    using ordered_map = std::map<K, E>;
+    /** Hashed layout storage (falls back to the ordered one when K cannot be hashed) */
+    using hashed_map = typename std::conditional<hash_supported, std::unordered_map<K, E>, ordered_map>::type;
+
+    /**
+     * Usage statistics gathered since the last layout evaluation.
+     */
+    struct stats {
+        /** Operations done on the queue ends (push/pop) */
+        std::size_t fifo_ops = 0;
+        /** Operations done on explicitly given keys */
+        std::size_t keyed_ops = 0;
+        /** Iterations over keys in the sorted order */
+        std::size_t scans = 0;
+        /** Number of elements held under the keys at the last recorded operation */
+        std::size_t elements = 0;
+    };
+
+    /**
+     * Position of the entry inside the index.
+     * Valid to the next modification of the index.
+     */
+    class slot {
+    private:
+        friend class adaptive_key_index;
+        E* entry = nullptr;
+        std::size_t small_pos = 0;
+        typename hashed_map::iterator hashed_pos{};
+        typename ordered_map::iterator ordered_pos{};
+    public:
+
+        /**
+         * Checks if the slot points to any entry.
+         * @throws never
+         */
+        explicit operator bool() const noexcept {
+            return entry != nullptr;
+        }
+
+        /**
+         * Get the reference to the entry.
+         * @throws never
+         */
+        E& operator*() const noexcept {
+            return *entry;
+        }
+
+        /**
+         * Get the pointer to the entry.
+         * @throws never
+         */
+        E* operator->() const noexcept {
+            return entry;
+        }
+    };
+
+private:
+
+    /** Currently used layout */
+    layout current;
+    /** Storage of the small layout */
+    small_map small;
+    /** Storage of the hashed layout */
+    hashed_map hashed;
+    /** Storage of the ordered layout */
+    ordered_map ordered;
+    /** Statistics since the last evaluation */
+    stats usage;
+
+    /**
+     * Find the first small layout position not less than the key.
+     */
+    typename small_map::iterator small_lower_bound(K const& k) {
+        return std::lower_bound(small.begin(), small.end(), k, [](std::pair<K, E> const& e, K const& key) {
+            return e.first < key;
+        });
+    }
+
+    /**
+     * Find the first small layout position not less than the key.
+     */
+    typename small_map::const_iterator small_lower_bound(K const& k) const {
+        return std::lower_bound(small.begin(), small.end(), k, [](std::pair<K, E> const& e, K const& key) {
+            return e.first < key;
+        });
+    }
+
+public:
+
+    /**
+     * Call f(key, entry) for all entries of the current layout.
+     * Entries are visited in the sorted order of keys only for small and ordered layouts.
+     *
+     * @param[in] f : function taking (K const&, E&)
+     */
+    template <class F>
+    void visit(F f) {
+        if(current_layout() == layout::small) {
+            for(auto& e : small) f(e.first, e.second);
+        } else if(current_layout() == layout::hashed) {
+            for(auto& e : hashed) f(e.first, e.second);
+        } else {
+            for(auto& e : ordered) f(e.first, e.second);
+        }
+    }
+
+    /**
+     * Call f(key, entry) for all entries of the current layout.
+     * Entries are visited in the sorted order of keys only for small and ordered layouts.
+     *
+     * @param[in] f : function taking (K const&, E const&)
+     */
+    template <class F>
+    void visit(F f) const {
+        if(current_layout() == layout::small) {
+            for(auto& e : small) f(e.first, e.second);
+        } else if(current_layout() == layout::hashed) {
+            for(auto& e : hashed) f(e.first, e.second);
+        } else {
+            for(auto& e : ordered) f(e.first, e.second);
+        }
+    }
+
+private:
+
+    /**
+     * Pick the layout for many keys.
+     * Sorting the keys for every scan of the hashed layout costs about as much
+     * as all the lookups between the scans, so once that dominates the ordered layout is cheaper.
+     * When the keys hold few elements each, pushes and pops mostly create and erase keys,
+     * which also rebalances the tree of the ordered layout: the operations weigh up to twice
+     * as much (with one element per key).
+     *
+     * @throws never
+     */
+    layout large_layout() const noexcept {
+        if(!hash_supported) {
+            return layout::ordered;
+        }
+        const auto ops = usage.fifo_ops + usage.keyed_ops;
+        const auto churn = (usage.elements > size()) ? ops * size() / usage.elements : ops;
+        return (usage.scans * size() > ops + churn) ? layout::ordered : layout::hashed;
+    }
+
+    /**
+     * Pick the cheapest layout for the current statistics.
+     * Small layout is left only when it's full and entered back
+     * only when the keys fit in half of it, so the index does not flip between layouts.
+     *
+     * @throws never
+     */
+    layout preferred_layout() const noexcept {
+        if(adaptive) {
+            const auto limit = (current_layout() == layout::small) ? small_limit : small_limit / 2;
+            if(size() <= limit) {
+                return layout::small;
+            }
+        }
+        return large_layout();
+    }
+
+    /**
+     * Migrate all the entries to another layout.
+     * All the allocations are done before any entry is moved.
+     *
+     * @param[in] target : New layout
+     */
+    void migrate(layout target) {
+        if(target == current) {
+            return;
+        }
+        // Pairs of (source entry, key) to be moved
+        std::vector<std::pair<E*, K const*>> sources;
+        sources.reserve(size());
+        visit([&](K const& k, E& e) {
+            sources.push_back({ &e, &k });
+        });
+        // Destinations of the entries (in order of sources)
+        std::vector<E*> targets;
+        targets.reserve(sources.size());
+
+        small_map new_small;
+        hashed_map new_hashed;
+        ordered_map new_ordered;
+
+        if(target == layout::small) {
+            if constexpr (adaptive) {
+                std::sort(sources.begin(), sources.end(), [](auto const& a, auto const& b) {
+                    return *a.second < *b.second;
+                });
+                new_small.reserve(small_limit);
+                for(auto& s : sources) {
+                    new_small.emplace_back(*s.second, E());
+                    targets.push_back(&new_small.back().second);
+                }
+            }
+        } else if(target == layout::hashed) {
+            if constexpr (hash_supported) {
+                new_hashed.reserve(sources.size());
+                for(auto& s : sources) {
+                    targets.push_back(&new_hashed.try_emplace(*s.second).first->second);
+                }
+            }
+        } else {
+            for(auto& s : sources) {
+                targets.push_back(&new_ordered.try_emplace(new_ordered.end(), *s.second)->second);
+            }
+        }
+
+        // Nothing below can throw
+        for(std::size_t i = 0; i < sources.size(); ++i) {
+            *targets[i] = std::move(*sources[i].first);
+        }
+        small = std::move(new_small);
+        hashed = std::move(new_hashed);
+        ordered = std::move(new_ordered);
+        current = target;
+    }
+
+    /**
+     * Get the layout of the empty index.
+     * @throws never
+     */
+    static constexpr layout initial_layout() noexcept {
+        if(adaptive) {
+            return layout::small;
+        }
+        return hash_supported ? layout::hashed : layout::ordered;
+    }
+
+public:
+
+    /**
+     * Create empty index.
+     * Starts in the small layout if the index is adaptive.
+     */
+    adaptive_key_index(): current(initial_layout()) {
+
+    }
+
+    /**
+     * Create empty index in the same layout as other index.
+     * Useful to copy the index without migrating it again.
+     *
+     * @param[in] l : Initial layout
+     */
+    explicit adaptive_key_index(layout l): current(l) {
+        if(!adaptive || (l == layout::hashed && !hash_supported)) {
+            current = initial_layout();
+        }
+    }
+
+    adaptive_key_index(adaptive_key_index const&) = delete;
+    adaptive_key_index(adaptive_key_index&&) = default;
+    adaptive_key_index& operator=(adaptive_key_index const&) = delete;
+    adaptive_key_index& operator=(adaptive_key_index&&) = default;
+
+    /**
+     * Get the layout currently used.
+     * Known at compile time when the index does not reshape itself.
+     * @throws never
+     */
+    layout current_layout() const noexcept {
+        if constexpr (!adaptive) {
+            return initial_layout();
+        } else {
+            return current;
+        }
+    }
+
+    /**
+     * Get the statistics gathered since the last evaluation.
+     * @throws never
+     */
+    stats const& statistics() const noexcept {
+        return usage;
+    }
+
+    /**
+     * Gets the number of keys in the index.
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        switch(current_layout()) {
+            case layout::small: return small.size();
+            case layout::hashed: return hashed.size();
+            default: return ordered.size();
+        }
+    }
+
+    /**
+     * Checks if there are no keys in the index.
+     * @throws never
+     */
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    /**
+     * Find the entry of the given key.
+     *
+     * @param[in] k : key
+     * @returns slot of the entry (empty if the key is missing)
+     */
+    slot find(K const& k) {
+        slot s;
+        if(current_layout() == layout::small) {
+            const auto i = small_lower_bound(k);
+            if(i != small.end() && !(k < i->first)) {
+                s.entry = &i->second;
+                s.small_pos = static_cast<std::size_t>(i - small.begin());
+            }
+        } else if(current_layout() == layout::hashed) {
+            const auto i = hashed.find(k);
+            if(i != hashed.end()) {
+                s.entry = &i->second;
+                s.hashed_pos = i;
+            }
+        } else {
+            const auto i = ordered.find(k);
+            if(i != ordered.end()) {
+                s.entry = &i->second;
+                s.ordered_pos = i;
+            }
+        }
+        return s;
+    }
+
+    /**
+     * Find the entry of the given key.
+     *
+     * @param[in] k : key
+     * @returns pointer to the entry or nullptr if the key is missing
+     */
+    E const* find(K const& k) const {
+        if(current_layout() == layout::small) {
+            const auto i = small_lower_bound(k);
+            return (i != small.end() && !(k < i->first)) ? &i->second : nullptr;
+        } else if(current_layout() == layout::hashed) {
+            const auto i = hashed.find(k);
+            return (i != hashed.end()) ? &i->second : nullptr;
+        }
+        const auto i = ordered.find(k);
+        return (i != ordered.end()) ? &i->second : nullptr;
+    }
+
+    /**
+     * Make sure there's an entry for the given key.
+     * Inserts default constructed entry if the key is missing.
+     * Provides strong exception guarantee.
+     *
+     * @param[in] k : key
+     * @returns slot of the entry and flag telling if it was inserted
+     */
+    std::pair<slot, bool> try_emplace(K const& k) {
+        if(current_layout() == layout::small) {
+            if constexpr (adaptive) {
+                auto i = small_lower_bound(k);
+                if(i != small.end() && !(k < i->first)) {
+                    slot s;
+                    s.entry = &i->second;
+                    s.small_pos = static_cast<std::size_t>(i - small.begin());
+                    return { s, false };
+                }
+                if(small.size() < small_limit) {
+                    const auto pos = i - small.begin();
+                    small.reserve(small_limit);
+                    std::pair<K, E> entry(k, E());
+                    // Capacity is already reserved so the insertion only moves entries
+                    i = small.insert(small.begin() + pos, std::move(entry));
+                    slot s;
+                    s.entry = &i->second;
+                    s.small_pos = static_cast<std::size_t>(pos);
+                    return { s, true };
+                }
+                migrate(large_layout());
+            }
+        }
+        slot s;
+        bool inserted;
+        if(current_layout() == layout::hashed) {
+            const auto r = hashed.try_emplace(k);
+            s.entry = &r.first->second;
+            s.hashed_pos = r.first;
+            inserted = r.second;
+        } else {
+            const auto r = ordered.try_emplace(k);
+            s.entry = &r.first->second;
+            s.ordered_pos = r.first;
+            inserted = r.second;
+        }
+        return { s, inserted };
+    }
+
+    /**
+     * Remove the entry.
+     *
+     * @param[in] s : slot obtained from find() or try_emplace()
+     */
+    void erase(slot const& s) {
+        if(current_layout() == layout::small) {
+            if constexpr (adaptive) {
+                small.erase(small.begin() + s.small_pos);
+            }
+        } else if(current_layout() == layout::hashed) {
+            hashed.erase(s.hashed_pos);
+        } else {
+            ordered.erase(s.ordered_pos);
+        }
+    }
+
+    /**
+     * Prepare the index for the given number of keys.
+     * Leaves the small layout if the keys would not fit in it
+     * and reserves the buckets of the hashed layout.
+     *
+     * @param[in] count : expected number of keys
+     */
+    void reserve(std::size_t count) {
+        if(adaptive && current_layout() == layout::small && count > small_limit) {
+            migrate(large_layout());
+        }
+        if(current_layout() == layout::hashed) {
+            hashed.reserve(count);
+        }
+    }
+
+    /**
+     * Move all the entries of another index into this one.
+     * The indexes must not share any key. When both use the same large layout
+     * the nodes are moved without allocating, otherwise the entries are moved one by one.
+     *
+     * @param[in] other : index with other keys (left empty)
+     */
+    void merge(adaptive_key_index& other) {
+        if(current_layout() == other.current_layout() && current_layout() == layout::hashed) {
+            hashed.merge(other.hashed);
+        } else if(current_layout() == other.current_layout() && current_layout() == layout::ordered) {
+            ordered.merge(other.ordered);
+        } else {
+            other.visit([this](K const& k, E& e) {
+                *try_emplace(k).first = std::move(e);
+            });
+        }
+        other.clear();
+    }
+
+    /**
+     * Remove all the entries.
+     * Index goes back to its initial layout.
+     *
+     * @throws never
+     */
+    void clear() noexcept {
+        small.clear();
+        hashed.clear();
+        ordered.clear();
+        usage = stats();
+        current = initial_layout();
+    }
+
+    /**
+     * Checks if the keys can be iterated directly in the sorted order.
+     * @throws never
+     */
+    bool is_ordered() const noexcept {
+        return current_layout() == layout::ordered;
+    }
+
+    /**
+     * Get the ordered layout storage.
+     * Holds the keys only when is_ordered() is true.
+     *
+     * @returns ordered mapping
+     */
+    ordered_map const& ordered_entries() const noexcept {
+        return ordered;
+    }
+
+    /**
+     * Copy the keys in the sorted order.
+     *
+     * @returns sorted vector of the keys
+     */
+    std::vector<K> sorted_keys() const {
+        std::vector<K> result;
+        result.reserve(size());
+        if(current_layout() == layout::small) {
+            for(auto& e : small) result.push_back(e.first);
+        } else if(current_layout() == layout::hashed) {
+            if constexpr (hash_supported) {
+                for(auto& e : hashed) result.push_back(e.first);
+                std::sort(result.begin(), result.end());
+            }
+        } else {
+            for(auto& e : ordered) result.push_back(e.first);
+        }
+        return result;
+    }
+
+    /**
+     * Record the operation done on the index
+     * and migrate to better layout at the end of the reshape period.
+     * If the migration fails the index stays as it is.
+     *
+     * @param[in] keyed    : Was the operation done on explicitly given key?
+     * @param[in] scans    : Number of the ordered scans done since the last call
+     * @param[in] elements : Number of elements held under all the keys
+     * @throws never
+     */
+    void record(bool keyed, std::size_t scans, std::size_t elements) noexcept {
+        if(!adaptive) {
+            return;
+        }
+        if(keyed) {
+            ++usage.keyed_ops;
+        } else {
+            ++usage.fifo_ops;
+        }
+        usage.scans += scans;
+        usage.elements = elements;
+        if(usage.fifo_ops + usage.keyed_ops < std::max(reshape_period, size())) {
+            return;
+        }
+        try {
+            migrate(preferred_layout());
+        } catch(...) {
+            // Keep the current layout
+        }
+        usage = stats();
+    }
+};
+
+
+/**
+ * Sequence of positions stored in one contiguous block.
+ * Supports the subset of std::list operations used for per-key positions:
+ * appending at the back and removing from the front, both in amortised O(1).
+ * Removed front positions are reclaimed when the block would have to grow.
+ *
+ * @tparam T : Type of the position (must be nothrow copyable)
+ */
+template <class T>
+class position_vector {
+private:
+    /** Positions (the first `head` ones are already removed) */
+    std::vector<T> items;
+    /** Number of removed positions at the front */
+    std::size_t head = 0;
+    
+public:
+
+    using iterator = typename std::vector<T>::iterator;
+    using const_iterator = typename std::vector<T>::const_iterator;
+    
+    position_vector() noexcept = default;
+    position_vector(position_vector const&) = default;
+    position_vector(position_vector&&) noexcept = default;
+    position_vector& operator=(position_vector const&) = default;
+    position_vector& operator=(position_vector&&) noexcept = default;
+    
+    iterator begin() noexcept {
+        return items.begin() + head;
+    }
+    
+    iterator end() noexcept {
+        return items.end();
+    }
+    
+    const_iterator begin() const noexcept {
+        return items.begin() + head;
+    }
+    
+    const_iterator end() const noexcept {
+        return items.end();
+    }
+    
+    std::size_t size() const noexcept {
+        return items.size() - head;
+    }
+    
+    bool empty() const noexcept {
+        return items.size() == head;
+    }
+    
+    T& front() noexcept {
+        return items[head];
+    }
+    
+    T const& front() const noexcept {
+        return items[head];
+    }
+    
+    T& back() noexcept {
+        return items.back();
+    }
+    
+    T const& back() const noexcept {
+        return items.back();
+    }
+    
+    /**
+     * Append the position.
+     * Provides strong exception guarantee.
+     *
+     * @param[in] p : position
+     */
+    void push_back(T const& p) {
+        if(head > 0 && items.size() == items.capacity() && head * 2 >= items.size()) {
+            // Reuse the space of the removed positions instead of growing
+            items.erase(items.begin(), items.begin() + head);
+            head = 0;
+        }
+        items.push_back(p);
+    }
+    
+    /**
+     * Remove the first position.
+     * @throws never
+     */
+    void pop_front() noexcept {
+        ++head;
+        if(head == items.size()) {
+            items.clear();
+            head = 0;
+        }
+    }
+    
+    /**
+     * Remove all the positions.
+     * @throws never
+     */
+    void clear() noexcept {
+        items.clear();
+        head = 0;
+    }
+    
+    /**
+     * Append all positions of another sequence, leaving it empty.
+     *
+     * @param[in] other : appended positions
+     */
+    void append(position_vector& other) {
+        items.insert(items.end(), other.begin(), other.end());
+        other.clear();
+    }
+};
+
+/**
+ * Storage policy: positions of the elements of every key are kept in a std::list.
+ */
+struct list_storage {
+    using category = storage_policy;
+    
+    template <class T>
+    using positions = std::list<T>;
+};
+
+/**
+ * Storage policy: positions of the elements of every key are kept in a contiguous
+ * block (position_vector), which saves a node allocation per element
+ * and makes scanning the elements of a key cache friendly.
+ */
+struct contiguous_storage {
+    using category = storage_policy;
+    
+    template <class T>
+    using positions = position_vector<T>;
+};
+
+
+/**
+ * Value held in an immutable box shared between copies of the holder.
+ * Copying the holder takes O(1) time, the value is copied only when it's
+ * modified through the holder while other holders share it.
+ *
+ * @tparam V : Value type (must be copy constructible)
+ */
+template <class V>
+class shared_value {
+private:
+    /** Box holding the value */
+    std::shared_ptr<V> box;
+    
+public:
+
+    shared_value(V const& v): box(std::make_shared<V>(v)) {
+    
+    }
+    
+    shared_value(V&& v): box(std::make_shared<V>(std::move(v))) {
+    
+    }
+    
+    shared_value(shared_value const&) = default;
+    shared_value(shared_value&&) noexcept = default;
+    shared_value& operator=(shared_value const&) = default;
+    shared_value& operator=(shared_value&&) noexcept = default;
+    
+    /**
+     * Creates the holder with its own copy of the value.
+     *
+     * @param[in] v : copied holder
+     */
+    shared_value(shared_value const& v, deep_copy_t): box(std::make_shared<V>(v.get())) {
+    
+    }
+    
+    /**
+     * Get the value for reading.
+     * @throws never
+     */
+    V const& get() const noexcept {
+        return *box;
+    }
+    
+    /**
+     * Get the value for writing.
+     * The value is copied first if it's shared with other holders.
+     *
+     * @returns reference to the value owned by this holder
+     */
+    V& mutate() {
+        if(box.use_count() > 1) {
+            box = std::make_shared<V>(static_cast<V const&>(*box));
+        }
+        return *box;
+    }
+    
+    /**
+     * Checks if the value is shared with other holders.
+     * @throws never
+     */
+    bool is_shared() const noexcept {
+        return box.use_count() > 1;
+    }
+};
+
+/**
+ * Value policy: values are stored directly in the queue elements.
+ */
+struct inline_values {
+    using category = value_policy;
+};
+
+/**
+ * Value policy: values are stored in immutable boxes (shared_value) shared between
+ * copy-on-write copies of the queue. Detaching the data copies only the structure,
+ * the values are copied lazily when they're modified through front(), back(), first(), last(),
+ * for_each() or the key_values views.
+ */
+struct shared_values {
+    using category = value_policy;
+};
+
+
+/**
+ * Checks if the type is one of keyed_queue policies.
+ */
+template <class P, class = void>
+struct keyed_queue_is_policy : std::false_type {};
+
+template <class P>
+struct keyed_queue_is_policy<P, std::void_t<typename P::category>> : std::integral_constant<bool,
+    std::is_same<typename P::category, guarantee_policy>::value ||
+    std::is_same<typename P::category, index_policy>::value ||
+    std::is_same<typename P::category, storage_policy>::value ||
+    std::is_same<typename P::category, ownership_policy>::value ||
+    std::is_same<typename P::category, refcount_policy>::value ||
+    std::is_same<typename P::category, value_policy>::value> {};
+
+/**
+ * Resolved configuration of keyed_queue.
+ *
+ * @tparam Policies : List of policies (the last policy of each category wins)
+ */
+template <class... Policies>
+struct keyed_queue_config {
+    static_assert((keyed_queue_is_policy<Policies>::value && ...), "keyed_queue: Unknown policy type.");
+    
+    using guarantee = typename select_policy<guarantee_policy, auto_guarantee, Policies...>::type;
+    using index = typename select_policy<index_policy, adaptive_index, Policies...>::type;
+    using storage = typename select_policy<storage_policy, list_storage, Policies...>::type;
+    using ownership = typename select_policy<ownership_policy, shared_ownership, Policies...>::type;
+    using refcount = typename select_policy<refcount_policy, atomic_refcount, Policies...>::type;
+    using values = typename select_policy<value_policy, inline_values, Policies...>::type;
+};
+
+
+template <class K, class V, class... Policies>
+class keyed_queue;
+
+template <class K, class V>
+class frozen_keyed_queue;
+
+/**
+ * List of policies.
+ */
+template <class... Policies>
+struct policy_list {};
+
+/**
+ * Resolves keyed_queue type with the policies of the given category removed
+ * (so the category uses its default policy) and Extra policies appended.
+ *
+ * @tparam K        : Key type
+ * @tparam V        : Value type
+ * @tparam Category : Removed policy category
+ * @tparam Kept     : policy_list of the policies kept so far
+ * @tparam Policies : Remaining policies
+ */
+template <class K, class V, class Category, class Kept, class... Policies>
+struct keyed_queue_without_policy;
+
+template <class K, class V, class Category, class... Kept>
+struct keyed_queue_without_policy<K, V, Category, policy_list<Kept...>> {
+    template <class... Extra>
+    using with = keyed_queue<K, V, Kept..., Extra...>;
+};
+
+template <class K, class V, class Category, class... Kept, class P, class... Policies>
+struct keyed_queue_without_policy<K, V, Category, policy_list<Kept...>, P, Policies...> :
+    keyed_queue_without_policy<K, V, Category, typename std::conditional<std::is_same<typename P::category, Category>::value,
+        policy_list<Kept...>, policy_list<Kept..., P>>::type, Policies...> {};
+
+
 /**
  * Keyed queue is a FIFO structure that can held pairs of key, value.
  * It offers additional functionality compared to standard queues like
@@ -401,37 +2181,140 @@ public:
  *
  * @tparam K : Key type
  * @tparam V : Value type
+ * @tparam Policies : Policies configuring the queue internals, in any order
+ *                    (the last policy of each category wins):
+ *                      exception guarantee - auto_guarantee (default), strong_guarantee or basic_guarantee
+ *                      keys index          - adaptive_index (default), ordered_index or hashed_index
+ *                      positions storage   - list_storage (default) or contiguous_storage
+ *                      data ownership      - shared_ownership (default) or unique_ownership
+ *                      reference counting  - atomic_refcount (default) or local_refcount
+ *                      values storage      - inline_values (default) or shared_values
  */
-template <class K, class V>
+template <class K, class V, class... Policies>
 class keyed_queue {
 private:
 
+    static_assert(std::is_copy_constructible<K>::value,
+        "keyed_queue: Keys are stored both in the queue and in the keys mapping, so they must be copy constructible.");
+
+    /** Resolved policies */
+    using config = keyed_queue_config<Policies...>;
+
+    /** Do mutations work in-place (basic guarantee) instead of using splice buffers? */
+    static constexpr bool in_place = keyed_queue_in_place<typename config::guarantee, K, V>::value;
+    
+    /** Can the queue be copied? Queues of move-only values can only be moved. */
+    static constexpr bool copyable = std::is_copy_constructible<V>::value;
+    
+    /** Can values be moved into the queue? */
+    static constexpr bool movable_value = !std::is_reference<V>::value && std::is_move_constructible<V>::value;
+    
+    /** Same queue without the ownership policy */
+    using ownership_free = keyed_queue_without_policy<K, V, ownership_policy, policy_list<>, Policies...>;
+    
+    /** Queues with other policies access the data when converting the ownership */
+    template <class, class, class...>
+    friend class keyed_queue;
+    
+    /** Type of the value argument of push(K, V&&) (disabled_argument when values cannot be moved in) */
+    using value_rvalue = std::conditional_t<movable_value, V, disabled_argument>;
+
+    /** Are the values held in boxes shared between copies? */
+    static constexpr bool boxed_values = std::is_same<typename config::values, shared_values>::value;
+    
+    static_assert(!boxed_values || std::is_copy_constructible<V>::value,
+        "keyed_queue: shared_values policy requires copy constructible values.");
+    
+    /** Type of the value stored in the queue */
+    using stored_value = typename std::conditional<boxed_values, shared_value<V>, V>::type;
+
     /** Type of key, value pair */
-    using kv_pair = std::pair<K, V>;
+    using kv_pair = std::pair<K, stored_value>;
     /** List of key, value pairs */
     using kv_list = std::list<kv_pair>;
     /** Iterator to the list of key, value pair list*/
     using kv_list_i = typename kv_list::iterator;
     /** List of key, value iterators */
-    using kvi_list = std::list<kv_list_i>;
+    using kvi_list = typename config::storage::template positions<kv_list_i>;
     /** Iterator to the list of key, value iterator list*/
     using kvi_list_i = typename kvi_list::iterator;
     /** Mapping key -> list of key, value iterators */
-    using kvi_map = std::map<K, kvi_list>;
-    /** Iterator to the mapping key -> list of key, value iterators */
-    using kvi_map_i = typename kvi_map::iterator;
-    /** Const iterator to the mapping key -> list of key, value iterators */
-    using kvi_map_ic = typename kvi_map::const_iterator;
+    using kvi_map = adaptive_key_index<K, kvi_list, typename config::index>;
+    /** Const iterator to the ordered layout of the mapping key -> list of key, value iterators */
+    using kvi_map_ic = typename kvi_map::ordered_map::const_iterator;
+
+    /**
+     * Get the value stored in the queue.
+     * Boxed values are unshared first when they're accessed for writing.
+     *
+     * @param[in] v : stored value
+     * @returns reference to the value
+     */
+    template <class S>
+    static auto& value_of(S& v) {
+        if constexpr (!boxed_values) {
+            return v;
+        } else if constexpr (std::is_const<S>::value) {
+            return v.get();
+        } else {
+            return v.mutate();
+        }
+    }
+    
+    /**
+     * Get the key to build the extracted pair from.
+     * The key is moved only when nothing after it can throw.
+     *
+     * @param[in] k : key stored in the element
+     * @returns rvalue or const reference to the key
+     */
+    template <bool MoveKey>
+    static decltype(auto) key_source(K& k) noexcept {
+        if constexpr (MoveKey) {
+            return std::move(k);
+        } else {
+            return static_cast<K const&>(k);
+        }
+    }
+    
+    /**
+     * Take the element out of the queue as a key, value pair.
+     * The key is built first, then the value; the key is copied unless both moves are noexcept
+     * and the value is moved only if its move is noexcept (or it cannot be copied), so when building
+     * the pair throws, the element is left untouched. Boxed values are copied when the box is shared.
+     *
+     * @param[in] e : element
+     * @returns the key, value pair
+     */
+    static std::pair<K, V> take_element(kv_pair& e) {
+        constexpr bool nothrow_moves = std::is_nothrow_move_constructible<K>::value && std::is_nothrow_move_constructible<V>::value;
+        if constexpr (boxed_values) {
+            if(e.second.is_shared()) {
+                return std::pair<K, V>(std::piecewise_construct,
+                    std::forward_as_tuple(key_source<false>(e.first)), std::forward_as_tuple(e.second.get()));
+            }
+        }
+        return std::pair<K, V>(std::piecewise_construct,
+            std::forward_as_tuple(key_source<nothrow_moves>(e.first)), std::forward_as_tuple(std::move_if_noexcept(value_of(e.second))));
+    }
     
 public:
 
     /**
      * Keyed queue iterator.
+     * When the keys mapping is not kept in the ordered layout
+     * the iterator walks through the sorted snapshot of the keys.
      */
     class k_iterator {
     private:
         /** Helper iterator - iterating through keys mapping */
         kvi_map_ic map_iter;
+        /** Sorted keys (used when the mapping is not ordered) */
+        std::shared_ptr<const std::vector<K>> snapshot;
+        /** Position in the sorted keys */
+        size_t snapshot_pos;
+        /** Does the iterator walk through the sorted keys? */
+        bool uses_snapshot;
         /** If the iterator was initialized? */
         bool assigned;
     public:
@@ -441,6 +2324,21 @@ public:
          */
         k_iterator(kvi_map_ic i) {
             map_iter = i;
+            snapshot_pos = 0;
+            uses_snapshot = false;
+            assigned = true;
+        }
+        
+        /**
+         * Create new iterator walking through the sorted keys.
+         * Past-the-end iterator does not need the keys themselves.
+         *
+         * @param[in] keys : sorted keys (may be null)
+         * @param[in] pos  : position in the sorted keys
+         */
+        k_iterator(std::shared_ptr<const std::vector<K>> keys, size_t pos): snapshot(std::move(keys)) {
+            snapshot_pos = pos;
+            uses_snapshot = true;
             assigned = true;
         }
     
@@ -448,97 +2346,659 @@ public:
          * Creates empty iterator.
          * @throws never
          */
-        k_iterator() {
-            assigned = false;
+        k_iterator() {
+            snapshot_pos = 0;
+            uses_snapshot = false;
+            assigned = false;
+        }
+        /**
+         * Copy constructor.
+         */
+        k_iterator(k_iterator const& i) = default;
+        /**
+         * Move to next position.
+         * @throws never
+         */
+        void operator++() {
+            if(!assigned) return;
+            if(uses_snapshot) {
+                ++snapshot_pos;
+            } else {
+                ++map_iter;
+            }
+        }
+        /**
+         * Compare iterators.
+         * @throws never
+         */
+        bool operator==(k_iterator k) {
+            if(!assigned || !k.assigned || uses_snapshot != k.uses_snapshot) return false;
+            if(uses_snapshot) return snapshot_pos == k.snapshot_pos;
+            return map_iter == k.map_iter;
+        }
+        /**
+         * Compare iterators.
+         * @throws never
+         */
+        bool operator!=(k_iterator k) {
+            return !(*this == k);
+        }
+        /**
+         * Dereference iterator.
+         */
+        K operator*() {
+            if(!assigned) throw "k_iterator: Dereferencing unassigned iterator.";
+            if(uses_snapshot) {
+                if(!snapshot || snapshot_pos >= snapshot->size()) throw "k_iterator: Dereferencing past-the-end iterator.";
+                return (*snapshot)[snapshot_pos];
+            }
+            return map_iter->first;
+        }
+    };
+    
+    /**
+     * View of the values stored under one key, in the queue order.
+     * Valid to the next modification of the queue.
+     *
+     * @tparam Mutable : Can the values be modified through the view?
+     */
+    template <bool Mutable>
+    class basic_key_values {
+    private:
+        /** Value reference type returned by the view */
+        using reference = typename std::conditional<Mutable, V&, V const&>::type;
+        /** Positions of the values in the queue */
+        const kvi_list* positions;
+    public:
+    
+        /**
+         * Iterator over values of the key.
+         */
+        class iterator {
+        private:
+            typename kvi_list::const_iterator pos;
+        public:
+            explicit iterator(typename kvi_list::const_iterator i): pos(i) {
+            
+            }
+            iterator& operator++() {
+                ++pos;
+                return *this;
+            }
+            bool operator==(iterator const& i) const {
+                return pos == i.pos;
+            }
+            bool operator!=(iterator const& i) const {
+                return pos != i.pos;
+            }
+            reference operator*() const {
+                if constexpr (Mutable) {
+                    return value_of((*pos)->second);
+                } else {
+                    return value_of(static_cast<stored_value const&>((*pos)->second));
+                }
+            }
+        };
+        
+        /**
+         * Create view of the values at given positions.
+         */
+        explicit basic_key_values(const kvi_list& p): positions(&p) {
+        
+        }
+        
+        /**
+         * Gets the number of values.
+         * @throws never
+         */
+        size_t size() const noexcept {
+            return positions->size();
+        }
+        
+        /**
+         * Get the iterator to the first (oldest) value.
+         */
+        iterator begin() const {
+            return iterator(positions->begin());
+        }
+        
+        /**
+         * Get the past-the-end iterator.
+         */
+        iterator end() const {
+            return iterator(positions->end());
+        }
+    };
+    
+    /** View of modifiable values stored under one key */
+    using key_values = basic_key_values<true>;
+    /** View of read-only values stored under one key */
+    using const_key_values = basic_key_values<false>;
+    
+private:
+    
+    /**
+     * Internal data of keyed_queue.
+     */
+    class queue_data {
+    public:
+        /** Keys mapping: key -> list of iterators pointing to this.fifo */
+        kvi_map keys;
+        /** List of key, value pairs */
+        kv_list fifo;
+
+    public:
+      
+        /**
+         * Copy constructor.
+         * Deleted when values are not copy constructible.
+         */
+        queue_data(std::conditional_t<copyable, queue_data, disabled_argument> const& q): keys(q.keys.current_layout()) {
+            copy_range(q.fifo.begin(), q.fifo.end(), fifo, keys);
+        }
+        
+        queue_data(std::conditional_t<copyable, disabled_argument, queue_data> const&) = delete;
+        
+        /**
+         * Parallel copy constructor.
+         * Boxed values are copied too, so the copy shares nothing with the source
+         * (references handed out by the source never point into the copy).
+         *
+         * @param[in] q      : source data
+         * @param[in] policy : execution policy
+         */
+        queue_data(const queue_data& q, parallel_policy const& policy): keys(q.keys.current_layout()) {
+            build<boxed_values>(q.fifo.begin(), q.fifo.end(), q.fifo.size(), policy, q.keys.size());
+        }
+        
+        /**
+         * Copy constructor that does not share the boxed values with the source.
+         * Used for copying the data whose references were handed out.
+         *
+         * @param[in] q : source data
+         */
+        queue_data(const queue_data& q, deep_copy_t): keys(q.keys.current_layout()) {
+            copy_range<boxed_values>(q.fifo.begin(), q.fifo.end(), fifo, keys);
+        }
+        
+        /**
+         * Create empty data set.
+         */
+        queue_data(): keys(), fifo() {
+        
+        }
+        
+        /**
+         * Bulk constructor.
+         * Builds the queue from the range of (key, value) pairs.
+         * Single pass (input) ranges are always built in one pass on the calling thread.
+         *
+         * @param[in] first  : first (key, value) pair of the input
+         * @param[in] last   : past-the-end iterator of the input
+         * @param[in] policy : execution policy
+         */
+        template <class InputIt>
+        queue_data(InputIt first, InputIt last, parallel_policy const& policy): keys(), fifo() {
+            using category = typename std::iterator_traits<InputIt>::iterator_category;
+            if constexpr (std::is_base_of<std::forward_iterator_tag, category>::value) {
+                const auto size = static_cast<std::size_t>(std::distance(first, last));
+                build(first, last, size, policy);
+            } else {
+                copy_range(first, last, fifo, keys);
+            }
+        }
+        
+        /**
+         * Move contructor.
+         */
+        queue_data(queue_data&& q): keys(std::move(q.keys)),
+                                    fifo(std::move(q.fifo)) {
+        }
+        
+        /**
+         * Move assignment.
+         */
+        queue_data& operator=(queue_data&& q) = default;
+        
+        /**
+         * Take over the data of the queue with other ownership policy.
+         * Other policies of both queues must be the same.
+         *
+         * @param[in] q : data of the other queue (left empty)
+         */
+        template <class Other, class = typename std::enable_if<!std::is_same<typename std::decay<Other>::type, queue_data>::value>::type>
+        explicit queue_data(Other&& q): keys(std::move(q.keys)),
+                                        fifo(std::move(q.fifo)) {
+            q.keys.clear();
+            q.fifo.clear();
+        }
+        
+    private:
+    
+        /**
+         * Append copies of the (key, value) pairs from the given range
+         * to the list and its keys mapping.
+         *
+         * @tparam Deep          : Should the boxed values be copied instead of shared?
+         * @param[in] begin     : first element to copy
+         * @param[in] end       : past-the-end element to copy
+         * @param[in] dest      : target list
+         * @param[in] dest_keys : keys mapping of the target list
+         */
+        template <bool Deep = false, class It>
+        static void copy_range(It begin, It end, kv_list& dest, kvi_map& dest_keys) {
+            copy_range<Deep>(begin, end, dest, [&dest_keys](kv_list_i el_i) {
+                // Ensure there is at least empty list for the new key
+                const auto l = dest_keys.try_emplace(el_i->first);
+                // Insert iterator to the keys mapping
+                (l.first)->push_back(el_i);
+            });
+        }
+        
+        /**
+         * Append copies of the (key, value) pairs from the given range
+         * to the list, calling copied(iterator) for every appended element.
+         *
+         * @tparam Deep        : Should the boxed values be copied instead of shared?
+         * @param[in] begin  : first element to copy
+         * @param[in] end    : past-the-end element to copy
+         * @param[in] dest   : target list
+         * @param[in] copied : function taking the iterator to the appended element
+         */
+        template <bool Deep = false, class It, class F>
+        static void copy_range(It begin, It end, kv_list& dest, F const& copied) {
+            // For all elements in the copied range
+            for(auto i=begin; i!=end; ++i) {
+                // Push data to queue
+                if constexpr (Deep) {
+                    dest.emplace_back(i->first, stored_value(i->second, deep_copy_t()));
+                } else {
+                    dest.emplace_back(*i);
+                }
+                copied(std::prev(dest.end()));
+            }
         }
+        
+        /** Position of a copied element with the hash of its key */
+        using hashed_position = std::pair<std::size_t, kv_list_i>;
+        
         /**
-         * Copy constructor.
+         * Get the hash of the key used to group the elements in the bulk build.
+         * Hashes are mixed, so keys with regular hashes spread over all the groups.
+         * Keys that cannot be hashed all get the same hash.
+         *
+         * @param[in] k : key
          */
-        k_iterator(k_iterator const& i) {
-            assigned = i.assigned;
-            map_iter = i.map_iter;
+        static std::size_t key_hash(K const& k) {
+            if constexpr (keyed_queue_hashable<K>::value) {
+                return static_cast<std::size_t>(static_cast<std::uint64_t>(std::hash<K>{}(k)) * 0x9E3779B97F4A7C15ULL);
+            } else {
+                return 0;
+            }
         }
+        
         /**
-         * Move to next position.
+         * Get the group of the key hash in the bulk build.
+         *
+         * @param[in] h      : mixed hash of the key
+         * @param[in] groups : number of groups
          * @throws never
          */
-        void operator++() {
-            if(assigned) ++map_iter;
+        static unsigned group_of(std::size_t h, unsigned groups) noexcept {
+            return static_cast<unsigned>((static_cast<std::uint64_t>(h) >> 32) % groups);
         }
+        
         /**
-         * Compare iterators.
-         * @throws never
+         * Estimate the number of different keys in the range.
+         * Linear counting: the key hashes mark the bits of a bitmap and the share of the bits
+         * left empty tells how many different hashes there are. A small bitmap on the stack
+         * is tried first (enough for a few thousand keys), a bitmap twice as large as the range
+         * is allocated only when the small one fills up.
+         *
+         * @param[in] begin   : first element
+         * @param[in] end     : past-the-end element
+         * @param[in] size    : number of elements in the range
+         * @param[in] hash_of : function giving the mixed hash of the element's key
+         * @returns estimated number of keys (0 when keys cannot be hashed)
          */
-        bool operator==(k_iterator k) {
-            if(!assigned || !k.assigned) return false;
-            return map_iter == k.map_iter;
+        template <class It, class F>
+        static std::size_t count_keys(It begin, It end, std::size_t size, F const& hash_of) {
+            if(!keyed_queue_hashable<K>::value || size == 0) {
+                return 0;
+            }
+            // Mark the hashes in the bitmap of 2^bits bits, returns the estimate or 0 when the bitmap is too full
+            const auto estimate = [&](unsigned bits, std::uint64_t* bitmap) -> std::size_t {
+                const std::size_t bitmap_size = std::size_t(1) << bits;
+                for(auto i = begin; i != end; ++i) {
+                    const auto bit = static_cast<std::size_t>(static_cast<std::uint64_t>(hash_of(*i)) >> (64 - bits));
+                    bitmap[bit / 64] |= std::uint64_t(1) << (bit % 64);
+                }
+                std::size_t empty = bitmap_size;
+                for(std::size_t w = 0; w < bitmap_size / 64; ++w) {
+                    empty -= static_cast<std::size_t>(__builtin_popcountll(bitmap[w]));
+                }
+                if(empty * 4 < bitmap_size) {
+                    return 0;
+                }
+                const double keys = static_cast<double>(bitmap_size) * std::log(static_cast<double>(bitmap_size) / static_cast<double>(empty));
+                return std::max<std::size_t>(1, static_cast<std::size_t>(keys + 0.5));
+            };
+            std::uint64_t small_bitmap[64] = {};
+            std::size_t keys = estimate(12, small_bitmap);
+            if(keys == 0) {
+                // At most half of the bits of the large bitmap get marked
+                unsigned bits = 12;
+                while((std::size_t(1) << bits) < 2 * size) {
+                    ++bits;
+                }
+                std::vector<std::uint64_t> bitmap((std::size_t(1) << bits) / 64, 0);
+                keys = estimate(bits, bitmap.data());
+            }
+            return std::min(size, keys);
         }
+        
         /**
-         * Compare iterators.
-         * @throws never
+         * Index the elements of one key group in the queue order.
+         * The keys of the group are counted first and the index is reserved for them,
+         * so it does not rehash (or change the layout) while the elements are added.
+         *
+         * @param[in] group : positions of the group's elements in the queue order (left empty)
+         * @param[in] index : index of the group's keys
          */
-        bool operator!=(k_iterator k) {
-            if(!assigned || !k.assigned) return true;
-            return map_iter != k.map_iter;
+        static void index_group(std::vector<hashed_position>& group, kvi_map& index) {
+            index.reserve(count_keys(group.begin(), group.end(), group.size(), [](hashed_position const& p) {
+                return p.first;
+            }));
+            for(auto const& p : group) {
+                index.try_emplace(p.second->first).first->push_back(p.second);
+            }
+            std::vector<hashed_position>().swap(group);
         }
+        
         /**
-         * Dereference iterator.
+         * Fill empty data with copies of the (key, value) pairs from the given range.
+         *
+         * With one worker the keys are counted first (unless the number is known, as for a copy
+         * of a queue), the index is reserved for them and elements are indexed as they are copied.
+         * Otherwise the range is split into contiguous parts copied by separate threads.
+         * While copying, every thread sorts the positions of its elements into key groups
+         * by the key hash. The parts are spliced together and every key group is counted and
+         * indexed by its own thread (see index_group), so each key is indexed by one thread only.
+         * Groups hold different keys, so their indexes are merged by moving the nodes,
+         * without copying any position. Keys that cannot be hashed form one group.
+         *
+         * @tparam Deep           : Should the boxed values be copied instead of shared?
+         * @param[in] begin     : first element to copy
+         * @param[in] end       : past-the-end element to copy
+         * @param[in] size      : number of elements in the range
+         * @param[in] policy    : execution policy
+         * @param[in] key_count : number of keys (0 if unknown)
          */
-        K operator*() {
-            if(!assigned) throw "k_iterator: Dereferencing unassigned iterator.";
-            return map_iter->first;
+        template <bool Deep = false, class It>
+        void build(It begin, It end, std::size_t size, parallel_policy const& policy, std::size_t key_count = 0) {
+            const unsigned workers = policy.workers(size);
+            if(workers <= 1) {
+                if(key_count == 0) {
+                    key_count = count_keys(begin, end, size, [](auto const& e) {
+                        return key_hash(e.first);
+                    });
+                }
+                keys.reserve(key_count);
+                copy_range<Deep>(begin, end, fifo, keys);
+                return;
+            }
+            const unsigned groups = keyed_queue_hashable<K>::value ? workers : 1;
+            
+            std::vector<kv_list> parts(workers);
+            // Positions of the elements copied by worker w with keys of group g: positions[w * groups + g]
+            std::vector<std::vector<hashed_position>> positions(workers * groups);
+            parallel_policy::split(workers, begin, end, size, [&](unsigned w, It part_begin, It part_end) {
+                for(unsigned g = 0; g < groups; ++g) {
+                    positions[w * groups + g].reserve(size / workers / groups + 1);
+                }
+                copy_range<Deep>(part_begin, part_end, parts[w], [&](kv_list_i el) {
+                    const std::size_t h = key_hash(el->first);
+                    positions[w * groups + group_of(h, groups)].push_back({ h, el });
+                });
+            });
+            
+            // Join the parts (splicing keeps all the iterators valid)
+            for(unsigned w = 0; w < workers; ++w) {
+                fifo.splice(fifo.end(), parts[w]);
+            }
+            
+            std::vector<kvi_map> group_keys;
+            group_keys.reserve(groups);
+            for(unsigned g = 0; g < groups; ++g) {
+                group_keys.emplace_back(keys.current_layout());
+            }
+            parallel_policy::run(groups, [&](unsigned g) {
+                // Positions of the group in the queue order
+                std::vector<hashed_position> group;
+                std::size_t count = 0;
+                for(unsigned w = 0; w < workers; ++w) {
+                    count += positions[w * groups + g].size();
+                }
+                group.reserve(count);
+                for(unsigned w = 0; w < workers; ++w) {
+                    auto& part = positions[w * groups + g];
+                    group.insert(group.end(), part.begin(), part.end());
+                    std::vector<hashed_position>().swap(part);
+                }
+                index_group(group, group_keys[g]);
+            });
+            
+            std::size_t total = 0;
+            for(auto const& index : group_keys) {
+                total += index.size();
+            }
+            keys.reserve(total);
+            for(auto& index : group_keys) {
+                keys.merge(index);
+            }
         }
     };
     
-private:
+    /** Data wrapper (copy-on-write unless the queue owns its data) */
+    typename config::ownership::template holder<queue_data, typename config::refcount> sd;
     
     /**
-     * Internal data of keyed_queue.
+     * Creates keyed queue holding the given data.
      */
-    class queue_data {
-    public:
-        /** Keys mapping: key -> list of iterators pointing to this.fifo */
-        kvi_map keys;
-        /** List of key, value pairs */
-        kv_list fifo;
-
-    public:
-      
-        /**
-         * Copy constructor.
-         */
-        queue_data(const queue_data& q) {
-            //TODO: Validate
-            // For all elements in the copied queue
-            for(auto i=q.fifo.begin(); i!=q.fifo.end(); ++i) {
-                // Push data to queue
-                fifo.push_back(*i);
-                // Get the iterator to the pushed element
-                auto el_i = fifo.end();
-                --el_i;
-                // Ensure there is at least empty list for the new key
-                const auto l = keys.insert({ i->first, {} });
-                // Insert iterator to the keys mapping
-                (l.first)->second.push_back(el_i);
+    explicit keyed_queue(queue_data&& data): sd(std::move(data)) {
+    
+    }
+    
+    /**
+     * Move the elements into a queue with other ownership policy.
+     * Shared data is copied first, otherwise it's moved in O(1).
+     *
+     * @returns queue holding the elements
+     */
+    template <class Target>
+    Target move_into() {
+        auto writer = sd.write();
+        Target result(typename Target::queue_data(std::move(*writer)));
+        writer.commit();
+        pending_scans = 0;
+        return result;
+    }
+    
+    /**
+     * Call fn(key, value) for all elements of the data in parallel.
+     * Each thread handles a contiguous range of the queue.
+     */
+    template <class Data, class F>
+    static void for_each_in(Data& data, parallel_policy const& policy, F& fn) {
+        const unsigned workers = policy.workers(data.fifo.size());
+        if(workers <= 1) {
+            for(auto& e : data.fifo) {
+                fn(static_cast<K const&>(e.first), value_of(e.second));
             }
+            return;
         }
-        /**
-         * Create empty data set.
-         */
-        queue_data(): keys(), fifo() {
+        parallel_policy::split(workers, data.fifo.begin(), data.fifo.end(), data.fifo.size(), [&fn](unsigned, auto begin, auto end) {
+            for(auto i = begin; i != end; ++i) {
+                fn(static_cast<K const&>(i->first), value_of(i->second));
+            }
+        });
+    }
+    
+    /**
+     * Call fn(key, values) for all keys of the data in parallel.
+     * Keys are split into contiguous ranges holding similar numbers of elements.
+     */
+    template <class View, class F>
+    static void for_each_group_in(queue_data const& data, parallel_policy const& policy, F& fn) {
+        // Collect the key groups (kvi_map cannot be split directly)
+        std::vector<std::pair<K const*, kvi_list const*>> groups;
+        groups.reserve(data.keys.size());
+        data.keys.visit([&groups](K const& k, kvi_list const& positions) {
+            groups.push_back({ &k, &positions });
+        });
         
+        const unsigned workers = static_cast<unsigned>(std::min<std::size_t>(policy.workers(data.fifo.size()), std::max<std::size_t>(1, groups.size())));
+        // Cut the groups so every worker gets about the same number of elements
+        std::vector<std::size_t> bounds(1, 0);
+        const std::size_t share = data.fifo.size() / workers + 1;
+        std::size_t taken = 0;
+        for(std::size_t g = 0; g < groups.size() && bounds.size() < workers; ++g) {
+            taken += groups[g].second->size();
+            if(taken >= share * bounds.size()) {
+                bounds.push_back(g + 1);
+            }
+        }
+        while(bounds.size() <= workers) {
+            bounds.push_back(groups.size());
         }
         
+        parallel_policy::run(workers, [&](unsigned w) {
+            for(std::size_t g = bounds[w]; g < bounds[w + 1]; ++g) {
+                fn(*groups[g].first, View(*groups[g].second));
+            }
+        });
+    }
+    
+    
+    /** Number of sorted key scans not yet reported to the keys mapping */
+    size_t pending_scans = 0;
+    
+    /**
+     * Readiness notifiers of the queue.
+     * They belong to the queue object: copies of the queue start without notifiers.
+     */
+    struct notifiers {
+        /** Signalled when the queue goes from empty to non-empty */
+        std::shared_ptr<readiness_notifier> any;
+        /** Signalled when the key gets its first element */
+        std::map<K, std::shared_ptr<readiness_notifier>> keys;
+        
+        notifiers() = default;
+        notifiers(notifiers const&) noexcept {}
+        notifiers(notifiers&&) = default;
+        
         /**
-         * Move contructor.
+         * Signal the notifiers after the push.
+         *
+         * @param[in] k         : pushed key
+         * @param[in] first     : was the queue empty before the push?
+         * @param[in] first_key : was the key absent before the push?
+         * @throws never
          */
-        queue_data(queue_data&& q): keys(std::move(q.keys)),
-                                    fifo(std::move(q.fifo)) {
+        void pushed(K const& k, bool first, bool first_key) const noexcept {
+            if(first && any) {
+                any->notify();
+            }
+            if(first_key && !keys.empty()) {
+                const auto i = keys.find(k);
+                if(i != keys.end()) {
+                    i->second->notify();
+                }
+            }
         }
     };
     
-    /** Copy-on-write data wrapper */
-    cow_data<queue_data> sd;
+    /** Readiness notifiers */
+    notifiers watchers;
+    
+    /**
+     * Report the operation to the keys mapping, so it can adapt its layout.
+     * Must be called after all the slots of the mapping are no longer used.
+     *
+     * @param[in] data  : data modified by the operation
+     * @param[in] keyed : was the operation done on explicitly given key?
+     * @throws never
+     */
+    void record_operation(queue_data& data, bool keyed) noexcept {
+        data.keys.record(keyed, pending_scans, data.fifo.size());
+        pending_scans = 0;
+    }
+    
+    /**
+     * Push new key, value pair to the front of the queue.
+     * The keys mapping is prepared before the value is used,
+     * so a failed push leaves rvalue arguments untouched unless constructing the element fails.
+     *
+     * @param[in] k : key
+     * @param[in] v : value (copied or moved)
+     */
+    template <class Value>
+    void push_value(K const &k, Value&& v) {
+        auto writer = sd.write();
+        
+        // Make sure the keys mapping contains at least empty list for the new key
+        const auto l = writer->keys.try_emplace(k);
+        
+        if constexpr (in_place) {
+            auto& fifo = writer->fifo;
+            const auto size_before = fifo.size();
+            
+            try {
+                fifo.emplace_back(k, std::forward<Value>(v));
+                (l.first)->push_back(std::prev(fifo.end()));
+            } catch(...) {
+                // Roll back whatever was inserted so the mapping matches the queue
+                if(fifo.size() != size_before) {
+                    fifo.pop_back();
+                }
+                if(l.second) {
+                    writer->keys.erase(l.first);
+                }
+                throw;
+            }
+            
+            const bool first_key = (l.first)->size() == 1;
+            record_operation(*writer, false);
+            writer.commit();
+            watchers.pushed(k, size_before == 0, first_key);
+            return;
+        }
+        
+        // Buffer to store moved element
+        kv_list fifo_delta;
+        
+        try {
+            fifo_delta.emplace_back(k, std::forward<Value>(v));
+            // Insert the iterator to the buffered element in the mapping
+            // (splicing keeps it valid)
+            (l.first)->push_back(fifo_delta.begin());
+        } catch(...) {
+            // Do not leave empty list for the new key in the mapping
+            if(l.second) {
+                writer->keys.erase(l.first);
+            }
+            throw;
+        }
+        
+        // Import buffer to the actual queue
+        writer->fifo.splice(writer->fifo.end(), fifo_delta);
+        
+        const bool first = writer->fifo.size() == 1;
+        const bool first_key = (l.first)->size() == 1;
+        record_operation(*writer, false);
+        writer.commit();
+        watchers.pushed(k, first, first_key);
+    }
     
 public:
 
@@ -550,27 +3010,168 @@ public:
      }
     
     /**
-     * Creates keyed queue from another one.
+     * Creates keyed queue from the range of (key, value) pairs, preserving their order.
+     * Faster than pushing the pairs one by one: the queue is built without per-element
+     * copy-on-write bookkeeping, and for multi-pass ranges the keys are counted before
+     * the index is built, so it never rehashes. Large multi-pass ranges are copied and grouped
+     * by key hash on separate threads according to the policy (all hardware threads by default).
+     *
+     * @param[in] first  : first (key, value) pair
+     * @param[in] last   : past-the-end iterator
+     * @param[in] policy : execution policy
      */
-    keyed_queue(keyed_queue const& q): sd(q.sd) {
-        
+    template <class InputIt>
+    keyed_queue(InputIt first, InputIt last, parallel_policy const& policy = parallel_policy()):
+        sd(queue_data(first, last, policy)) {
+    
     }
     
     /**
      * Creates keyed queue from another one.
+     * Deleted when values are not copy constructible.
      */
-    keyed_queue(keyed_queue&& q): sd(std::move(q.sd)) {
-        
-    }
+    keyed_queue(keyed_queue const& q) = default;
+    
+    /**
+     * Creates keyed queue from another one.
+     * Queue of move-only values is left empty.
+     */
+    keyed_queue(keyed_queue&& q) = default;
     
     /**
      * Copies keyed queue from another one.
      */
     keyed_queue &operator=(keyed_queue other) {
-        sd = other.sd;
+        sd = std::move(other.sd);
         return *this;
     }
     
+    /**
+     * Set the reclaimer destroying the data dropped by the queue.
+     * With a reclaimer clear() and releasing the last reference to the data
+     * (destruction or assignment of the last queue sharing it) take O(1) time
+     * and the elements are destroyed on the reclaimer thread.
+     * Copies of the queue use the same reclaimer.
+     *
+     * @param[in] r : reclaimer (null to destroy the data on the calling thread)
+     * @throws never
+     */
+    void set_reclaimer(std::shared_ptr<background_reclaimer> r) noexcept {
+        sd.set_reclaimer(std::move(r));
+    }
+    
+    /**
+     * Set the notifier signalled by push() when the queue goes from empty to non-empty.
+     * Bursts of pushes signal it once; the consumer should take all the elements it's woken for
+     * (or signal the notifier itself) before it waits again.
+     * Copies of the queue do not use the notifier.
+     *
+     * @param[in] n : notifier (null to stop notifying)
+     * @throws never
+     */
+    void set_notifier(std::shared_ptr<readiness_notifier> n) noexcept {
+        watchers.any = std::move(n);
+    }
+    
+    /**
+     * Set the notifier signalled by push() when the key gets its first element.
+     * Copies of the queue do not use the notifier.
+     *
+     * @param[in] k : watched key
+     * @param[in] n : notifier (null to stop watching the key)
+     */
+    void watch(K const& k, std::shared_ptr<readiness_notifier> n) {
+        if(n) {
+            watchers.keys[k] = std::move(n);
+        } else {
+            watchers.keys.erase(k);
+        }
+    }
+    
+    /** Copy-on-write queue with the same policies */
+    using shared_queue = typename ownership_free::template with<>;
+    /** Uniquely owned queue with the same policies */
+    using unique_queue = typename ownership_free::template with<unique_ownership>;
+    
+    /**
+     * Turns the queue into a copy-on-write queue, so it can be shared cheaply.
+     * The elements are moved in O(1) (copied when the data is already shared with other queues).
+     * The queue is left empty.
+     *
+     * @returns copy-on-write queue holding the elements
+     */
+    shared_queue share() && {
+        return move_into<shared_queue>();
+    }
+    
+    /**
+     * Turns the queue into a uniquely owned queue, so mutations skip the copy-on-write bookkeeping.
+     * The elements are moved in O(1) (copied when the data is shared with other queues).
+     * The queue is left empty.
+     *
+     * @returns uniquely owned queue holding the elements
+     */
+    unique_queue unshare() && {
+        return move_into<unique_queue>();
+    }
+    
+    /**
+     * Creates a copy-on-write snapshot of the queue.
+     * Takes O(1) time for a copy-on-write queue, uniquely owned data is copied
+     * (with its boxed values, as references to them may have been handed out).
+     *
+     * @returns copy-on-write queue holding copies of the elements
+     */
+    shared_queue snapshot() const {
+        if constexpr (std::is_same<shared_queue, keyed_queue>::value) {
+            return *this;
+        } else {
+            auto reader = sd.read();
+            return shared_queue(typename shared_queue::queue_data(queue_data(*reader, deep_copy_t())));
+        }
+    }
+    
+    /**
+     * Creates immutable read-optimised copy of the queue (see frozen_keyed_queue).
+     *
+     * @returns frozen queue
+     */
+    frozen_keyed_queue<K, V> freeze() const {
+        auto reader = sd.read();
+        return frozen_keyed_queue<K, V>::build(reader->keys.sorted_keys(), reader->fifo.begin(), reader->fifo.end(), reader->fifo.size(),
+            [](stored_value const& v) -> V const& {
+                return value_of(v);
+            });
+    }
+    
+    /**
+     * Creates a deep copy of the queue that does not share data with any other queue.
+     * Elements are copied and grouped by keys in parallel.
+     *
+     * @param[in] policy : execution policy
+     * @returns copy of the queue
+     */
+    keyed_queue clone(parallel_policy const& policy) const {
+        static_assert(copyable, "clone(): Queues of move-only values cannot be copied.");
+        auto reader = sd.read();
+        return keyed_queue(queue_data(*reader, policy));
+    }
+    
+    /**
+     * Stops sharing data with other queues.
+     * If the data is shared it's copied in parallel right away,
+     * so the next mutation does not have to copy it.
+     *
+     * @param[in] policy : execution policy
+     */
+    void detach(parallel_policy const& policy) {
+        static_assert(copyable, "detach(): Queues of move-only values are never shared.");
+        auto writer = sd.write([&policy](queue_data const& data) {
+            return queue_data(data, policy);
+        });
+        writer.commit();
+    }
+    
    
     /**
      * Push new key, value pair to the front of the queue.
@@ -579,26 +3180,85 @@ public:
      * @param[in] v : value
      */
     void push(K const &k, V const &v) {
+        push_value(k, v);
+    }
+    
+    /**
+     * Push new key, value pair to the front of the queue moving the value into it.
+     * Value is left untouched when the push fails before the value is moved.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const &k, value_rvalue &&v) {
+        push_value(k, std::move(v));
+    }
+
+    /**
+     * Pop the first element from the queue and return it.
+     * The element is moved out of the queue (copied if moving it may throw and it's copyable);
+     * if taking it out throws, the queue is left untouched.
+     *
+     * @returns the first key, value pair
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> extract() {
         auto writer = sd.write();
         
-        // Buffers to store moved elements
-        kv_list fifo_delta;
-        kvi_list keys_delta;
-        fifo_delta.push_back({k, v});
+        if(writer->fifo.empty()) {
+            throw lookup_error("extract(): Queue is empty.");
+        }
         
-        // Make sure the keys mapping contains at least empty list for the new key
-        const auto l = writer->keys.insert({ k, {} });
-        // Obtain the iterator to the inserted element
-        auto delta_i = fifo_delta.end();
-        --delta_i;
+        const auto iter = writer->fifo.begin();
+        const auto i = writer->keys.find(iter->first);
+        assert(i);
+        assert(!i->empty());
+        assert(i->front() == iter);
         
-        keys_delta.push_back(delta_i);
-        // Import buffer to the actual queue
-        writer->fifo.splice(writer->fifo.end(), fifo_delta);
-        // Insert the iterator in the mapping
-        (l.first)->second.splice((l.first)->second.end(), keys_delta);
+        std::pair<K, V> result(take_element(*iter));
+        
+        // Nothing below can throw
+        i->pop_front();
+        writer->fifo.pop_front();
+        if(i->empty()) {
+            writer->keys.erase(i);
+        }
+        
+        record_operation(*writer, false);
+        writer.commit();
+        return result;
+    }
+    
+    /**
+     * Pop the first element from the queue with matching key and return it.
+     * The element is moved out of the queue (copied if moving it may throw and it's copyable);
+     * if taking it out throws, the queue is left untouched.
+     *
+     * @param[in] k : key
+     * @returns the first key, value pair with matching key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> extract(K const &k) {
+        auto writer = sd.write();
         
+        const auto i = writer->keys.find(k);
+        if(!i || i->empty()) {
+            throw lookup_error("extract(K): Key not present in the queue.");
+        }
+        
+        const auto e = i->front();
+        std::pair<K, V> result(take_element(*e));
+        
+        // Nothing below can throw
+        i->pop_front();
+        writer->fifo.erase(e);
+        if(i->empty()) {
+            writer->keys.erase(i);
+        }
+        
+        record_operation(*writer, true);
         writer.commit();
+        return result;
     }
 
     /**
@@ -613,39 +3273,52 @@ public:
         // Try to find key in the mapping
         const auto iter = writer->keys.find(k);
         
-        if(iter == writer->keys.end()) {
+        if(!iter) {
             throw lookup_error("pop(K): Key not present in the queue.");
         }
         
-        if(iter->second.empty()) {
+        if(iter->empty()) {
             throw lookup_error("pop(K): Key not present in the queue.");
         }
         
-        // Buffers to store moved elements
+        if constexpr (in_place) {
+            auto& list = *iter;
+            writer->fifo.erase(list.front());
+            list.pop_front();
+            
+            if(list.empty()) {
+                writer->keys.erase(iter);
+            }
+            
+            record_operation(*writer, true);
+            writer.commit();
+            return;
+        }
+        
+        // Buffer to store moved element
         kv_list fifo_delta;
-        kvi_list keys_delta;
         
         // Check if there's any iterator for the given key
-        if((iter->second).empty()) {
+        if(iter->empty()) {
             throw lookup_error("pop(K): Key not present in the queue.");
         }
         
         // Get the first element of the iterator list
-        const auto e = (iter->second).front();
+        const auto e = iter->front();
         // Move out element from the queue
         fifo_delta.splice(fifo_delta.begin(),  writer->fifo, e);
-        // Move out the element iterator from the mapping
-        keys_delta.splice(keys_delta.begin(), iter->second, (iter->second).begin());
+        // Remove the element iterator from the mapping
+        iter->pop_front();
         
-        // Remove the elements
+        // Remove the element
         fifo_delta.clear();
-        keys_delta.clear();
         
         // Erase the keys mapping list if it's empty
-        if((iter->second).size() <= 0) {
+        if(iter->size() <= 0) {
             writer->keys.erase(iter);
         }
         
+        record_operation(*writer, true);
         writer.commit();
     }
 
@@ -661,10 +3334,6 @@ public:
             throw lookup_error("pop(): Queue is empty.");
         }
         
-        // Buffers to store moved elements
-        kv_list fifo_delta;
-        kvi_list keys_delta;
-        
         // Get the iterator to the first queue element
         const auto iter = writer->fifo.begin();
         // Get the key of that element
@@ -674,35 +3343,51 @@ public:
         const auto i = writer->keys.find(key);
         
         // The key must be present in the mapping
-        assert(i != writer->keys.end());
-        assert(!(i->second).empty());
+        assert(i);
+        assert(!i->empty());
         
         // Obtain the list of iterators with matching key
-        auto& list = i->second;
+        auto& list = *i;
         
         // Iterator list must contain at least one key (the one we will remove)
         assert(!list.empty());
         
-        // If the first element of the list in the mapping
-        // is not equal to the iterator of the first element of the queue
-        // then something really bad happened and entire data is broken!
-        assert(list.front() == iter);
+        // If the first element of the list in the mapping
+        // is not equal to the iterator of the first element of the queue
+        // then something really bad happened and entire data is broken!
+        assert(list.front() == iter);
+        
+        if constexpr (in_place) {
+            list.pop_front();
+            writer->fifo.pop_front();
+            
+            if(list.empty()) {
+                writer->keys.erase(i);
+            }
+            
+            record_operation(*writer, false);
+            writer.commit();
+            return;
+        }
+        
+        // Buffer to store moved element
+        kv_list fifo_delta;
         
         // Pop the element from the mapping
-        keys_delta.splice(keys_delta.begin(), list, list.begin());
+        list.pop_front();
         
         // Pop the element from the queue
         fifo_delta.splice(fifo_delta.begin(), writer->fifo, writer->fifo.begin());
         
-        // Remove the elements
+        // Remove the element
         fifo_delta.clear();
-        keys_delta.clear();
         
         // Remove list from mapping if it's empty
         if(list.size() <= 0) {
             writer->keys.erase(i);
         }
         
+        record_operation(*writer, false);
         writer.commit();
     }
 
@@ -717,12 +3402,12 @@ public:
         auto writer = sd.write();
         
         const auto i = writer->keys.find(k);
-        if(i == writer->keys.end()) {
+        if(!i) {
             throw lookup_error("move_to_back(K): There's no such key in the queue.");
         }
         
         // Find the list of iterators with matching keys
-        auto& list = i->second;
+        auto& list = *i;
         if(list.empty()) {
             throw lookup_error("move_to_back(K): There's no such key in the queue.");
         }
@@ -733,6 +3418,7 @@ public:
             writer->fifo.splice( writer->fifo.end(), writer->fifo, *e );
         }
         
+        record_operation(*writer, true);
         writer.commit();
     }
 
@@ -748,7 +3434,7 @@ public:
         }
         
         auto& ref = reader->fifo.front();
-        return {std::get<0>(ref), std::get<1>(ref)};
+        return { ref.first, value_of(ref.second) };
     }
 
     /**
@@ -763,7 +3449,7 @@ public:
         }
         
         auto& ref = reader->fifo.back();
-        return { std::get<0>(ref), std::get<1>(ref) };
+        return { ref.first, value_of(ref.second) };
     }
 
     /**
@@ -772,13 +3458,13 @@ public:
      * @throws lookup_error when the queue is empty
      */
     std::pair<K const &, V const &> front() const {
-        auto reader = sd.readPersistent();
+        auto reader = sd.read();
         if(reader->fifo.empty()) {
             throw lookup_error("front(): Queue is empty.");
         }
         
         auto& ref = reader->fifo.front();
-        return { std::get<0>(ref), std::get<1>(ref) };
+        return { ref.first, value_of(ref.second) };
     }
 
     /**
@@ -787,13 +3473,13 @@ public:
      * @throws lookup_error when the queue is empty
      */
     std::pair<K const &, V const &> back() const {
-        auto reader = sd.readPersistent();
+        auto reader = sd.read();
         if(reader->fifo.empty()) {
             throw lookup_error("back(): Queue is empty.");
         }
         
         auto& ref = reader->fifo.back();
-        return { std::get<0>(ref), std::get<1>(ref) };
+        return { ref.first, value_of(ref.second) };
     }
 
    /**
@@ -805,14 +3491,14 @@ public:
     std::pair<K const &, V &> first(K const &key) {
         auto reader = sd.writePersistent();
         const auto keyloc = reader->keys.find(key);
-        if(keyloc == reader->keys.end()) {
+        if(!keyloc) {
             throw lookup_error("first(K): Key not present in the queue.");
         }
-        if(keyloc->second.empty()) {
+        if(keyloc->empty()) {
             throw lookup_error("first(K): Key not present in the queue.");
         }
         
-        return { key, (keyloc->second.front())->second };
+        return { key, value_of((keyloc->front())->second) };
     }
 
     /**
@@ -824,14 +3510,14 @@ public:
     std::pair<K const &, V &> last(K const &key) {
         auto reader = sd.writePersistent();
         const auto keyloc = reader->keys.find(key);
-        if(keyloc == reader->keys.end()) {
+        if(!keyloc) {
             throw lookup_error("last(K): Key not present in the queue.");
         }
-        if(keyloc->second.empty()) {
+        if(keyloc->empty()) {
             throw lookup_error("last(K): Key not present in the queue.");
         }
         
-        return { key, (keyloc->second.back())->second };
+        return { key, value_of((keyloc->back())->second) };
     }
 
     /**
@@ -841,16 +3527,16 @@ public:
      * @throws lookup_error when the queue does not contain element with given key
      */
     std::pair<K const &, V const &> first(K const &key) const {
-        auto reader = sd.readPersistent();
+        auto reader = sd.read();
         const auto keyloc = reader->keys.find(key);
-        if(keyloc == reader->keys.end()) {
+        if(!keyloc) {
             throw lookup_error("first(K): Key not present in the queue.");
         }
-        if(keyloc->second.empty()) {
+        if(keyloc->empty()) {
             throw lookup_error("first(K): Key not present in the queue.");
         }
         
-        return { key, (keyloc->second.front())->second };
+        return { key, value_of(static_cast<stored_value const&>((keyloc->front())->second)) };
     }
 
     /**
@@ -860,16 +3546,16 @@ public:
      * @throws lookup_error when the queue does not contain element with given key
      */
     std::pair<K const &, V const &> last(K const &key) const {
-        auto reader = sd.readPersistent();
+        auto reader = sd.read();
         const auto keyloc = reader->keys.find(key);
-        if(keyloc == reader->keys.end()) {
+        if(!keyloc) {
             throw lookup_error("last(K): Key not present in the queue.");
         }
-        if(keyloc->second.empty()) {
+        if(keyloc->empty()) {
             throw lookup_error("last(K): Key not present in the queue.");
         }
         
-        return { key, (keyloc->second.back())->second };
+        return { key, value_of(static_cast<stored_value const&>((keyloc->back())->second)) };
     }
 
     /**
@@ -899,11 +3585,25 @@ public:
      * Clears the queue contents.
      */
     void clear() {
+        if(sd.has_reclaimer() || sd.read().is_shared()) {
+            // Drop the whole data instead of copying or destroying it here
+            sd.reset();
+            pending_scans = 0;
+            return;
+        }
+        
         auto writer = sd.write();
         
-        // Buffers to store the moved data
+        if constexpr (in_place) {
+            writer->keys.clear();
+            writer->fifo.clear();
+            
+            writer.commit();
+            return;
+        }
+        
+        // Buffer to store the moved data
         kv_list fifo_delta;
-        kvi_list keys_delta;
         
         // Empty keymap to be swapped
         kvi_map empty_keys;
@@ -929,12 +3629,74 @@ public:
     size_t count(K const &k) const {
         auto reader = sd.read();
         const auto i = reader->keys.find(k);
-        if(i != reader->keys.end()) {
-            return i->second.size();
+        if(i) {
+            return i->size();
         }
         return 0;
     }
 
+    /**
+     * Call fn(key, value) for all elements of the queue.
+     * Elements are split into contiguous ranges handled by separate threads,
+     * so fn must be safe to call concurrently for different elements.
+     * Values can be modified; shared data is detached first.
+     *
+     * @param[in] policy : execution policy
+     * @param[in] fn     : function taking (K const&, V&)
+     */
+    template <class F>
+    void for_each(parallel_policy const& policy, F fn) {
+        auto writer = sd.writePersistent();
+        for_each_in(*writer, policy, fn);
+    }
+    
+    /**
+     * Call fn(key, value) for all elements of the queue.
+     * Elements are split into contiguous ranges handled by separate threads,
+     * so fn must be safe to call concurrently for different elements.
+     * Only reads the data, so it can run on a snapshot (copy) of a queue
+     * that is modified by another thread.
+     *
+     * @param[in] policy : execution policy
+     * @param[in] fn     : function taking (K const&, V const&)
+     */
+    template <class F>
+    void for_each(parallel_policy const& policy, F fn) const {
+        auto reader = sd.read();
+        for_each_in(*reader, policy, fn);
+    }
+    
+    /**
+     * Call fn(key, values) for every key in the queue,
+     * values of the key are given in the queue order.
+     * Keys are split between threads so that each of them handles similar number of elements.
+     * Values can be modified; shared data is detached first.
+     *
+     * @param[in] policy : execution policy
+     * @param[in] fn     : function taking (K const&, key_values)
+     */
+    template <class F>
+    void for_each_key_group(parallel_policy const& policy, F fn) {
+        auto writer = sd.writePersistent();
+        for_each_group_in<key_values>(*writer, policy, fn);
+    }
+    
+    /**
+     * Call fn(key, values) for every key in the queue,
+     * values of the key are given in the queue order.
+     * Keys are split between threads so that each of them handles similar number of elements.
+     * Only reads the data, so it can run on a snapshot (copy) of a queue
+     * that is modified by another thread.
+     *
+     * @param[in] policy : execution policy
+     * @param[in] fn     : function taking (K const&, const_key_values)
+     */
+    template <class F>
+    void for_each_key_group(parallel_policy const& policy, F fn) const {
+        auto reader = sd.read();
+        for_each_group_in<const_key_values>(*reader, policy, fn);
+    }
+
     /**
      * Obtains the iterator to the queue first element.
      *
@@ -942,7 +3704,12 @@ public:
      */
     k_iterator k_begin() {
         auto reader = sd.read();
-        return k_iterator(reader->keys.begin());
+        if(reader->keys.is_ordered()) {
+            return k_iterator(reader->keys.ordered_entries().begin());
+        }
+        // Sorting the keys is reported to the mapping, so it can switch to the ordered layout
+        ++pending_scans;
+        return k_iterator(std::make_shared<const std::vector<K>>(reader->keys.sorted_keys()), 0);
     }
 
     /**
@@ -952,7 +3719,10 @@ public:
      */
     k_iterator k_end() {
         auto reader = sd.read();
-        return k_iterator(reader->keys.end());
+        if(reader->keys.is_ordered()) {
+            return k_iterator(reader->keys.ordered_entries().end());
+        }
+        return k_iterator(nullptr, reader->keys.size());
     }
 
     /**
@@ -966,17 +3736,454 @@ public:
         std::ostringstream out;
         out << "{ ";
         bool isFirst = true;
-        for(auto e : reader->fifo) {
+        for(auto const& e : reader->fifo) {
             if(!isFirst) {
                 out << ", ";
             } else {
                 isFirst = false;
             }
-            out << e.first << " => " << e.second;
+            out << e.first << " => " << value_of(e.second);
         }
         out << " }";
         return out.str();
     }
 };
 
+/**
+ * Immutable, read-optimised form of keyed_queue (created by keyed_queue::freeze()).
+ *
+ * Elements are stored in flat arrays in the queue order (key ids and values)
+ * and keys are indexed in CSR form: sorted unique keys, offsets of their groups
+ * and positions of the elements of every key in the flat arrays.
+ * Every key is stored once, so it takes far less memory than the list and map nodes,
+ * and full or per-key scans walk contiguous memory.
+ *
+ * Lookups by key take O(log k) time for k unique keys.
+ *
+ * @tparam K : Key type
+ * @tparam V : Value type
+ */
+template <class K, class V>
+class frozen_keyed_queue {
+public:
+
+    /** Type of the positions and offsets in the flat arrays */
+    using position = std::uint32_t;
+    
+private:
+
+    /** Sorted unique keys */
+    std::vector<K> sorted_keys;
+    /** Key (index in sorted_keys) of every element in the queue order */
+    std::vector<position> key_ids;
+    /** Value of every element in the queue order */
+    std::vector<V> value_array;
+    /** Positions of the elements of the i-th key are positions[offsets[i]..offsets[i+1]) */
+    std::vector<position> offsets;
+    /** Positions of the elements grouped by key (queue order within the group) */
+    std::vector<position> positions;
+    
+    /**
+     * Find the index of the key in sorted_keys.
+     *
+     * @param[in] k : key
+     * @returns index of the key or sorted_keys.size() if it's missing
+     */
+    std::size_t key_index(K const& k) const {
+        const auto i = std::lower_bound(sorted_keys.begin(), sorted_keys.end(), k);
+        if(i == sorted_keys.end() || k < *i) {
+            return sorted_keys.size();
+        }
+        return static_cast<std::size_t>(i - sorted_keys.begin());
+    }
+    
+    /**
+     * Get the element at the given position.
+     * @throws never
+     */
+    std::pair<K const &, V const &> element(std::size_t pos) const noexcept {
+        return { sorted_keys[key_ids[pos]], value_array[pos] };
+    }
+    
+public:
+
+    /**
+     * Random access iterator through the elements in the queue order.
+     * Dereferencing gives (key, value) pair of references.
+     */
+    class const_iterator {
+    private:
+        const frozen_keyed_queue* queue = nullptr;
+        std::size_t pos = 0;
+    public:
+        using iterator_category = std::random_access_iterator_tag;
+        using value_type = std::pair<K const &, V const &>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+        
+        const_iterator() = default;
+        
+        const_iterator(const frozen_keyed_queue* q, std::size_t p): queue(q), pos(p) {
+        
+        }
+        
+        reference operator*() const {
+            return queue->element(pos);
+        }
+        
+        reference operator[](difference_type n) const {
+            return queue->element(pos + n);
+        }
+        
+        const_iterator& operator++() {
+            ++pos;
+            return *this;
+        }
+        
+        const_iterator operator++(int) {
+            auto copy = *this;
+            ++pos;
+            return copy;
+        }
+        
+        const_iterator& operator--() {
+            --pos;
+            return *this;
+        }
+        
+        const_iterator operator--(int) {
+            auto copy = *this;
+            --pos;
+            return copy;
+        }
+        
+        const_iterator& operator+=(difference_type n) {
+            pos += n;
+            return *this;
+        }
+        
+        const_iterator& operator-=(difference_type n) {
+            pos -= n;
+            return *this;
+        }
+        
+        const_iterator operator+(difference_type n) const {
+            return const_iterator(queue, pos + n);
+        }
+        
+        const_iterator operator-(difference_type n) const {
+            return const_iterator(queue, pos - n);
+        }
+        
+        difference_type operator-(const_iterator const& i) const {
+            return static_cast<difference_type>(pos) - static_cast<difference_type>(i.pos);
+        }
+        
+        bool operator==(const_iterator const& i) const {
+            return pos == i.pos;
+        }
+        
+        bool operator!=(const_iterator const& i) const {
+            return pos != i.pos;
+        }
+        
+        bool operator<(const_iterator const& i) const {
+            return pos < i.pos;
+        }
+        
+        bool operator>(const_iterator const& i) const {
+            return pos > i.pos;
+        }
+        
+        bool operator<=(const_iterator const& i) const {
+            return pos <= i.pos;
+        }
+        
+        bool operator>=(const_iterator const& i) const {
+            return pos >= i.pos;
+        }
+    };
+    
+    /**
+     * View of the values stored under one key, in the queue order.
+     */
+    class key_values {
+    private:
+        const frozen_keyed_queue* queue;
+        const position* first;
+        const position* last;
+    public:
+    
+        class iterator {
+        private:
+            const frozen_keyed_queue* queue;
+            const position* pos;
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = V;
+            using difference_type = std::ptrdiff_t;
+            using pointer = V const*;
+            using reference = V const&;
+            
+            iterator(const frozen_keyed_queue* q, const position* p): queue(q), pos(p) {
+            
+            }
+            
+            V const& operator*() const {
+                return queue->value_array[*pos];
+            }
+            
+            V const* operator->() const {
+                return &queue->value_array[*pos];
+            }
+            
+            iterator& operator++() {
+                ++pos;
+                return *this;
+            }
+            
+            iterator operator++(int) {
+                auto copy = *this;
+                ++pos;
+                return copy;
+            }
+            
+            bool operator==(iterator const& i) const {
+                return pos == i.pos;
+            }
+            
+            bool operator!=(iterator const& i) const {
+                return pos != i.pos;
+            }
+        };
+        
+        key_values(const frozen_keyed_queue* q, const position* b, const position* e): queue(q), first(b), last(e) {
+        
+        }
+        
+        iterator begin() const {
+            return iterator(queue, first);
+        }
+        
+        iterator end() const {
+            return iterator(queue, last);
+        }
+        
+        std::size_t size() const {
+            return static_cast<std::size_t>(last - first);
+        }
+        
+        bool empty() const {
+            return first == last;
+        }
+    };
+    
+    /**
+     * Creates empty frozen queue.
+     */
+    frozen_keyed_queue() = default;
+    
+    /**
+     * Build the frozen queue from the elements in the queue order.
+     *
+     * @param[in] keys  : sorted unique keys of the elements
+     * @param[in] begin : first (key, value) pair
+     * @param[in] end   : past-the-end iterator
+     * @param[in] size  : number of the elements
+     * @param[in] value : function returning the value for the stored one
+     * @returns frozen queue
+     * @throws std::length_error when the positions do not fit the position type
+     */
+    template <class It, class ValueOf>
+    static frozen_keyed_queue build(std::vector<K> keys, It begin, It end, std::size_t size, ValueOf const& value) {
+        if(size > std::numeric_limits<position>::max()) {
+            throw std::length_error("freeze(): Queue is too large to be frozen.");
+        }
+        
+        frozen_keyed_queue f;
+        f.sorted_keys = std::move(keys);
+        f.key_ids.reserve(size);
+        f.value_array.reserve(size);
+        f.offsets.assign(f.sorted_keys.size() + 1, 0);
+        
+        // Flatten the elements and count the elements of every key
+        for(auto i = begin; i != end; ++i) {
+            const auto id = static_cast<position>(f.key_index(i->first));
+            assert(id < f.sorted_keys.size());
+            f.key_ids.push_back(id);
+            f.value_array.push_back(value(i->second));
+            ++f.offsets[id + 1];
+        }
+        for(std::size_t k = 1; k < f.offsets.size(); ++k) {
+            f.offsets[k] += f.offsets[k - 1];
+        }
+        
+        // Scatter positions into the groups (keeps the queue order within the groups)
+        f.positions.resize(size);
+        std::vector<position> cursor(f.offsets.begin(), f.offsets.end() - 1);
+        for(std::size_t e = 0; e < size; ++e) {
+            f.positions[cursor[f.key_ids[e]]++] = static_cast<position>(e);
+        }
+        return f;
+    }
+    
+    /**
+     * Get the number of elements.
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        return value_array.size();
+    }
+    
+    /**
+     * Checks if there are no elements.
+     * @throws never
+     */
+    bool empty() const noexcept {
+        return value_array.empty();
+    }
+    
+    /**
+     * Gets the number of elements with the given key.
+     *
+     * @param[in] k : key
+     * @returns number of elements with matching key
+     */
+    std::size_t count(K const& k) const {
+        const auto i = key_index(k);
+        if(i == sorted_keys.size()) {
+            return 0;
+        }
+        return offsets[i + 1] - offsets[i];
+    }
+    
+    /**
+     * Get the first element.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K const &, V const &> front() const {
+        if(empty()) {
+            throw lookup_error("front(): Queue is empty.");
+        }
+        return element(0);
+    }
+    
+    /**
+     * Get the last element.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K const &, V const &> back() const {
+        if(empty()) {
+            throw lookup_error("back(): Queue is empty.");
+        }
+        return element(size() - 1);
+    }
+    
+    /**
+     * Get the first element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K const &, V const &> first(K const& k) const {
+        const auto i = key_index(k);
+        if(i == sorted_keys.size()) {
+            throw lookup_error("first(K): Key not present in the queue.");
+        }
+        return element(positions[offsets[i]]);
+    }
+    
+    /**
+     * Get the last element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K const &, V const &> last(K const& k) const {
+        const auto i = key_index(k);
+        if(i == sorted_keys.size()) {
+            throw lookup_error("last(K): Key not present in the queue.");
+        }
+        return element(positions[offsets[i + 1] - 1]);
+    }
+    
+    /**
+     * Get the values with matching key in the queue order.
+     *
+     * @param[in] k : key
+     * @returns view of the values (empty if there's no such key)
+     */
+    key_values values(K const& k) const {
+        const auto i = key_index(k);
+        if(i == sorted_keys.size()) {
+            return key_values(this, nullptr, nullptr);
+        }
+        return key_values(this, positions.data() + offsets[i], positions.data() + offsets[i + 1]);
+    }
+    
+    /**
+     * Returns iterator to the first element.
+     */
+    const_iterator begin() const {
+        return const_iterator(this, 0);
+    }
+    
+    /**
+     * Returns past-the-end iterator.
+     */
+    const_iterator end() const {
+        return const_iterator(this, size());
+    }
+    
+    /**
+     * Returns iterator to the first of the sorted unique keys.
+     */
+    typename std::vector<K>::const_iterator k_begin() const {
+        return sorted_keys.begin();
+    }
+    
+    /**
+     * Returns past-the-end iterator of the sorted unique keys.
+     */
+    typename std::vector<K>::const_iterator k_end() const {
+        return sorted_keys.end();
+    }
+    
+    /**
+     * Get the number of bytes held by the arrays
+     * (not counting the memory owned by the keys and values themselves).
+     */
+    std::size_t memory_usage() const noexcept {
+        return sorted_keys.capacity() * sizeof(K) + value_array.capacity() * sizeof(V) +
+            (key_ids.capacity() + offsets.capacity() + positions.capacity()) * sizeof(position);
+    }
+    
+    /**
+     * Creates mutable keyed queue with the copies of the elements.
+     *
+     * @tparam Policies : Policies of the created queue
+     * @param[in] policy : execution policy of the copy
+     * @returns keyed queue
+     */
+    template <class... Policies>
+    keyed_queue<K, V, Policies...> thaw(parallel_policy const& policy = parallel_policy::sequential()) const {
+        return keyed_queue<K, V, Policies...>(begin(), end(), policy);
+    }
+};
+
+
+/**
+ * Keyed queue owning its data (see unique_ownership).
+ * Use share() or snapshot() to obtain a copy-on-write keyed_queue when it's needed.
+ *
+ * @tparam K : Key type
+ * @tparam V : Value type
+ * @tparam Policies : Other policies of the queue
+ */
+template <class K, class V, class... Policies>
+using unique_keyed_queue = typename keyed_queue_without_policy<K, V, ownership_policy, policy_list<>, Policies...>::template with<unique_ownership>;
+
 #endif // _KEYED_QUEUE_
\ No newline at end of file
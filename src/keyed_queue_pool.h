@@ -0,0 +1,334 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _KEYED_QUEUE_POOL_
+#define _KEYED_QUEUE_POOL_
+
+#include "keyed_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Pool of keyed queue shards, one per worker, with work stealing.
+ *
+ * Every key has its home shard (chosen by the hash). A worker takes the elements from its own shard;
+ * when it's empty, the worker steals from the shard with the largest depth: the whole group of the key
+ * of its last element is moved to the worker's shard. Moving whole groups keeps the order of the elements
+ * of every key (all the elements of a key are always in one shard, the owner of the key),
+ * stealing single elements would break it. Victims are chosen by the depth counters read without locks,
+ * so the choice is only approximate.
+ *
+ * The home shard remembers the keys it gave away, pushes of such keys go to their current owner.
+ * The key returns home when it's pushed again after its owner took all its elements.
+ *
+ * Lock order: shard locks are taken in the order of the shard indices.
+ *
+ * @tparam K        : Key type (requires std::hash<K>)
+ * @tparam V        : Value type
+ * @tparam Policies : Policies of the shard queues
+ */
+template <class K, class V, class... Policies>
+class keyed_queue_pool {
+private:
+
+    /**
+     * Queue of one worker.
+     */
+    struct alignas(64) shard {
+        std::mutex lock;
+        keyed_queue<K, V, Policies...> queue;
+        /** Keys of this home shard owned by other shards */
+        std::unordered_map<K, std::size_t> moved;
+        /** Number of elements (updated under the lock, read without it) */
+        std::atomic<std::size_t> depth{ 0 };
+    };
+
+    /**
+     * Locks up to three shards in the order of their indices.
+     */
+    class ordered_lock {
+    private:
+        std::mutex* locked[3];
+        std::size_t count = 0;
+
+    public:
+        ordered_lock(std::vector<shard>& shards, std::size_t a, std::size_t b, std::size_t c) {
+            std::size_t order[3] = { a, b, c };
+            std::sort(order, order + 3);
+            for(std::size_t i = 0; i < 3; ++i) {
+                if(i == 0 || order[i] != order[i - 1]) {
+                    shards[order[i]].lock.lock();
+                    locked[count++] = &shards[order[i]].lock;
+                }
+            }
+        }
+
+        ~ordered_lock() {
+            while(count > 0) {
+                locked[--count]->unlock();
+            }
+        }
+
+        ordered_lock(ordered_lock const&) = delete;
+        ordered_lock& operator=(ordered_lock const&) = delete;
+    };
+
+    std::vector<shard> shards;
+
+    /**
+     * Get the home shard of the key.
+     */
+    std::size_t home_of(K const& k) const {
+        return std::hash<K>()(k) % shards.size();
+    }
+
+    /**
+     * Get the shard owning the key.
+     * Called with the home shard of the key locked.
+     */
+    std::size_t owner_of(K const& k, std::size_t home) const {
+        const auto i = shards[home].moved.find(k);
+        return i == shards[home].moved.end() ? home : i->second;
+    }
+
+    /**
+     * Push the element to the shard. Called with the shard locked.
+     */
+    template <class Value>
+    void push_to(std::size_t index, K const& k, Value&& v) {
+        shard& s = shards[index];
+        s.queue.push(k, std::forward<Value>(v));
+        s.depth.store(s.queue.size(), std::memory_order_relaxed);
+    }
+
+    /**
+     * Push new element to the owner of the key.
+     */
+    template <class Value>
+    void push_value(K const& k, Value&& v) {
+        const std::size_t home = home_of(k);
+        while(true) {
+            std::size_t owner;
+            {
+                std::lock_guard<std::mutex> guard(shards[home].lock);
+                owner = owner_of(k, home);
+                if(owner == home) {
+                    push_to(home, k, std::forward<Value>(v));
+                    return;
+                }
+            }
+            ordered_lock guard(shards, home, owner, owner);
+            if(owner_of(k, home) != owner) {
+                // Stolen again in the meantime
+                continue;
+            }
+            if(shards[owner].queue.count(k) == 0) {
+                // The owner took all the elements, the key returns home
+                shards[home].moved.erase(k);
+                owner = home;
+            }
+            push_to(owner, k, std::forward<Value>(v));
+            return;
+        }
+    }
+
+    /**
+     * Get the shard with the largest depth other than the worker's one.
+     * @returns index of the shard or the worker's index when all the other shards look empty
+     */
+    std::size_t choose_victim(std::size_t worker) const noexcept {
+        std::size_t victim = worker;
+        std::size_t largest = 0;
+        for(std::size_t i = 0; i < shards.size(); ++i) {
+            const std::size_t depth = shards[i].depth.load(std::memory_order_relaxed);
+            if(i != worker && depth > largest) {
+                largest = depth;
+                victim = i;
+            }
+        }
+        return victim;
+    }
+
+    /**
+     * Check the worker index.
+     */
+    void check_worker(std::size_t worker) const {
+        if(worker >= shards.size()) {
+            throw std::out_of_range("keyed_queue_pool: There's no such worker.");
+        }
+    }
+
+public:
+
+    /**
+     * Create the pool.
+     *
+     * @param[in] workers : number of shards (0 means the number of hardware threads)
+     */
+    explicit keyed_queue_pool(std::size_t workers = 0):
+        shards(workers ? workers : std::max(1u, std::thread::hardware_concurrency())) {
+
+    }
+
+    keyed_queue_pool(keyed_queue_pool const&) = delete;
+    keyed_queue_pool& operator=(keyed_queue_pool const&) = delete;
+
+    /**
+     * Push new key, value pair to the shard owning the key.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V const& v) {
+        push_value(k, v);
+    }
+
+    /**
+     * Push new key, value pair to the shard owning the key.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V&& v) {
+        push_value(k, std::move(v));
+    }
+
+    /**
+     * Move the group of the last key of the largest shard to the worker's shard.
+     * Gives the basic guarantee: when moving an element throws, the group may end up split between the shards.
+     *
+     * @param[in] worker : index of the worker
+     * @returns number of moved elements (0 when all the other shards are empty)
+     * @throws std::out_of_range when there's no such worker
+     */
+    std::size_t steal(std::size_t worker) {
+        check_worker(worker);
+        while(true) {
+            const std::size_t victim = choose_victim(worker);
+            if(victim == worker) {
+                return 0;
+            }
+            std::optional<K> key;
+            {
+                std::lock_guard<std::mutex> guard(shards[victim].lock);
+                if(!shards[victim].queue.empty()) {
+                    key.emplace(shards[victim].queue.back().first);
+                }
+            }
+            if(!key) {
+                // Emptied in the meantime, the depth counter is already updated
+                continue;
+            }
+            const K& k = *key;
+            const std::size_t home = home_of(k);
+            ordered_lock guard(shards, victim, worker, home);
+            shard& from = shards[victim];
+            shard& to = shards[worker];
+            const std::size_t moved = from.queue.count(k);
+            if(moved == 0 || owner_of(k, home) != victim) {
+                continue;
+            }
+            if(worker != home) {
+                shards[home].moved[k] = victim;
+            }
+            for(std::size_t i = 0; i < moved; ++i) {
+                to.queue.push(k, std::move(from.queue.first(k).second));
+                from.queue.pop(k);
+            }
+            if(worker == home) {
+                shards[home].moved.erase(k);
+            } else {
+                shards[home].moved[k] = worker;
+            }
+            from.depth.store(from.queue.size(), std::memory_order_relaxed);
+            to.depth.store(to.queue.size(), std::memory_order_relaxed);
+            return moved;
+        }
+    }
+
+    /**
+     * Remove the first element of the worker's shard and return it. When the shard is empty,
+     * steal a key group from the largest shard first.
+     *
+     * @param[in] worker : index of the worker
+     * @returns the element or nothing when all the shards are empty
+     * @throws std::out_of_range when there's no such worker
+     */
+    std::optional<std::pair<K, V>> try_extract(std::size_t worker) {
+        check_worker(worker);
+        shard& own = shards[worker];
+        do {
+            std::lock_guard<std::mutex> guard(own.lock);
+            if(!own.queue.empty()) {
+                std::optional<std::pair<K, V>> result(own.queue.extract());
+                own.depth.store(own.queue.size(), std::memory_order_relaxed);
+                return result;
+            }
+        } while(steal(worker) > 0 || own.depth.load(std::memory_order_relaxed) > 0);
+        return std::nullopt;
+    }
+
+    /**
+     * Remove the first element of the worker's shard (stealing when it's empty) and return it.
+     *
+     * @param[in] worker : index of the worker
+     * @throws lookup_error when all the shards are empty
+     * @throws std::out_of_range when there's no such worker
+     */
+    std::pair<K, V> extract(std::size_t worker) {
+        auto e = try_extract(worker);
+        if(!e) {
+            throw lookup_error("extract(): Pool is empty.");
+        }
+        return std::move(*e);
+    }
+
+    /**
+     * Gets the approximate number of elements in the shard.
+     *
+     * @param[in] worker : index of the worker
+     * @throws std::out_of_range when there's no such worker
+     */
+    std::size_t depth(std::size_t worker) const {
+        check_worker(worker);
+        return shards[worker].depth.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Gets the approximate number of elements in the pool.
+     *
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        std::size_t total = 0;
+        for(auto const& s : shards) {
+            total += s.depth.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+
+    /**
+     * Gets the number of shards (workers).
+     *
+     * @throws never
+     */
+    std::size_t workers() const noexcept {
+        return shards.size();
+    }
+};
+
+#endif // _KEYED_QUEUE_POOL_
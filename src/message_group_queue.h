@@ -0,0 +1,343 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _MESSAGE_GROUP_QUEUE_
+#define _MESSAGE_GROUP_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Thread-safe keyed queue with message group semantics.
+ *
+ * Elements of a key form a group processed by one consumer at a time: pop_next_unlocked() takes
+ * the oldest element whose key is not leased and leases the key to the consumer. Until the lease
+ * is acknowledged (ack()) or rejected (nack(), which puts the element back), other consumers skip
+ * the key and take the elements of the next keys, so the elements of every key are processed one by one
+ * in the FIFO order.
+ *
+ * The lease is recorded in the entry of the key in the key index. Keys available for leasing are kept
+ * in a heap ordered by the age of their first elements; a key leaves the heap when it's leased
+ * and returns to it when the lease ends, so finding the next element never visits the leased keys.
+ *
+ * @tparam K : Key type (requires std::hash<K> and equality comparison)
+ * @tparam V : Value type
+ */
+template <class K, class V>
+class message_group_queue {
+private:
+
+    /** Sequence number of the element */
+    using sequence = std::uint64_t;
+
+public:
+
+    /**
+     * Element taken with the exclusive lease of its key.
+     * Pass it to ack() when the element is processed or to nack() to put it back.
+     */
+    class lease {
+    private:
+        friend class message_group_queue;
+
+        K k;
+        V v;
+        sequence seq;
+        std::uint64_t token;
+
+        template <class Value>
+        lease(K const& key, Value&& value, sequence s, std::uint64_t t): k(key), v(std::forward<Value>(value)), seq(s), token(t) {
+
+        }
+
+    public:
+
+        /**
+         * Get the key of the element.
+         *
+         * @throws never
+         */
+        K const& key() const noexcept {
+            return k;
+        }
+
+        /**
+         * Get the value of the element.
+         *
+         * @throws never
+         */
+        V& value() noexcept {
+            return v;
+        }
+
+        /**
+         * Get the value of the element.
+         *
+         * @throws never
+         */
+        V const& value() const noexcept {
+            return v;
+        }
+    };
+
+private:
+
+    /**
+     * Stored element.
+     */
+    struct node {
+        sequence seq;
+        V value;
+
+        /**
+         * Create the element in place (so containers allocate before the value is moved).
+         */
+        template <class Value>
+        node(sequence s, Value&& v): seq(s), value(std::forward<Value>(v)) {
+
+        }
+    };
+
+    /**
+     * Entry of the key index.
+     */
+    struct group {
+        std::deque<node> elements;
+        /** Token of the current lease (0 when the key is not leased) */
+        std::uint64_t lease_token = 0;
+    };
+
+    /**
+     * Key available for leasing with the age of its first element.
+     */
+    struct ready_entry {
+        sequence seq;
+        K key;
+    };
+
+    /**
+     * Orders the ready keys so the oldest one is on the top of the heap.
+     */
+    struct later {
+        bool operator()(ready_entry const& a, ready_entry const& b) const noexcept {
+            return a.seq > b.seq;
+        }
+    };
+
+    /** Protects all the members below */
+    mutable std::mutex lock;
+    /** Key index */
+    std::unordered_map<K, group> groups;
+    /** Keys which are not leased and have elements */
+    std::priority_queue<ready_entry, std::vector<ready_entry>, later> ready;
+    /** Next sequence number */
+    sequence next_seq = 0;
+    /** Next lease token */
+    std::uint64_t next_token = 1;
+    /** Number of elements waiting in the queue */
+    std::size_t waiting = 0;
+    /** Number of leased keys */
+    std::size_t leased = 0;
+
+    /**
+     * Push new element.
+     */
+    template <class Value>
+    void push_value(K const& k, Value&& v) {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto l = groups.try_emplace(k);
+        group& g = l.first->second;
+        try {
+            g.elements.emplace_back(next_seq, std::forward<Value>(v));
+        } catch(...) {
+            if(l.second) {
+                groups.erase(l.first);
+            }
+            throw;
+        }
+        if(!g.lease_token && g.elements.size() == 1) {
+            try {
+                ready.push({ next_seq, k });
+            } catch(...) {
+                g.elements.pop_back();
+                if(l.second) {
+                    groups.erase(l.first);
+                }
+                throw;
+            }
+        }
+        ++next_seq;
+        ++waiting;
+    }
+
+    /**
+     * Find the group leased with the lease.
+     * Called with the lock held.
+     *
+     * @throws lookup_error when the lease is not held
+     */
+    group& leased_group(lease const& l, char const* message) {
+        const auto i = groups.find(l.k);
+        if(i == groups.end() || i->second.lease_token != l.token) {
+            throw lookup_error(message);
+        }
+        return i->second;
+    }
+
+public:
+
+    message_group_queue() = default;
+    message_group_queue(message_group_queue const&) = delete;
+    message_group_queue& operator=(message_group_queue const&) = delete;
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V const& v) {
+        push_value(k, v);
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue moving the value into it.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V&& v) {
+        push_value(k, std::move(v));
+    }
+
+    /**
+     * Take the oldest element whose key is not leased and lease the key.
+     *
+     * @returns the lease or nothing when every waiting element belongs to a leased key
+     */
+    std::optional<lease> try_pop_next_unlocked() {
+        std::lock_guard<std::mutex> guard(lock);
+        if(ready.empty()) {
+            return std::nullopt;
+        }
+        ready_entry const& next = ready.top();
+        group& g = groups.find(next.key)->second;
+        node& first = g.elements.front();
+        std::optional<lease> result(lease(next.key, std::move(first.value), first.seq, next_token));
+        ready.pop();
+        g.elements.pop_front();
+        g.lease_token = next_token++;
+        --waiting;
+        ++leased;
+        return result;
+    }
+
+    /**
+     * Take the oldest element whose key is not leased and lease the key.
+     *
+     * @returns the lease
+     * @throws lookup_error when every waiting element belongs to a leased key
+     */
+    lease pop_next_unlocked() {
+        auto l = try_pop_next_unlocked();
+        if(!l) {
+            throw lookup_error("pop_next_unlocked(): There's no element with an unlocked key.");
+        }
+        return std::move(*l);
+    }
+
+    /**
+     * Acknowledge the processed element and release its key.
+     *
+     * @param[in] l : lease
+     * @throws lookup_error when the lease is not held (e.g. it was already released)
+     */
+    void ack(lease const& l) {
+        std::lock_guard<std::mutex> guard(lock);
+        group& g = leased_group(l, "ack(): Lease is not held.");
+        if(g.elements.empty()) {
+            groups.erase(l.k);
+        } else {
+            ready.push({ g.elements.front().seq, l.k });
+            g.lease_token = 0;
+        }
+        --leased;
+    }
+
+    /**
+     * Put the element back to its place at the front of its key and release the key.
+     * The value is moved once, after the room for it is allocated: when putting it back throws,
+     * the lease keeps the value and the key stays leased.
+     *
+     * @param[in] l : lease
+     * @throws lookup_error when the lease is not held (e.g. it was already released)
+     */
+    void nack(lease&& l) {
+        std::lock_guard<std::mutex> guard(lock);
+        group& g = leased_group(l, "nack(): Lease is not held.");
+        g.elements.emplace_front(l.seq, std::move(l.v));
+        try {
+            ready.push({ l.seq, l.k });
+        } catch(...) {
+            l.v = std::move(g.elements.front().value);
+            g.elements.pop_front();
+            throw;
+        }
+        g.lease_token = 0;
+        ++waiting;
+        --leased;
+    }
+
+    /**
+     * Checks if the key is leased.
+     *
+     * @param[in] k : key
+     */
+    bool is_locked(K const& k) const {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto i = groups.find(k);
+        return i != groups.end() && i->second.lease_token != 0;
+    }
+
+    /**
+     * Gets the number of waiting (not leased) elements with the given key.
+     *
+     * @param[in] k : key
+     */
+    std::size_t count(K const& k) const {
+        std::lock_guard<std::mutex> guard(lock);
+        const auto i = groups.find(k);
+        return i == groups.end() ? 0 : i->second.elements.size();
+    }
+
+    /**
+     * Gets the number of waiting (not leased) elements.
+     */
+    std::size_t size() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return waiting;
+    }
+
+    /**
+     * Gets the number of leased keys.
+     */
+    std::size_t in_flight() const {
+        std::lock_guard<std::mutex> guard(lock);
+        return leased;
+    }
+};
+
+#endif // _MESSAGE_GROUP_QUEUE_
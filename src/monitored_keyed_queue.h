@@ -0,0 +1,330 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _MONITORED_KEYED_QUEUE_
+#define _MONITORED_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * Keyed queue mutated by one owner thread and observed by any number of monitoring threads without locks.
+ *
+ * After every mutation the owner mirrors the state seen by the monitors: the number of elements,
+ * the numbers of elements of the monitored keys (atomic depth counters) and a copy of the front element.
+ * The mirror is guarded by a sequence lock: the owner makes the sequence odd while it writes the mirror
+ * and even again afterwards, monitors read the mirror optimistically and retry when the sequence changed.
+ * Monitors never write shared memory, so polling does not slow down the owner.
+ *
+ * The front element is copied word by word through atomics, so it's mirrored only
+ * when the keys and the values are trivially copyable (and default constructible).
+ *
+ * @tparam K        : Key type (requires std::hash<K> for the monitored keys)
+ * @tparam V        : Value type
+ * @tparam Policies : Policies of the underlying keyed_queue
+ */
+template <class K, class V, class... Policies>
+class monitored_keyed_queue {
+public:
+
+    /** Is the front element mirrored? */
+    static constexpr bool mirrors_front =
+        std::is_trivially_copyable<K>::value && std::is_trivially_copyable<V>::value &&
+        std::is_default_constructible<K>::value && std::is_default_constructible<V>::value;
+
+    /**
+     * Consistent view of the queue.
+     */
+    struct observation {
+        /** Number of elements */
+        std::size_t size;
+        /** Copy of the first element (nothing when the queue is empty) */
+        std::optional<std::pair<K, V>> front;
+    };
+
+private:
+
+    /**
+     * Object copied word by word through relaxed atomics.
+     */
+    template <class T>
+    struct atomic_words {
+        static constexpr std::size_t count = (sizeof(T) + sizeof(std::uint64_t) - 1) / sizeof(std::uint64_t);
+        std::atomic<std::uint64_t> words[count] = {};
+
+        void store(T const& value) noexcept {
+            std::uint64_t buffer[count] = {};
+            std::memcpy(buffer, &value, sizeof(T));
+            for(std::size_t i = 0; i < count; ++i) {
+                words[i].store(buffer[i], std::memory_order_relaxed);
+            }
+        }
+
+        void load(T& value) const noexcept {
+            std::uint64_t buffer[count];
+            for(std::size_t i = 0; i < count; ++i) {
+                buffer[i] = words[i].load(std::memory_order_relaxed);
+            }
+            std::memcpy(&value, buffer, sizeof(T));
+        }
+    };
+
+    /**
+     * Mirror of the front element (empty when it's not mirrored).
+     */
+    struct front_mirror {
+        std::atomic<bool> present{ false };
+        atomic_words<K> key;
+        atomic_words<V> value;
+    };
+
+    struct no_front_mirror {};
+
+    /** The queue (used only by the owner) */
+    keyed_queue<K, V, Policies...> queue;
+
+    /** Sequence of the mirror (odd while the owner writes it) */
+    alignas(64) std::atomic<std::uint64_t> sequence{ 0 };
+    /** Number of elements */
+    std::atomic<std::size_t> elements{ 0 };
+    /** Copy of the front element */
+    typename std::conditional<mirrors_front, front_mirror, no_front_mirror>::type front_copy;
+    /** Numbers of elements of the monitored keys (the map is never modified after the construction) */
+    std::unordered_map<K, std::atomic<std::size_t>> depths;
+
+    /**
+     * Mirror the state after the mutation.
+     *
+     * @param[in] changed : key whose number of elements could change (null means all the keys)
+     */
+    void publish(K const* changed) noexcept {
+        const std::uint64_t seq = sequence.load(std::memory_order_relaxed);
+        sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        elements.store(queue.size(), std::memory_order_relaxed);
+        if(changed) {
+            const auto i = depths.find(*changed);
+            if(i != depths.end()) {
+                i->second.store(queue.count(*changed), std::memory_order_relaxed);
+            }
+        } else {
+            for(auto& entry : depths) {
+                entry.second.store(queue.count(entry.first), std::memory_order_relaxed);
+            }
+        }
+        if constexpr (mirrors_front) {
+            const bool present = !queue.empty();
+            front_copy.present.store(present, std::memory_order_relaxed);
+            if(present) {
+                auto const& q = queue;
+                const auto first = q.front();
+                front_copy.key.store(first.first);
+                front_copy.value.store(first.second);
+            }
+        }
+
+        sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    /**
+     * Read the mirror optimistically, retrying until the owner did not change it in the meantime.
+     */
+    template <class F>
+    void read(F const& f) const noexcept {
+        while(true) {
+            const std::uint64_t before = sequence.load(std::memory_order_acquire);
+            if(before & 1) {
+                std::this_thread::yield();
+                continue;
+            }
+            f();
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if(sequence.load(std::memory_order_relaxed) == before) {
+                return;
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Create the queue.
+     *
+     * @param[in] monitored : keys whose numbers of elements can be read by the monitors
+     */
+    explicit monitored_keyed_queue(std::vector<K> const& monitored = std::vector<K>()) {
+        for(auto const& k : monitored) {
+            depths.try_emplace(k, 0);
+        }
+    }
+
+    monitored_keyed_queue(monitored_keyed_queue const&) = delete;
+    monitored_keyed_queue& operator=(monitored_keyed_queue const&) = delete;
+
+    /**
+     * Owner: push new key, value pair.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V const& v) {
+        queue.push(k, v);
+        publish(&k);
+    }
+
+    /**
+     * Owner: push new key, value pair moving the value into it.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     */
+    void push(K const& k, V&& v) {
+        queue.push(k, std::move(v));
+        publish(&k);
+    }
+
+    /**
+     * Owner: remove the first element and return it.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> extract() {
+        auto e = queue.extract();
+        publish(&e.first);
+        return e;
+    }
+
+    /**
+     * Owner: remove the first element with matching key and return it.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> extract(K const& k) {
+        auto e = queue.extract(k);
+        publish(&k);
+        return e;
+    }
+
+    /**
+     * Owner: pop the first element.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    void pop() {
+        extract();
+    }
+
+    /**
+     * Owner: pop the first element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void pop(K const& k) {
+        queue.pop(k);
+        publish(&k);
+    }
+
+    /**
+     * Owner: move all elements with matching key to the end of the queue.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void move_to_back(K const& k) {
+        queue.move_to_back(k);
+        publish(&k);
+    }
+
+    /**
+     * Owner: remove all the elements.
+     */
+    void clear() {
+        queue.clear();
+        publish(nullptr);
+    }
+
+    /**
+     * Owner: get the queue.
+     *
+     * @throws never
+     */
+    keyed_queue<K, V, Policies...> const& local() const noexcept {
+        return queue;
+    }
+
+    /**
+     * Monitor: gets the number of elements.
+     *
+     * @throws never
+     */
+    std::size_t size() const noexcept {
+        return elements.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Monitor: gets the number of elements of the monitored key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when the key is not monitored
+     */
+    std::size_t count(K const& k) const {
+        const auto i = depths.find(k);
+        if(i == depths.end()) {
+            throw lookup_error("count(K): Key is not monitored.");
+        }
+        return i->second.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Monitor: get the copy of the first element.
+     *
+     * @returns the first element or nothing when the queue is empty
+     * @throws never
+     */
+    std::optional<std::pair<K, V>> front() const noexcept {
+        return observe().front;
+    }
+
+    /**
+     * Monitor: get the number of elements and the copy of the first element, both from the same moment.
+     *
+     * @throws never
+     */
+    observation observe() const noexcept {
+        static_assert(mirrors_front, "monitored_keyed_queue: Front element is mirrored only for trivially copyable keys and values.");
+        observation result;
+        std::pair<K, V> first;
+        read([&]() {
+            result.size = elements.load(std::memory_order_relaxed);
+            const bool present = front_copy.present.load(std::memory_order_relaxed);
+            if(present) {
+                front_copy.key.load(first.first);
+                front_copy.value.load(first.second);
+                result.front = first;
+            } else {
+                result.front.reset();
+            }
+        });
+        return result;
+    }
+};
+
+#endif // _MONITORED_KEYED_QUEUE_
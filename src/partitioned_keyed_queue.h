@@ -0,0 +1,299 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _PARTITIONED_KEYED_QUEUE_
+#define _PARTITIONED_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+/**
+ * Shared-nothing keyed queue for thread-per-core designs.
+ *
+ * Keys are split between N partitions by their hash. Every partition is a plain keyed_queue
+ * owned by one core (thread): only its owner touches it, so it needs no locks and no atomics.
+ * A core pushing a key of another partition puts the element into the mailbox from this core
+ * to the owner (a bounded single-producer single-consumer ring, one for every pair of cores);
+ * the owner moves the elements from its mailboxes into its partition in batches (poll()).
+ *
+ * Ordering is per key and per partition, not global: elements of a key pushed by one core
+ * are taken in the order of the pushes, but there's no order between the elements pushed by different
+ * cores before they reach the partition, and no order at all between the partitions.
+ * This gives up global FIFO for scaling with the number of cores.
+ *
+ * Every method taking the core index must be called only by the thread of that core.
+ *
+ * A partition is never shared, so without explicit policies the partitions use unique_ownership:
+ * their data has no reference count, and mutations never check for a shared copy.
+ *
+ * @tparam K        : Key type (requires std::hash<K>)
+ * @tparam V        : Value type
+ * @tparam N        : Number of partitions (cores)
+ * @tparam Policies : Policies of the partition queues (unique_ownership when none are given)
+ */
+template <class K, class V, std::size_t N, class... Policies>
+class partitioned_keyed_queue {
+    static_assert(N > 0, "partitioned_keyed_queue: There must be at least one partition.");
+
+public:
+
+    /** Queue of one partition */
+    using partition_queue = typename std::conditional<sizeof...(Policies) == 0,
+        keyed_queue<K, V, unique_ownership>, keyed_queue<K, V, Policies...>>::type;
+
+private:
+
+    /**
+     * Bounded single-producer single-consumer ring.
+     * Both sides cache the index of the other one and read it again only when the cached
+     * value says the ring is full (empty), so the shared indices are touched once per batch.
+     */
+    class mailbox {
+    private:
+        /** Read by both sides, written only in the constructor */
+        std::size_t mask;
+        std::unique_ptr<std::optional<std::pair<K, V>>[]> slots;
+
+        /** Written by the producer */
+        alignas(64) std::atomic<std::size_t> tail{ 0 };
+        std::size_t cached_head = 0;
+
+        /** Written by the consumer */
+        alignas(64) std::atomic<std::size_t> head{ 0 };
+        std::size_t cached_tail = 0;
+
+    public:
+
+        explicit mailbox(std::size_t capacity): mask(capacity - 1), slots(new std::optional<std::pair<K, V>>[capacity]) {
+
+        }
+
+        /**
+         * Producer: put the element into the ring.
+         * The value is not touched when the ring is full.
+         *
+         * @returns false when the ring is full
+         */
+        template <class Value>
+        bool try_push(K const& k, Value&& v) {
+            const std::size_t t = tail.load(std::memory_order_relaxed);
+            if(t - cached_head > mask) {
+                cached_head = head.load(std::memory_order_acquire);
+                if(t - cached_head > mask) {
+                    return false;
+                }
+            }
+            slots[t & mask].emplace(k, std::forward<Value>(v));
+            tail.store(t + 1, std::memory_order_release);
+            return true;
+        }
+
+        /**
+         * Consumer: pass at most max_items elements to fn(std::pair<K, V>&&) and remove them.
+         * When fn throws, its element stays in the ring.
+         *
+         * @returns number of removed elements
+         */
+        template <class F>
+        std::size_t drain(std::size_t max_items, F& fn) {
+            const std::size_t h = head.load(std::memory_order_relaxed);
+            if(cached_tail == h) {
+                cached_tail = tail.load(std::memory_order_acquire);
+            }
+            const std::size_t count = std::min(cached_tail - h, max_items);
+            for(std::size_t i = 0; i < count; ++i) {
+                auto& slot = slots[(h + i) & mask];
+                try {
+                    fn(std::move(*slot));
+                } catch(...) {
+                    head.store(h + i, std::memory_order_release);
+                    throw;
+                }
+                slot.reset();
+            }
+            head.store(h + count, std::memory_order_release);
+            return count;
+        }
+    };
+
+    /**
+     * Partition with the state of its owner.
+     */
+    struct alignas(64) partition {
+        partition_queue queue;
+        /** Mailbox polled first by the next poll() (for fairness between the senders) */
+        std::size_t next_source = 0;
+    };
+
+    std::array<partition, N> partitions;
+    /** mailboxes[from][to] (null for from == to) */
+    std::array<std::array<std::unique_ptr<mailbox>, N>, N> mailboxes;
+
+    /**
+     * Check the core index.
+     */
+    static void check_core(std::size_t core) {
+        if(core >= N) {
+            throw std::out_of_range("partitioned_keyed_queue: There's no such core.");
+        }
+    }
+
+    /**
+     * Push new element from the core.
+     */
+    template <class Value>
+    void push_value(std::size_t core, K const& k, Value&& v) {
+        check_core(core);
+        const std::size_t target = partition_of(k);
+        if(target == core) {
+            partitions[core].queue.push(k, std::forward<Value>(v));
+            return;
+        }
+        mailbox& m = *mailboxes[core][target];
+        while(!m.try_push(k, std::forward<Value>(v))) {
+            // Take own mail while waiting, so two cores waiting for each other always make progress
+            if(poll(core) == 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+public:
+
+    /**
+     * Create the partitions and the mailboxes.
+     *
+     * @param[in] mailbox_capacity : capacity of every mailbox (rounded up to the power of two)
+     */
+    explicit partitioned_keyed_queue(std::size_t mailbox_capacity = 1024) {
+        std::size_t capacity = 1;
+        while(capacity < mailbox_capacity) {
+            capacity *= 2;
+        }
+        for(std::size_t from = 0; from < N; ++from) {
+            for(std::size_t to = 0; to < N; ++to) {
+                if(from != to) {
+                    mailboxes[from][to] = std::make_unique<mailbox>(capacity);
+                }
+            }
+        }
+    }
+
+    partitioned_keyed_queue(partitioned_keyed_queue const&) = delete;
+    partitioned_keyed_queue& operator=(partitioned_keyed_queue const&) = delete;
+
+    /**
+     * Gets the partition (core) owning the key.
+     *
+     * @param[in] k : key
+     */
+    static std::size_t partition_of(K const& k) {
+        return std::hash<K>()(k) % N;
+    }
+
+    /**
+     * Gets the number of partitions.
+     *
+     * @throws never
+     */
+    static constexpr std::size_t partition_count() noexcept {
+        return N;
+    }
+
+    /**
+     * Push new key, value pair from the core: directly into its partition if it owns the key,
+     * to the mailbox of the owner otherwise. When the mailbox is full, the core polls its own
+     * mailboxes until there's room.
+     *
+     * @param[in] core : index of the calling core
+     * @param[in] k    : key
+     * @param[in] v    : value
+     * @throws std::out_of_range when there's no such core
+     */
+    void push(std::size_t core, K const& k, V const& v) {
+        push_value(core, k, v);
+    }
+
+    /**
+     * Push new key, value pair from the core, moving the value.
+     *
+     * @param[in] core : index of the calling core
+     * @param[in] k    : key
+     * @param[in] v    : value
+     * @throws std::out_of_range when there's no such core
+     */
+    void push(std::size_t core, K const& k, V&& v) {
+        push_value(core, k, std::move(v));
+    }
+
+    /**
+     * Move the elements from the mailboxes of the core into its partition.
+     * If pushing into the partition throws, the element stays in its mailbox.
+     *
+     * @param[in] core      : index of the calling core
+     * @param[in] max_items : maximal number of moved elements
+     * @returns number of moved elements
+     * @throws std::out_of_range when there's no such core
+     */
+    std::size_t poll(std::size_t core, std::size_t max_items = SIZE_MAX) {
+        check_core(core);
+        partition& p = partitions[core];
+        auto into_partition = [&p](std::pair<K, V>&& e) {
+            p.queue.push(e.first, std::move(e.second));
+        };
+        std::size_t moved = 0;
+        for(std::size_t i = 0; i < N && moved < max_items; ++i) {
+            const std::size_t from = (p.next_source + i) % N;
+            if(from != core) {
+                moved += mailboxes[from][core]->drain(max_items - moved, into_partition);
+            }
+        }
+        p.next_source = (p.next_source + 1) % N;
+        return moved;
+    }
+
+    /**
+     * Remove the first element of the core's partition and return it.
+     * Polls the mailboxes when the partition is empty.
+     *
+     * @param[in] core : index of the calling core
+     * @returns the first element or nothing when there's none
+     * @throws std::out_of_range when there's no such core
+     */
+    std::optional<std::pair<K, V>> try_extract(std::size_t core) {
+        check_core(core);
+        partition_queue& q = partitions[core].queue;
+        if(q.empty() && poll(core) == 0) {
+            return std::nullopt;
+        }
+        return q.extract();
+    }
+
+    /**
+     * Gets the partition of the core. Only its owner may use it.
+     *
+     * @param[in] core : index of the calling core
+     * @throws std::out_of_range when there's no such core
+     */
+    partition_queue& local(std::size_t core) {
+        check_core(core);
+        return partitions[core].queue;
+    }
+};
+
+#endif // _PARTITIONED_KEYED_QUEUE_
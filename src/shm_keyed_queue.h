@@ -0,0 +1,781 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _SHM_KEYED_QUEUE_
+#define _SHM_KEYED_QUEUE_
+
+#include "keyed_queue.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+/**
+ * Keyed queue living entirely in a shared memory region, for keyed messages between processes.
+ *
+ * The region holds the header, the key index (open addressing hash table with linear probing)
+ * and a fixed pool of elements. Elements are linked into the fifo (doubly linked) and into the chains
+ * of their keys (singly linked) with 32-bit indices instead of pointers, so every process can map
+ * the region at a different address.
+ *
+ * Operations are guarded by a process-shared futex lock: an uncontended lock and unlock are single
+ * atomic operations without syscalls. Consumers can wait for pushed elements on a futex (wait_extract()),
+ * producers wake them only when somebody waits.
+ *
+ * Keys and values are stored in the region, so they must be trivially copyable
+ * (no pointers to private memory). All the processes must use the same K, V and std::hash<K>.
+ * A process that dies while holding the lock leaves the queue locked.
+ *
+ * @tparam K : Key type (trivially copyable, with == and std::hash<K>)
+ * @tparam V : Value type (trivially copyable)
+ */
+template <class K, class V>
+class shm_keyed_queue {
+    static_assert(std::is_trivially_copyable<K>::value, "shm_keyed_queue: Keys must be trivially copyable.");
+    static_assert(std::is_trivially_copyable<V>::value, "shm_keyed_queue: Values must be trivially copyable.");
+
+private:
+
+    /** Null index */
+    static constexpr std::uint32_t none = UINT32_MAX;
+    /** Marks initialised regions */
+    static constexpr std::uint64_t magic = 0x6b65796564717565ULL;
+
+    /**
+     * Header at the beginning of the region.
+     */
+    struct header {
+        std::uint64_t magic_value;
+        std::uint64_t region_size;
+        std::uint32_t node_capacity;
+        /** Maximal number of distinct keys (at most half of the buckets) */
+        std::uint32_t key_capacity;
+        std::uint32_t bucket_count;
+        std::uint64_t buckets_offset;
+        std::uint64_t nodes_offset;
+
+        /** Futex lock: 0 - free, 1 - locked, 2 - locked with waiters */
+        alignas(64) std::atomic<std::uint32_t> lock_word;
+
+        /** Incremented on every push (futex waited on by consumers) */
+        alignas(64) std::atomic<std::uint32_t> push_seq;
+        /** Number of consumers waiting on push_seq */
+        std::atomic<std::uint32_t> waiters;
+
+        /** Guarded by the lock */
+        alignas(64) std::uint32_t size;
+        std::uint32_t key_count;
+        std::uint32_t fifo_head;
+        std::uint32_t fifo_tail;
+        std::uint32_t free_head;
+    };
+
+    /**
+     * Element of the queue.
+     */
+    struct node {
+        std::uint32_t fifo_prev;
+        std::uint32_t fifo_next;
+        /** Next element with the same key */
+        std::uint32_t key_next;
+        K key;
+        V value;
+    };
+
+    /**
+     * Entry of the key index.
+     */
+    struct bucket {
+        std::uint32_t used;
+        std::uint32_t count;
+        std::uint32_t head;
+        std::uint32_t tail;
+        std::size_t hash;
+        K key;
+    };
+
+    static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "shm_keyed_queue: Lock-free 32-bit atomics are required.");
+
+    /** Mapped region */
+    void* base = nullptr;
+    /** Size of the mapping */
+    std::size_t mapped = 0;
+    /** Descriptor of the shared memory object */
+    int descriptor = -1;
+
+    header& head() const noexcept {
+        return *static_cast<header*>(base);
+    }
+
+    bucket* buckets() const noexcept {
+        return reinterpret_cast<bucket*>(static_cast<char*>(base) + head().buckets_offset);
+    }
+
+    node& at(std::uint32_t i) const noexcept {
+        return reinterpret_cast<node*>(static_cast<char*>(base) + head().nodes_offset)[i];
+    }
+
+    static std::uint32_t* futex_word(std::atomic<std::uint32_t>& a) noexcept {
+        return reinterpret_cast<std::uint32_t*>(&a);
+    }
+
+    static void futex_wait(std::atomic<std::uint32_t>& a, std::uint32_t expected, timespec const* timeout) noexcept {
+        ::syscall(SYS_futex, futex_word(a), FUTEX_WAIT, expected, timeout, nullptr, 0);
+    }
+
+    static void futex_wake(std::atomic<std::uint32_t>& a, int count) noexcept {
+        ::syscall(SYS_futex, futex_word(a), FUTEX_WAKE, count, nullptr, nullptr, 0);
+    }
+
+    /**
+     * Process-shared lock of the queue (three-state futex mutex).
+     */
+    class guard {
+    private:
+        std::atomic<std::uint32_t>& word;
+    public:
+        explicit guard(std::atomic<std::uint32_t>& w) noexcept: word(w) {
+            std::uint32_t c = 0;
+            if(word.compare_exchange_strong(c, 1, std::memory_order_acquire)) {
+                return;
+            }
+            if(c != 2) {
+                c = word.exchange(2, std::memory_order_acquire);
+            }
+            while(c != 0) {
+                futex_wait(word, 2, nullptr);
+                c = word.exchange(2, std::memory_order_acquire);
+            }
+        }
+
+        ~guard() {
+            if(word.fetch_sub(1, std::memory_order_release) != 1) {
+                word.store(0, std::memory_order_release);
+                futex_wake(word, 1);
+            }
+        }
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+    };
+
+    /**
+     * Round up to the multiple of 64.
+     */
+    static constexpr std::size_t align_up(std::size_t n) noexcept {
+        return (n + 63) / 64 * 64;
+    }
+
+    /**
+     * Find the bucket of the key (or the empty bucket where it would go).
+     */
+    std::uint32_t probe(K const& k, std::size_t hash) const noexcept {
+        const std::uint32_t mask = head().bucket_count - 1;
+        std::uint32_t i = static_cast<std::uint32_t>(hash) & mask;
+        bucket* b = buckets();
+        while(b[i].used && !(b[i].hash == hash && b[i].key == k)) {
+            i = (i + 1) & mask;
+        }
+        return i;
+    }
+
+    /**
+     * Find the bucket of the key.
+     * @returns bucket or null if the key is not present
+     */
+    bucket* find(K const& k) const noexcept {
+        bucket& b = buckets()[probe(k, std::hash<K>()(k))];
+        return b.used ? &b : nullptr;
+    }
+
+    /**
+     * Remove the bucket keeping the probe sequences of the other keys intact (backward shift).
+     */
+    void erase_bucket(bucket& removed) noexcept {
+        const std::uint32_t mask = head().bucket_count - 1;
+        bucket* b = buckets();
+        std::uint32_t hole = static_cast<std::uint32_t>(&removed - b);
+        std::uint32_t j = hole;
+        while(true) {
+            j = (j + 1) & mask;
+            if(!b[j].used) {
+                break;
+            }
+            const std::uint32_t home = static_cast<std::uint32_t>(b[j].hash) & mask;
+            // Move the entry back if its home is not in the (hole, j] range
+            const bool between = (hole < j) ? (home > hole && home <= j) : (home > hole || home <= j);
+            if(!between) {
+                b[hole] = b[j];
+                hole = j;
+            }
+        }
+        b[hole].used = 0;
+        --head().key_count;
+    }
+
+    /**
+     * Unlink the element from the fifo.
+     */
+    void unlink_fifo(std::uint32_t i) noexcept {
+        node& n = at(i);
+        header& h = head();
+        (n.fifo_prev == none ? h.fifo_head : at(n.fifo_prev).fifo_next) = n.fifo_next;
+        (n.fifo_next == none ? h.fifo_tail : at(n.fifo_next).fifo_prev) = n.fifo_prev;
+    }
+
+    /**
+     * Append the element to the fifo.
+     */
+    void append_fifo(std::uint32_t i) noexcept {
+        node& n = at(i);
+        header& h = head();
+        n.fifo_prev = h.fifo_tail;
+        n.fifo_next = none;
+        (h.fifo_tail == none ? h.fifo_head : at(h.fifo_tail).fifo_next) = i;
+        h.fifo_tail = i;
+    }
+
+    /**
+     * Remove the first element of the key (b must be its bucket) and return its index to the pool.
+     */
+    void remove_first(bucket& b) noexcept {
+        header& h = head();
+        const std::uint32_t i = b.head;
+        unlink_fifo(i);
+        b.head = at(i).key_next;
+        if(--b.count == 0) {
+            erase_bucket(b);
+        }
+        at(i).fifo_next = h.free_head;
+        h.free_head = i;
+        --h.size;
+    }
+
+    /**
+     * Take the first element (with the given key) under the lock and pass it to fn(K const&, V const&).
+     * @returns false when there's no such element
+     */
+    template <class F>
+    bool consume_first(K const* k, F& fn) {
+        guard g(head().lock_word);
+        bucket* b;
+        if(k) {
+            b = find(*k);
+        } else {
+            b = (head().fifo_head == none) ? nullptr : find(at(head().fifo_head).key);
+        }
+        if(!b) {
+            return false;
+        }
+        node const& n = at(b->head);
+        fn(static_cast<K const&>(n.key), static_cast<V const&>(n.value));
+        remove_first(*b);
+        return true;
+    }
+
+    /**
+     * Initialise the empty queue in the mapped region.
+     */
+    void initialize(std::uint32_t node_capacity, std::uint32_t key_capacity, std::uint32_t bucket_count) noexcept {
+        header& h = *new (base) header();
+        h.region_size = mapped;
+        h.node_capacity = node_capacity;
+        h.key_capacity = key_capacity;
+        h.bucket_count = bucket_count;
+        h.buckets_offset = align_up(sizeof(header));
+        h.nodes_offset = align_up(h.buckets_offset + sizeof(bucket) * bucket_count);
+        h.lock_word.store(0, std::memory_order_relaxed);
+        h.push_seq.store(0, std::memory_order_relaxed);
+        h.waiters.store(0, std::memory_order_relaxed);
+        h.size = 0;
+        h.key_count = 0;
+        h.fifo_head = h.fifo_tail = none;
+        h.free_head = node_capacity ? 0 : none;
+        for(std::uint32_t i = 0; i < bucket_count; ++i) {
+            buckets()[i].used = 0;
+        }
+        for(std::uint32_t i = 0; i < node_capacity; ++i) {
+            at(i).fifo_next = (i + 1 < node_capacity) ? i + 1 : none;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        h.magic_value = magic;
+    }
+
+    /**
+     * Map the shared memory object.
+     */
+    void map(int fd, std::size_t size) {
+        descriptor = fd;
+        mapped = size;
+        base = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if(base == MAP_FAILED) {
+            base = nullptr;
+            const int error = errno;
+            ::close(fd);
+            descriptor = -1;
+            throw std::system_error(error, std::generic_category(), "shm_keyed_queue: Cannot map the region.");
+        }
+    }
+
+    /**
+     * Number of buckets for the given number of keys (power of two, at least twice the number of keys,
+     * so the load factor of the index never exceeds 0.5 and the probe sequences stay short).
+     */
+    static std::uint32_t buckets_for(std::uint32_t keys) {
+        std::uint64_t count = 2;
+        while(count < static_cast<std::uint64_t>(keys) * 2) {
+            count *= 2;
+        }
+        if(count > UINT32_MAX / 2) {
+            throw std::length_error("shm_keyed_queue: Too many keys.");
+        }
+        return static_cast<std::uint32_t>(count);
+    }
+
+    /**
+     * Create the queue in the new shared memory object.
+     */
+    static shm_keyed_queue create_in(int fd, std::uint32_t capacity, std::uint32_t key_capacity) {
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "shm_keyed_queue: Cannot create the shared memory object.");
+        }
+        std::uint32_t bucket_count;
+        try {
+            bucket_count = buckets_for(key_capacity);
+        } catch(...) {
+            ::close(fd);
+            throw;
+        }
+        const std::size_t size = required_size(capacity, bucket_count);
+        if(::ftruncate(fd, static_cast<off_t>(size)) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "shm_keyed_queue: Cannot resize the shared memory object.");
+        }
+        shm_keyed_queue q;
+        q.map(fd, size);
+        q.initialize(capacity, key_capacity, bucket_count);
+        return q;
+    }
+
+    /**
+     * Size of the region for the given numbers of the elements and buckets.
+     */
+    static std::size_t required_size(std::uint32_t capacity, std::uint32_t bucket_count) noexcept {
+        return align_up(align_up(sizeof(header)) + sizeof(bucket) * bucket_count) + sizeof(node) * capacity;
+    }
+
+    shm_keyed_queue() = default;
+
+public:
+
+    /**
+     * Create the queue in the new named shared memory object (/dev/shm).
+     *
+     * @param[in] name         : name of the object ("/name")
+     * @param[in] capacity     : maximal number of elements
+     * @param[in] key_capacity : maximal number of distinct keys at the same time
+     * @throws std::system_error when the object exists or cannot be created
+     * @throws std::length_error when key_capacity is too large
+     */
+    static shm_keyed_queue create(std::string const& name, std::uint32_t capacity, std::uint32_t key_capacity) {
+        return create_in(::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600), capacity, key_capacity);
+    }
+
+    /**
+     * Create the queue in an anonymous memory file (memfd). The mapping is inherited by fork(),
+     * and the descriptor (fd()) can be passed to other processes.
+     *
+     * @param[in] capacity     : maximal number of elements
+     * @param[in] key_capacity : maximal number of distinct keys at the same time
+     * @throws std::system_error when the memory file cannot be created
+     * @throws std::length_error when key_capacity is too large
+     */
+    static shm_keyed_queue create_anonymous(std::uint32_t capacity, std::uint32_t key_capacity) {
+        return create_in(::memfd_create("shm_keyed_queue", MFD_CLOEXEC), capacity, key_capacity);
+    }
+
+    /**
+     * Map the queue created by another process.
+     *
+     * @param[in] name : name of the object ("/name")
+     * @throws std::system_error when the object cannot be opened
+     * @throws std::invalid_argument when the object does not hold a queue
+     */
+    static shm_keyed_queue open(std::string const& name) {
+        return attach(::shm_open(name.c_str(), O_RDWR, 0));
+    }
+
+    /**
+     * Map the queue from the descriptor of the shared memory object (takes over the descriptor).
+     *
+     * @param[in] fd : descriptor
+     * @throws std::system_error when the object cannot be mapped
+     * @throws std::invalid_argument when the object does not hold a queue
+     */
+    static shm_keyed_queue attach(int fd) {
+        if(fd < 0) {
+            throw std::system_error(errno, std::generic_category(), "shm_keyed_queue: Cannot open the shared memory object.");
+        }
+        struct stat info;
+        if(::fstat(fd, &info) != 0) {
+            const int error = errno;
+            ::close(fd);
+            throw std::system_error(error, std::generic_category(), "shm_keyed_queue: Cannot read the shared memory object.");
+        }
+        shm_keyed_queue q;
+        q.map(fd, static_cast<std::size_t>(info.st_size));
+        if(q.mapped < sizeof(header) || q.head().magic_value != magic || q.head().region_size != q.mapped) {
+            throw std::invalid_argument("shm_keyed_queue: The shared memory object does not hold a keyed queue.");
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return q;
+    }
+
+    /**
+     * Remove the name of the shared memory object. Mapped queues stay valid.
+     *
+     * @param[in] name : name of the object
+     */
+    static void unlink(std::string const& name) noexcept {
+        ::shm_unlink(name.c_str());
+    }
+
+    shm_keyed_queue(shm_keyed_queue const&) = delete;
+    shm_keyed_queue& operator=(shm_keyed_queue const&) = delete;
+
+    shm_keyed_queue(shm_keyed_queue&& q) noexcept: base(q.base), mapped(q.mapped), descriptor(q.descriptor) {
+        q.base = nullptr;
+        q.descriptor = -1;
+    }
+
+    /**
+     * Unmaps the region. The queue stays in the shared memory object.
+     */
+    ~shm_keyed_queue() {
+        if(base) {
+            ::munmap(base, mapped);
+        }
+        if(descriptor >= 0) {
+            ::close(descriptor);
+        }
+    }
+
+    /**
+     * Get the descriptor of the shared memory object.
+     *
+     * @throws never
+     */
+    int fd() const noexcept {
+        return descriptor;
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     * Wakes the consumers waiting in wait_extract() (only if there're any).
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     * @returns false when the queue or the key index is full
+     */
+    bool try_push(K const& k, V const& v) noexcept {
+        header& h = head();
+        {
+            guard g(h.lock_word);
+            if(h.free_head == none) {
+                return false;
+            }
+            const std::size_t hash = std::hash<K>()(k);
+            bucket& b = buckets()[probe(k, hash)];
+            if(!b.used) {
+                // Keep the load factor of the index at most 0.5
+                if(h.key_count >= h.key_capacity) {
+                    return false;
+                }
+                b.used = 1;
+                b.count = 0;
+                b.hash = hash;
+                b.key = k;
+                b.head = b.tail = none;
+                ++h.key_count;
+            }
+            const std::uint32_t i = h.free_head;
+            node& n = at(i);
+            h.free_head = n.fifo_next;
+            n.key = k;
+            n.value = v;
+            n.key_next = none;
+            (b.tail == none ? b.head : at(b.tail).key_next) = i;
+            b.tail = i;
+            ++b.count;
+            append_fifo(i);
+            ++h.size;
+        }
+        h.push_seq.fetch_add(1, std::memory_order_seq_cst);
+        if(h.waiters.load(std::memory_order_seq_cst) > 0) {
+            futex_wake(h.push_seq, INT_MAX);
+        }
+        return true;
+    }
+
+    /**
+     * Push new key, value pair to the end of the queue.
+     *
+     * @param[in] k : key
+     * @param[in] v : value
+     * @throws std::length_error when the queue or the key index is full
+     */
+    void push(K const& k, V const& v) {
+        if(!try_push(k, v)) {
+            throw std::length_error("push(): Queue is full.");
+        }
+    }
+
+    /**
+     * Pass the first element to fn(K const&, V const&) without copying it out of the region,
+     * then remove it. fn runs under the lock of the queue.
+     *
+     * @param[in] fn : function taking the element
+     * @returns false when the queue is empty
+     */
+    template <class F>
+    bool try_consume(F fn) {
+        return consume_first(nullptr, fn);
+    }
+
+    /**
+     * Pass the first element with matching key to fn(K const&, V const&) without copying it
+     * out of the region, then remove it. fn runs under the lock of the queue.
+     *
+     * @param[in] k  : key
+     * @param[in] fn : function taking the element
+     * @returns false when there's no element with given key
+     */
+    template <class F>
+    bool try_consume(K const& k, F fn) {
+        return consume_first(&k, fn);
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     *
+     * @returns the first element or nothing when the queue is empty
+     */
+    std::optional<std::pair<K, V>> try_extract() noexcept {
+        std::optional<std::pair<K, V>> result;
+        try_consume([&result](K const& k, V const& v) { result.emplace(k, v); });
+        return result;
+    }
+
+    /**
+     * Remove the first element with matching key and return it.
+     *
+     * @param[in] k : key
+     * @returns the first element with matching key or nothing when there's no such element
+     */
+    std::optional<std::pair<K, V>> try_extract(K const& k) noexcept {
+        std::optional<std::pair<K, V>> result;
+        try_consume(k, [&result](K const& key, V const& v) { result.emplace(key, v); });
+        return result;
+    }
+
+    /**
+     * Remove the first element of the queue and return it.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> extract() {
+        auto e = try_extract();
+        if(!e) {
+            throw lookup_error("extract(): Queue is empty.");
+        }
+        return *e;
+    }
+
+    /**
+     * Remove the first element with matching key and return it.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> extract(K const& k) {
+        auto e = try_extract(k);
+        if(!e) {
+            throw lookup_error("extract(K): Key not present in the queue.");
+        }
+        return *e;
+    }
+
+    /**
+     * Pop the first element from the queue.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    void pop() {
+        extract();
+    }
+
+    /**
+     * Pop the first element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void pop(K const& k) {
+        extract(k);
+    }
+
+    /**
+     * Remove the first element of the queue and return it, waiting (on a futex) at most timeout
+     * until there's one.
+     *
+     * @param[in] timeout : maximal waiting time
+     * @returns the first element or nothing when the timeout expired
+     */
+    template <class Rep, class Period>
+    std::optional<std::pair<K, V>> wait_extract(std::chrono::duration<Rep, Period> const& timeout) {
+        header& h = head();
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while(true) {
+            const std::uint32_t seq = h.push_seq.load(std::memory_order_seq_cst);
+            if(auto e = try_extract()) {
+                return e;
+            }
+            const auto left = deadline - std::chrono::steady_clock::now();
+            if(left <= left.zero()) {
+                return std::nullopt;
+            }
+            const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+            timespec ts;
+            ts.tv_sec = static_cast<time_t>(ns / 1000000000);
+            ts.tv_nsec = static_cast<long>(ns % 1000000000);
+            h.waiters.fetch_add(1, std::memory_order_seq_cst);
+            // Returns at once if anything was pushed since seq was read
+            futex_wait(h.push_seq, seq, &ts);
+            h.waiters.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * Move all elements with matching key to the end of the queue.
+     * Operation preserves order of the elements of the key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    void move_to_back(K const& k) {
+        guard g(head().lock_word);
+        bucket* b = find(k);
+        if(!b) {
+            throw lookup_error("move_to_back(K): There's no such key in the queue.");
+        }
+        for(std::uint32_t i = b->head; i != none; i = at(i).key_next) {
+            unlink_fifo(i);
+            append_fifo(i);
+        }
+    }
+
+    /**
+     * Get the copy of the first element of the queue.
+     *
+     * @throws lookup_error when the queue is empty
+     */
+    std::pair<K, V> front() const {
+        guard g(head().lock_word);
+        if(head().fifo_head == none) {
+            throw lookup_error("front(): Queue is empty.");
+        }
+        node const& n = at(head().fifo_head);
+        return { n.key, n.value };
+    }
+
+    /**
+     * Get the copy of the first element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> first(K const& k) const {
+        guard g(head().lock_word);
+        bucket const* b = find(k);
+        if(!b) {
+            throw lookup_error("first(K): Key not present in the queue.");
+        }
+        return { k, at(b->head).value };
+    }
+
+    /**
+     * Get the copy of the last element with matching key.
+     *
+     * @param[in] k : key
+     * @throws lookup_error when there's no element with given key
+     */
+    std::pair<K, V> last(K const& k) const {
+        guard g(head().lock_word);
+        bucket const* b = find(k);
+        if(!b) {
+            throw lookup_error("last(K): Key not present in the queue.");
+        }
+        return { k, at(b->tail).value };
+    }
+
+    /**
+     * Gets the number of elements with the given key.
+     *
+     * @param[in] k : key
+     */
+    std::size_t count(K const& k) const noexcept {
+        guard g(head().lock_word);
+        bucket const* b = find(k);
+        return b ? b->count : 0;
+    }
+
+    /**
+     * Gets the number of elements.
+     */
+    std::size_t size() const noexcept {
+        guard g(head().lock_word);
+        return head().size;
+    }
+
+    /**
+     * Checks if the queue is empty.
+     */
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    /**
+     * Gets the maximal number of elements.
+     *
+     * @throws never
+     */
+    std::size_t capacity() const noexcept {
+        return head().node_capacity;
+    }
+};
+
+#endif // _SHM_KEYED_QUEUE_
@@ -0,0 +1,257 @@
+/**
+ * Univeristy of Warsaw 2017
+ *  Task: KEYED QUEUE
+ *  Authors:
+ *     kk385830  @kowaalczyk-priv
+ *     ps386038  @styczynski
+ */
+#ifndef _SNAPSHOT_PUBLISHER_
+#define _SNAPSHOT_PUBLISHER_
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * RCU-style publisher of immutable versions of an object (e.g. keyed_queue snapshots).
+ *
+ * One writer thread publishes new versions with publish(). Reader threads register once
+ * (register_reader()) and then acquire the current version with reader::acquire(),
+ * which is wait-free: the reader announces the current epoch in its own slot and loads the pointer.
+ *
+ * Replaced versions are retired with the epoch of the replacement. A retired version is destroyed
+ * (by the writer, in publish() or reclaim()) once every active reader announced a later epoch,
+ * so no reader can still hold it.
+ *
+ * Readers get only const access to the published version. Copying the version out of the guard
+ * (e.g. the copy-on-write keyed_queue copy in O(1)) keeps it alive after the guard is released.
+ *
+ * @tparam Q : Type of the published object
+ */
+template <class Q>
+class snapshot_publisher {
+private:
+
+    /** Epoch of the slots not reading anything */
+    static constexpr std::uint64_t idle_epoch = 0;
+
+    /**
+     * Slot of the registered reader.
+     */
+    struct alignas(64) reader_slot {
+        /** Epoch announced by the reader (idle_epoch when it holds nothing) */
+        std::atomic<std::uint64_t> epoch{ idle_epoch };
+        /** Is the slot registered? */
+        std::atomic<bool> taken{ false };
+    };
+
+    /**
+     * Version waiting until readers stop using it.
+     */
+    struct retired_version {
+        std::uint64_t epoch;
+        std::shared_ptr<const Q> version;
+    };
+
+    /** Current version (read by the readers) */
+    alignas(64) std::atomic<const Q*> current;
+    /** Global epoch, incremented on every publish */
+    std::atomic<std::uint64_t> global_epoch{ idle_epoch + 1 };
+    /** Owner of the current version (writer only) */
+    std::shared_ptr<const Q> current_owner;
+    /** Versions replaced while readers could hold them (writer only) */
+    std::vector<retired_version> retired;
+    /** Reader slots */
+    std::vector<reader_slot> slots;
+
+public:
+
+    class reader;
+
+    /**
+     * Guard of the acquired version.
+     * The version stays alive until the guard is destroyed.
+     */
+    class guard {
+    private:
+        reader_slot* slot;
+        const Q* version;
+
+        friend class reader;
+
+        guard(reader_slot* s, const Q* v) noexcept: slot(s), version(v) {}
+
+    public:
+
+        guard(guard const&) = delete;
+        guard& operator=(guard const&) = delete;
+
+        guard(guard&& g) noexcept: slot(g.slot), version(g.version) {
+            g.slot = nullptr;
+        }
+
+        /**
+         * Releases the version.
+         */
+        ~guard() {
+            if(slot != nullptr) {
+                slot->epoch.store(idle_epoch, std::memory_order_release);
+            }
+        }
+
+        /**
+         * Get the read-only reference to the version.
+         */
+        const Q& operator*() const noexcept {
+            return *version;
+        }
+
+        /**
+         * Get the read-only pointer to the version.
+         */
+        const Q* operator->() const noexcept {
+            return version;
+        }
+    };
+
+    /**
+     * Registered reader. Each reader thread uses its own reader object.
+     * Reader can hold one guard at the time.
+     */
+    class reader {
+    private:
+        snapshot_publisher* publisher;
+        reader_slot* slot;
+
+        friend class snapshot_publisher;
+
+        reader(snapshot_publisher* p, reader_slot* s) noexcept: publisher(p), slot(s) {}
+
+    public:
+
+        reader(reader const&) = delete;
+        reader& operator=(reader const&) = delete;
+
+        reader(reader&& r) noexcept: publisher(r.publisher), slot(r.slot) {
+            r.slot = nullptr;
+        }
+
+        /**
+         * Frees the slot.
+         */
+        ~reader() {
+            if(slot != nullptr) {
+                slot->epoch.store(idle_epoch, std::memory_order_release);
+                slot->taken.store(false, std::memory_order_release);
+            }
+        }
+
+        /**
+         * Acquire the current version. Wait-free.
+         *
+         * @returns guard of the version
+         * @throws never
+         */
+        guard acquire() const noexcept {
+            assert(slot->epoch.load(std::memory_order_relaxed) == idle_epoch);
+            // Announce the epoch before loading the pointer, so the writer does not reclaim what we load
+            slot->epoch.store(publisher->global_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+            return guard(slot, publisher->current.load(std::memory_order_seq_cst));
+        }
+    };
+
+    /**
+     * Create the publisher with the initial version.
+     *
+     * @param[in] initial     : initial version
+     * @param[in] max_readers : maximal number of registered readers
+     */
+    explicit snapshot_publisher(Q initial = Q(), std::size_t max_readers = 64):
+        current_owner(std::make_shared<const Q>(std::move(initial))), slots(max_readers) {
+        current.store(current_owner.get(), std::memory_order_release);
+    }
+
+    snapshot_publisher(snapshot_publisher const&) = delete;
+    snapshot_publisher& operator=(snapshot_publisher const&) = delete;
+
+    /**
+     * Register new reader.
+     *
+     * @returns reader handle (must not outlive the publisher)
+     * @throws std::length_error when all the slots are taken
+     */
+    reader register_reader() {
+        for(auto& s : slots) {
+            bool expected = false;
+            if(!s.taken.load(std::memory_order_relaxed) && s.taken.compare_exchange_strong(expected, true, std::memory_order_acq_rel)) {
+                return reader(this, &s);
+            }
+        }
+        throw std::length_error("register_reader(): All reader slots are taken.");
+    }
+
+    /**
+     * Publish new version. Writer thread only.
+     * The previous version is retired and destroyed when no reader holds it.
+     *
+     * @param[in] version : new version
+     */
+    void publish(Q version) {
+        auto fresh = std::make_shared<const Q>(std::move(version));
+        retired.reserve(retired.size() + 1);
+
+        const std::uint64_t epoch = global_epoch.load(std::memory_order_relaxed);
+        current.store(fresh.get(), std::memory_order_seq_cst);
+        // Readers announcing later epochs load the pointer after the store above
+        global_epoch.store(epoch + 1, std::memory_order_seq_cst);
+
+        retired.push_back({ epoch, std::move(current_owner) });
+        current_owner = std::move(fresh);
+        reclaim();
+    }
+
+    /**
+     * Destroy retired versions that no reader can hold. Writer thread only.
+     *
+     * @returns number of versions still waiting for readers
+     */
+    std::size_t reclaim() {
+        std::uint64_t oldest = global_epoch.load(std::memory_order_seq_cst);
+        for(auto& s : slots) {
+            const std::uint64_t e = s.epoch.load(std::memory_order_seq_cst);
+            if(e != idle_epoch && e < oldest) {
+                oldest = e;
+            }
+        }
+        // Readers that announced later epochs loaded a newer pointer
+        retired.erase(std::remove_if(retired.begin(), retired.end(), [oldest](retired_version const& r) {
+            return r.epoch < oldest;
+        }), retired.end());
+        return retired.size();
+    }
+
+    /**
+     * Get the current version. Writer thread only.
+     *
+     * @throws never
+     */
+    const Q& latest() const noexcept {
+        return *current_owner;
+    }
+
+    /**
+     * Get the number of retired versions waiting for readers. Writer thread only.
+     *
+     * @throws never
+     */
+    std::size_t pending_versions() const noexcept {
+        return retired.size();
+    }
+};
+
+#endif // _SNAPSHOT_PUBLISHER_